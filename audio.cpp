@@ -0,0 +1,330 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <atomic>
+
+#if defined( __SSE__ )
+#include <xmmintrin.h>
+#endif
+
+#include "SDL.h"
+
+#include "audio.h"
+#include "ay.h"
+#include "speccy.h"
+
+#define AUDIO_RATE 48000
+#define AUDIO_DEVICE_SAMPLES 512
+
+// Each step is a windowed sinc impulse added to a buffer of differences, which is
+// summed to give the samples. The impulse is picked from AUDIO_PHASES offsets
+// between samples, and cut off a little below half the rate.
+#define AUDIO_TAPS 16
+#define AUDIO_PHASES 64
+#define AUDIO_PHASE_BITS 6
+#define AUDIO_CUTOFF 0.9
+
+// The summing leaks, which takes out the speaker's DC level over about 20ms
+#define AUDIO_LEAK 0.999f
+
+#define BEEPER_VOLUME 0.25f
+
+// A frame's samples at up to 192kHz, and room for steps running past its end
+#define AUDIO_FRAME_MAX 4096
+#define AUDIO_DELTA_SIZE ( AUDIO_FRAME_MAX + AUDIO_TAPS * 2 )
+
+// Samples queued for the device, a power of two
+#define AUDIO_RING_SIZE 8192
+#define AUDIO_RING_MASK ( AUDIO_RING_SIZE - 1 )
+
+// Samples wanted in the queue as a frame starts, and silence queued at the start so
+// the device isn't short straight away
+#define AUDIO_TARGET ( AUDIO_DEVICE_SAMPLES * 2 )
+
+// Largest rate adjustment, the weight of each frame in the averaged queue length, and
+// the share of each frame's error added to the steady adjustment for a lasting drift
+#define AUDIO_MAX_ADJUST 0.005
+#define AUDIO_FILL_WEIGHT 0.05
+#define AUDIO_DRIFT_WEIGHT 0.01
+
+// Audio_Wait gives up after this, in case the device has stopped
+#define AUDIO_WAIT_MAX_MS 100
+
+alignas( 16 ) static float s_kernel[AUDIO_PHASES][AUDIO_TAPS];
+alignas( 16 ) static float s_delta[AUDIO_DELTA_SIZE];
+static float s_frame[AUDIO_FRAME_MAX];
+
+static SDL_AudioDeviceID s_device;
+static int s_rate;
+
+// Samples per T-state and the frame's start in s_delta, in 32.32 fixed point
+static uint64_t s_nominalStep;
+static uint64_t s_step;
+static uint64_t s_start;
+static float s_sum;
+static uint8_t s_level;
+
+// head is only written by the emulation and tail only by the callback
+static float s_ring[AUDIO_RING_SIZE];
+static std::atomic<uint32_t> s_head;
+static std::atomic<uint32_t> s_tail;
+static std::atomic<uint32_t> s_overruns;
+static std::atomic<uint32_t> s_underruns;
+static float s_last;
+
+static double s_fill;
+static double s_adjust;
+static double s_drift;
+static bool s_sync;
+static uint32_t s_fillMin = UINT32_MAX;
+static uint32_t s_fillMax;
+static uint32_t s_waitMs;
+
+static void BuildKernel()
+{
+	for( int p = 0; p < AUDIO_PHASES; p++ )
+	{
+		double sum = 0;
+		for( int k = 0; k < AUDIO_TAPS; k++ )
+		{
+			// Centred between the middle taps, the step is delayed by half the kernel
+			double x = k - ( AUDIO_TAPS / 2 - 1 ) - p / (double)AUDIO_PHASES;
+			double sinc = x == 0 ? 1 : sin( M_PI * AUDIO_CUTOFF * x ) / ( M_PI * AUDIO_CUTOFF * x );
+			double window = 0.42 + 0.5 * cos( 2 * M_PI * x / AUDIO_TAPS ) + 0.08 * cos( 4 * M_PI * x / AUDIO_TAPS );
+			s_kernel[p][k] = (float)( sinc * window );
+			sum += s_kernel[p][k];
+		}
+
+		// Every phase adds up to exactly one step
+		for( int k = 0; k < AUDIO_TAPS; k++ )
+			s_kernel[p][k] = (float)( s_kernel[p][k] / sum );
+	}
+}
+
+static void AddStep( uint64_t position, float delta )
+{
+	uint32_t index = (uint32_t)( position >> 32 );
+	if( index > AUDIO_DELTA_SIZE - AUDIO_TAPS )
+		index = AUDIO_DELTA_SIZE - AUDIO_TAPS;
+
+	const float *kernel = s_kernel[( position >> ( 32 - AUDIO_PHASE_BITS ) ) & ( AUDIO_PHASES - 1 )];
+	float *out = s_delta + index;
+
+#if defined( __SSE__ )
+	const __m128 d = _mm_set1_ps( delta );
+	for( int k = 0; k < AUDIO_TAPS; k += 4 )
+		_mm_storeu_ps( out + k, _mm_add_ps( _mm_loadu_ps( out + k ), _mm_mul_ps( d, _mm_load_ps( kernel + k ) ) ) );
+#else
+	for( int k = 0; k < AUDIO_TAPS; k++ )
+		out[k] += delta * kernel[k];
+#endif
+}
+
+static void Push( const float *samples, uint32_t count )
+{
+	uint32_t head = s_head.load( std::memory_order_relaxed );
+	uint32_t space = AUDIO_RING_SIZE - ( head - s_tail.load( std::memory_order_acquire ) );
+	if( count > space )
+	{
+		s_overruns += count - space;
+		count = space;
+	}
+
+	uint32_t first = AUDIO_RING_SIZE - ( head & AUDIO_RING_MASK );
+	if( first > count )
+		first = count;
+	memcpy( s_ring + ( head & AUDIO_RING_MASK ), samples, first * sizeof( float ) );
+	memcpy( s_ring, samples + first, ( count - first ) * sizeof( float ) );
+
+	s_head.store( head + count, std::memory_order_release );
+}
+
+// On SDL's audio thread. When short the last sample is held, which is silent.
+static void Callback( void *userdata, Uint8 *stream, int length )
+{
+	float *out = (float *)stream;
+	uint32_t count = length / sizeof( float );
+
+	uint32_t tail = s_tail.load( std::memory_order_relaxed );
+	uint32_t available = s_head.load( std::memory_order_acquire ) - tail;
+	uint32_t n = available < count ? available : count;
+
+	for( uint32_t i = 0; i < n; i++ )
+		out[i] = s_ring[( tail + i ) & AUDIO_RING_MASK];
+	if( n > 0 )
+		s_last = out[n - 1];
+	s_tail.store( tail + n, std::memory_order_release );
+
+	if( n < count )
+		s_underruns += count - n;
+	for( uint32_t i = n; i < count; i++ )
+		out[i] = s_last;
+}
+
+bool Audio_Init()
+{
+	if( SDL_InitSubSystem( SDL_INIT_AUDIO ) < 0 )
+	{
+		printf( "SDL audio failed: %s\n", SDL_GetError() );
+		return false;
+	}
+
+	SDL_AudioSpec want, have;
+	memset( &want, 0, sizeof( want ) );
+	want.freq = AUDIO_RATE;
+	want.format = AUDIO_F32SYS;
+	want.channels = 1;
+	want.samples = AUDIO_DEVICE_SAMPLES;
+	want.callback = Callback;
+
+	// SDL converts anything else the device wants
+	s_device = SDL_OpenAudioDevice( NULL, 0, &want, &have, 0 );
+	if( s_device == 0 )
+	{
+		printf( "Could not open audio device: %s\n", SDL_GetError() );
+		return false;
+	}
+
+	s_rate = have.freq;
+	s_nominalStep = ( (uint64_t)s_rate << 32 ) / CPU_CLOCK_HZ;
+	s_step = s_nominalStep;
+	s_fill = AUDIO_TARGET;
+	s_adjust = 0;
+	s_drift = 0;
+	s_start = 0;
+	s_sum = 0;
+	s_level = 0;
+	BuildKernel();
+	AY_Init( s_rate );
+	memset( s_delta, 0, sizeof( s_delta ) );
+
+	static const float silence[AUDIO_TARGET] = {};
+	Push( silence, AUDIO_TARGET );
+
+	SDL_PauseAudioDevice( s_device, 0 );
+	return true;
+}
+
+void Audio_Shutdown()
+{
+	if( s_device == 0 )
+		return;
+
+	SDL_CloseAudioDevice( s_device );
+	s_device = 0;
+}
+
+void Audio_EndFrame( const BeeperLog *log, const AYRegisters *ay )
+{
+	if( s_device == 0 )
+		return;
+
+	// From how far the averaged queue is from its target, the averaging hides the
+	// device taking samples in blocks. The error also builds up into s_drift, which
+	// settles on the difference between the clocks so the queue settles on the target.
+	uint32_t queued = s_head.load( std::memory_order_relaxed ) - s_tail.load( std::memory_order_acquire );
+	s_fill += ( queued - s_fill ) * AUDIO_FILL_WEIGHT;
+	s_fillMin = queued < s_fillMin ? queued : s_fillMin;
+	s_fillMax = queued > s_fillMax ? queued : s_fillMax;
+
+	// Paced by the device, Audio_Wait holds the queue at the target from above, so
+	// there's no drift to steer out and steering would only slow the emulation
+	if( s_sync )
+	{
+		s_drift = 0;
+		s_adjust = 0;
+		s_step = s_nominalStep;
+	}
+	else
+	{
+		double error = AUDIO_MAX_ADJUST * ( AUDIO_TARGET - s_fill ) / AUDIO_TARGET;
+		s_drift += error * AUDIO_DRIFT_WEIGHT;
+		if( s_drift > AUDIO_MAX_ADJUST )
+			s_drift = AUDIO_MAX_ADJUST;
+		if( s_drift < -AUDIO_MAX_ADJUST )
+			s_drift = -AUDIO_MAX_ADJUST;
+
+		s_adjust = error + s_drift;
+		if( s_adjust > AUDIO_MAX_ADJUST )
+			s_adjust = AUDIO_MAX_ADJUST;
+		if( s_adjust < -AUDIO_MAX_ADJUST )
+			s_adjust = -AUDIO_MAX_ADJUST;
+		s_step = (uint64_t)( s_nominalStep * ( 1 + s_adjust ) );
+	}
+
+	// The level can change between frames that weren't passed in
+	uint8_t level = log->level;
+	if( level != s_level )
+		AddStep( s_start, level ? BEEPER_VOLUME : -BEEPER_VOLUME );
+
+	uint32_t changes = log->head < BEEPER_LOG_SIZE ? log->head : BEEPER_LOG_SIZE;
+	for( uint32_t i = 0; i < changes; i++ )
+	{
+		level ^= 1;
+		AddStep( s_start + log->tstate[i] * s_step, level ? BEEPER_VOLUME : -BEEPER_VOLUME );
+	}
+	s_level = level;
+
+	uint64_t end = s_start + FRAME_TSTATES * s_step;
+	uint32_t count = (uint32_t)( end >> 32 );
+	if( count > AUDIO_FRAME_MAX )
+		count = AUDIO_FRAME_MAX;
+
+	float sum = s_sum;
+	for( uint32_t i = 0; i < count; i++ )
+	{
+		sum = sum * AUDIO_LEAK + s_delta[i];
+		s_frame[i] = sum;
+	}
+	s_sum = sum;
+
+	// Sample i falls i - s_start samples into the frame
+	if( ay )
+	{
+		double samplesPerTState = s_step / 4294967296.0;
+		AY_Render( ay, s_frame, count, -( s_start / 4294967296.0 ) / samplesPerTState, 1 / samplesPerTState );
+	}
+	Push( s_frame, count );
+
+	// Steps past the end of the frame carry over to the next
+	memmove( s_delta, s_delta + count, AUDIO_TAPS * 2 * sizeof( float ) );
+	memset( s_delta + AUDIO_TAPS * 2, 0, ( AUDIO_DELTA_SIZE - AUDIO_TAPS * 2 ) * sizeof( float ) );
+	s_start = end - ( (uint64_t)count << 32 );
+}
+
+void Audio_SetSync( bool sync )
+{
+	s_sync = sync;
+}
+
+void Audio_Wait()
+{
+	if( s_device == 0 )
+		return;
+
+	uint32_t start = SDL_GetTicks();
+	while( s_head.load( std::memory_order_relaxed ) - s_tail.load( std::memory_order_acquire ) > AUDIO_TARGET )
+	{
+		if( SDL_GetTicks() - start > AUDIO_WAIT_MAX_MS )
+			break;
+		SDL_Delay( 1 );
+	}
+	s_waitMs += SDL_GetTicks() - start;
+}
+
+void Audio_GetStats( AudioStats *stats )
+{
+	stats->queued = (uint32_t)s_fill;
+	stats->queuedMin = s_fillMin == UINT32_MAX ? 0 : s_fillMin;
+	stats->queuedMax = s_fillMax;
+	stats->target = AUDIO_TARGET;
+	stats->adjust = s_adjust;
+	stats->overruns = s_overruns.exchange( 0 );
+	stats->underruns = s_underruns.exchange( 0 );
+	stats->waitMs = s_waitMs;
+
+	s_fillMin = UINT32_MAX;
+	s_fillMax = 0;
+	s_waitMs = 0;
+}
@@ -0,0 +1,44 @@
+#if !defined( AUDIO_H )
+#define AUDIO_H 1
+
+#include <stdint.h>
+
+struct AYRegisters;
+struct BeeperLog;
+
+// Beeper and AY sound through SDL. Each frame's speaker changes become band-limited steps at
+// the device's rate, which are queued for the audio callback through a single
+// producer, single consumer ring so that the callback never waits on the emulation.
+bool Audio_Init();
+void Audio_Shutdown();
+
+// Adds a frame's worth of samples, with the AY's mixed in when ay is set. Frames that
+// aren't passed in, such as while warping, cost nothing, the device plays silence until
+// samples arrive again.
+void Audio_EndFrame( const BeeperLog *log, const AYRegisters *ay );
+
+// Samples are made at a rate nudged by up to half a percent to keep the queue near its
+// target, so latency stays low and constant whatever the drift between the pacing and
+// the device's clock. For pacing by the device's clock instead, Audio_Wait blocks until
+// the queue is down to its target.
+void Audio_Wait();
+
+// Set while Audio_Wait paces the frames, samples are then made at the nominal rate
+void Audio_SetSync( bool sync );
+
+struct AudioStats
+{
+	uint32_t queued;		// samples queued before each frame, averaged
+	uint32_t queuedMin;
+	uint32_t queuedMax;
+	uint32_t target;
+	double adjust;			// rate adjustment, 0.001 is 0.1% more samples per frame
+	uint32_t overruns;		// samples dropped because the queue was full
+	uint32_t underruns;		// samples the device was short of
+	uint32_t waitMs;		// time spent in Audio_Wait
+};
+
+// Figures since the last call
+void Audio_GetStats( AudioStats *stats );
+
+#endif // AUDIO_H
@@ -0,0 +1,333 @@
+#include <math.h>
+#include <string.h>
+
+#if defined( __SSE__ )
+#include <xmmintrin.h>
+#endif
+
+#include "ay.h"
+#include "machine.h"
+
+// The chip runs at half the CPU clock and everything in it counts in steps of eight of
+// its clocks, so it's stepped every 16 T-states. Tones change every period steps, noise
+// and the envelope every two.
+#define AY_TSTATES_PER_STEP 16
+#define AY_FRAME_STEPS ( FRAME_TSTATES / AY_TSTATES_PER_STEP )
+
+// Downsampling is a windowed sinc picked from AY_PHASES offsets between steps, cut off
+// a little below half the device's rate. Steps are kept from the last frame for the
+// filter, and for samples that fall just before the frame starts.
+#define AY_TAPS 32
+#define AY_PHASES 64
+#define AY_CUTOFF 0.9
+#define AY_HISTORY ( AY_TAPS + 8 )
+
+// All three channels at full volume, and how quickly their DC level is taken out
+#define AY_VOLUME 0.15f
+#define AY_DC_WEIGHT 0.001f
+
+enum
+{
+	AY_FINE_A, AY_COARSE_A, AY_FINE_B, AY_COARSE_B, AY_FINE_C, AY_COARSE_C,
+	AY_NOISE, AY_MIXER, AY_LEVEL_A, AY_LEVEL_B, AY_LEVEL_C,
+	AY_ENV_FINE, AY_ENV_COARSE, AY_ENV_SHAPE, AY_PORT_A, AY_PORT_B
+};
+
+#define AY_ENV_HOLD 0x01
+#define AY_ENV_ALTERNATE 0x02
+#define AY_ENV_ATTACK 0x04
+#define AY_ENV_CONTINUE 0x08
+
+static const uint8_t s_regMask[16] =
+{
+	0xff, 0x0f, 0xff, 0x0f, 0xff, 0x0f, 0x1f, 0xff, 0x1f, 0x1f, 0x1f, 0xff, 0xff, 0x0f, 0xff, 0xff
+};
+
+// The DAC's 16 levels, which go up roughly 3dB at a time
+static const float s_level[16] =
+{
+	0.0f, 0.00999f, 0.01448f, 0.02105f, 0.03075f, 0.04557f, 0.06444f, 0.10736f,
+	0.12653f, 0.20498f, 0.29221f, 0.37283f, 0.49253f, 0.63532f, 0.80558f, 1.0f
+};
+
+struct AYGenerator
+{
+	uint8_t reg[16];
+	uint16_t toneCount[3];
+	uint8_t tone[3];
+	uint16_t noiseCount;
+	uint32_t noise;
+	uint32_t envCount;
+	int envStep;
+	uint8_t envInvert;
+	bool envHolding;
+};
+
+static AYGenerator s_gen;
+
+alignas( 16 ) static float s_kernel[AY_PHASES][AY_TAPS];
+alignas( 16 ) static float s_channel[3][AY_FRAME_STEPS];
+alignas( 16 ) static float s_mix[AY_HISTORY + AY_FRAME_STEPS];
+static float s_dc;
+
+static uint8_t PortFFFDRead( ZState *Z, uint16_t addr )
+{
+	AYRegisters *ay = ( (Machine *)Z )->ay;
+	return ay->selected < 16 ? ay->reg[ay->selected] : 0xff;
+}
+
+static void PortFFFDWrite( ZState *Z, uint16_t addr, uint8_t value )
+{
+	( (Machine *)Z )->ay->selected = value;
+}
+
+static void PortBFFDWrite( ZState *Z, uint16_t addr, uint8_t value )
+{
+	Machine *M = (Machine *)Z;
+	AYRegisters *ay = M->ay;
+	if( ay->selected >= 16 )
+		return;
+
+	value &= s_regMask[ay->selected];
+	ay->reg[ay->selected] = value;
+
+	// Logged even when unchanged, writing the shape restarts the envelope
+	AYWrite *w = &ay->write[ay->head & AY_LOG_MASK];
+	w->tstate = Machine_FrameTState( M );
+	w->reg = ay->selected;
+	w->value = value;
+	ay->head++;
+}
+
+void AY_Attach( Machine *M, AYRegisters *ay )
+{
+	memset( ay, 0, sizeof( AYRegisters ) );
+	M->ay = ay;
+
+	// A15 high and A1 low, A14 picks the port. Both come after port 0x7ffd, which
+	// wants A15 low.
+	ZState *Z = &M->Z;
+	ZPeripheral *p = &Z->peripheral[Z->peripheralCount++];
+	p->mask = 0xc002;
+	p->address = 0xc000;
+	p->Read = PortFFFDRead;
+	p->Write = PortFFFDWrite;
+
+	p = &Z->peripheral[Z->peripheralCount++];
+	p->mask = 0xc002;
+	p->address = 0x8000;
+	p->Read = NULL;
+	p->Write = PortBFFDWrite;
+}
+
+static void BuildKernel( int sampleRate )
+{
+	// As a fraction of half the step rate
+	double cutoff = AY_CUTOFF * sampleRate * AY_TSTATES_PER_STEP / CPU_CLOCK_HZ;
+
+	for( int p = 0; p < AY_PHASES; p++ )
+	{
+		double sum = 0;
+		for( int k = 0; k < AY_TAPS; k++ )
+		{
+			// Taps run oldest first, the sample falls p / AY_PHASES after the last and
+			// comes out delayed by half the kernel
+			double x = k + 1 - AY_TAPS / 2 - p / (double)AY_PHASES;
+			double sinc = x == 0 ? 1 : sin( M_PI * cutoff * x ) / ( M_PI * cutoff * x );
+			double window = 0.42 + 0.5 * cos( 2 * M_PI * x / AY_TAPS ) + 0.08 * cos( 4 * M_PI * x / AY_TAPS );
+			s_kernel[p][k] = (float)( sinc * window );
+			sum += s_kernel[p][k];
+		}
+
+		for( int k = 0; k < AY_TAPS; k++ )
+			s_kernel[p][k] = (float)( s_kernel[p][k] / sum );
+	}
+}
+
+void AY_Init( int sampleRate )
+{
+	memset( &s_gen, 0, sizeof( s_gen ) );
+	s_gen.noise = 1;
+	memset( s_mix, 0, sizeof( s_mix ) );
+	s_dc = 0;
+	BuildKernel( sampleRate );
+}
+
+static void WriteRegister( AYGenerator *g, uint8_t reg, uint8_t value )
+{
+	g->reg[reg] = value;
+	if( reg == AY_ENV_SHAPE )
+	{
+		g->envCount = 0;
+		g->envStep = 15;
+		g->envInvert = ( value & AY_ENV_ATTACK ) ? 0x0f : 0;
+		g->envHolding = false;
+	}
+}
+
+static void StepEnvelope( AYGenerator *g )
+{
+	if( g->envHolding || --g->envStep >= 0 )
+		return;
+
+	uint8_t shape = g->reg[AY_ENV_SHAPE];
+	if( ( shape & AY_ENV_CONTINUE ) == 0 )
+	{
+		g->envHolding = true;
+		g->envStep = 0;
+		g->envInvert = 0;
+	}
+	else if( shape & AY_ENV_HOLD )
+	{
+		g->envHolding = true;
+		g->envStep = 0;
+		if( shape & AY_ENV_ALTERNATE )
+			g->envInvert ^= 0x0f;
+	}
+	else
+	{
+		g->envStep = 15;
+		if( shape & AY_ENV_ALTERNATE )
+			g->envInvert ^= 0x0f;
+	}
+}
+
+// Steps the chip from start to end, a channel's level at each step going into s_channel
+static void Generate( AYGenerator *g, uint32_t start, uint32_t end )
+{
+	uint16_t tonePeriod[3];
+	for( int c = 0; c < 3; c++ )
+	{
+		tonePeriod[c] = g->reg[AY_FINE_A + c * 2] | ( g->reg[AY_COARSE_A + c * 2] << 8 );
+		tonePeriod[c] = tonePeriod[c] ? tonePeriod[c] : 1;
+	}
+
+	uint16_t noisePeriod = g->reg[AY_NOISE] ? g->reg[AY_NOISE] * 2 : 2;
+	uint32_t envPeriod = g->reg[AY_ENV_FINE] | ( g->reg[AY_ENV_COARSE] << 8 );
+	envPeriod = envPeriod ? envPeriod * 2 : 2;
+	uint8_t mixer = g->reg[AY_MIXER];
+
+	for( uint32_t i = start; i < end; i++ )
+	{
+		for( int c = 0; c < 3; c++ )
+		{
+			if( ++g->toneCount[c] >= tonePeriod[c] )
+			{
+				g->toneCount[c] = 0;
+				g->tone[c] ^= 1;
+			}
+		}
+
+		// A 17 bit shift register, fed back from bits 0 and 3
+		if( ++g->noiseCount >= noisePeriod )
+		{
+			g->noiseCount = 0;
+			g->noise = ( g->noise >> 1 ) | ( ( ( g->noise ^ ( g->noise >> 3 ) ) & 1 ) << 16 );
+		}
+
+		if( ++g->envCount >= envPeriod )
+		{
+			g->envCount = 0;
+			StepEnvelope( g );
+		}
+
+		uint8_t envelope = (uint8_t)g->envStep ^ g->envInvert;
+		for( int c = 0; c < 3; c++ )
+		{
+			// Disabled tone and noise count as high
+			bool on = ( g->tone[c] | ( mixer >> c ) ) & ( g->noise | ( mixer >> ( c + 3 ) ) ) & 1;
+			uint8_t level = g->reg[AY_LEVEL_A + c];
+			level = ( level & 0x10 ) ? envelope : level & 0x0f;
+			s_channel[c][i] = on ? s_level[level] : 0.0f;
+		}
+	}
+}
+
+static void Mix( float *out, uint32_t count )
+{
+	uint32_t i = 0;
+#if defined( __SSE__ )
+	const __m128 volume = _mm_set1_ps( AY_VOLUME );
+	for( ; i + 4 <= count; i += 4 )
+	{
+		__m128 sum = _mm_add_ps( _mm_load_ps( s_channel[0] + i ), _mm_load_ps( s_channel[1] + i ) );
+		sum = _mm_add_ps( sum, _mm_load_ps( s_channel[2] + i ) );
+		_mm_storeu_ps( out + i, _mm_mul_ps( sum, volume ) );
+	}
+#endif
+	for( ; i < count; i++ )
+		out[i] = ( s_channel[0][i] + s_channel[1][i] + s_channel[2][i] ) * AY_VOLUME;
+}
+
+// The filtered value a fraction of a step after in[0], from the AY_TAPS steps up to it
+static float Filter( const float *in, uint32_t phase )
+{
+	const float *kernel = s_kernel[phase];
+	in -= AY_TAPS - 1;
+
+#if defined( __SSE__ )
+	__m128 sum = _mm_setzero_ps();
+	for( int k = 0; k < AY_TAPS; k += 4 )
+		sum = _mm_add_ps( sum, _mm_mul_ps( _mm_loadu_ps( in + k ), _mm_load_ps( kernel + k ) ) );
+	sum = _mm_add_ps( sum, _mm_movehl_ps( sum, sum ) );
+	sum = _mm_add_ss( sum, _mm_shuffle_ps( sum, sum, 1 ) );
+	return _mm_cvtss_f32( sum );
+#else
+	float sum = 0;
+	for( int k = 0; k < AY_TAPS; k++ )
+		sum += in[k] * kernel[k];
+	return sum;
+#endif
+}
+
+void AY_Render( const AYRegisters *ay, float *out, uint32_t count, double first, double spacing )
+{
+	AYGenerator *g = &s_gen;
+	for( int r = 0; r < 16; r++ )
+	{
+		if( g->reg[r] != ay->start[r] )
+			WriteRegister( g, r, ay->start[r] );
+	}
+
+	// Each write takes effect from the step it falls in
+	uint32_t step = 0;
+	uint32_t writes = ay->head < AY_LOG_SIZE ? ay->head : AY_LOG_SIZE;
+	for( uint32_t i = 0; i < writes; i++ )
+	{
+		const AYWrite *w = &ay->write[i];
+		uint32_t at = w->tstate / AY_TSTATES_PER_STEP;
+		at = at < AY_FRAME_STEPS ? at : AY_FRAME_STEPS;
+		if( at > step )
+		{
+			Generate( g, step, at );
+			step = at;
+		}
+		WriteRegister( g, w->reg, w->value );
+	}
+	Generate( g, step, AY_FRAME_STEPS );
+
+	Mix( s_mix + AY_HISTORY, AY_FRAME_STEPS );
+
+	// The chip's output is never negative, so its average is taken out
+	const float *steps = s_mix + AY_HISTORY;
+	float dc = s_dc;
+	for( uint32_t i = 0; i < count; i++ )
+	{
+		double position = ( first + i * spacing ) / AY_TSTATES_PER_STEP;
+		int index = (int)floor( position );
+		if( index < AY_TAPS - 1 - AY_HISTORY )
+			index = AY_TAPS - 1 - AY_HISTORY;
+		if( index > AY_FRAME_STEPS - 1 )
+			index = AY_FRAME_STEPS - 1;
+
+		uint32_t phase = (uint32_t)( ( position - index ) * AY_PHASES );
+		phase = phase < AY_PHASES ? phase : AY_PHASES - 1;
+
+		float sample = Filter( steps + index, phase );
+		dc += ( sample - dc ) * AY_DC_WEIGHT;
+		out[i] += sample - dc;
+	}
+	s_dc = dc;
+
+	memmove( s_mix, s_mix + AY_FRAME_STEPS, AY_HISTORY * sizeof( float ) );
+}
@@ -0,0 +1,23 @@
+#if !defined( AY_H )
+#define AY_H 1
+
+#include <stdint.h>
+
+struct Machine;
+struct AYRegisters;
+
+// Puts an AY-3-8912 on the 128K's ports, 0xfffd to select a register and read it back
+// and 0xbffd to write it. Writes are kept in ay with their T-state for AY_Render.
+void AY_Attach( Machine *M, AYRegisters *ay );
+
+// Builds the filter for the device's rate
+void AY_Init( int sampleRate );
+
+// Adds the sound of the frame just run to out. The chip's tone, noise and envelope are
+// stepped at its own clock over the whole frame, the channels mixed, and the result
+// filtered down to count samples, the first first T-states from the frame's start and
+// the rest spacing T-states apart. Frames that aren't rendered leave a gap in the sound
+// but not in the registers, which are taken from the frame's start each time.
+void AY_Render( const AYRegisters *ay, float *out, uint32_t count, double first, double spacing );
+
+#endif // AY_H
@@ -0,0 +1,588 @@
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "basic.h"
+#include "machine.h"
+#include "mapfile.h"
+
+#define BASIC_ERR_NR 0x5c3a
+#define BASIC_FLAGS 0x5c3b
+#define BASIC_TV_FLAG 0x5c3c
+#define BASIC_ERR_SP 0x5c3d
+#define BASIC_MODE 0x5c41
+#define BASIC_E_PPC 0x5c49
+#define BASIC_VARS 0x5c4b
+#define BASIC_CHANS 0x5c4f
+#define BASIC_CURCHL 0x5c51
+#define BASIC_PROG 0x5c53
+#define BASIC_NXTLIN 0x5c55
+#define BASIC_DATADD 0x5c57
+#define BASIC_E_LINE 0x5c59
+#define BASIC_K_CUR 0x5c5b
+#define BASIC_CH_ADD 0x5c5d
+#define BASIC_X_PTR 0x5c5f
+#define BASIC_WORKSP 0x5c61
+#define BASIC_STKBOT 0x5c63
+#define BASIC_STKEND 0x5c65
+#define BASIC_MEM 0x5c68
+#define BASIC_FLAGS2 0x5c6a
+#define BASIC_S_TOP 0x5c6c
+#define BASIC_FLAGX 0x5c71
+#define BASIC_MEMBOT 0x5c92
+#define BASIC_RAMTOP 0x5cb2
+
+// MAIN-EXEC lists the program and waits in the editor, the main loop carries on
+// at LINE-SCAN once the editor returns with a line
+#define BASIC_MAIN_EXEC 0x12a2
+#define BASIC_LINE_SCAN_CALL 0x12b4
+
+// DEC-TO-FP, and a HALT for it to return to
+#define BASIC_DEC_TO_FP 0x2c9b
+#define BASIC_HALT 0x1303
+
+// Frames' worth of time allowed for converting a number
+#define BASIC_CONVERT_RUNS 4
+
+// Room the ROM's TEST-ROOM insists on below the machine stack
+#define BASIC_STACK_ROOM 0x50
+
+#define BASIC_MAX_LINE 9999
+
+#define TOKEN_BIN 0xc4
+#define TOKEN_DEF_FN 0xce
+#define TOKEN_REM 0xea
+#define TOKEN_RUN 0xf7
+#define NUMBER_MARKER 0x0e
+
+static const char *const s_keywords[] =
+{
+	"RND", "INKEY$", "PI", "FN", "POINT", "SCREEN$", "ATTR", "AT", "TAB", "VAL$",
+	"CODE", "VAL", "LEN", "SIN", "COS", "TAN", "ASN", "ACS", "ATN", "LN",
+	"EXP", "INT", "SQR", "SGN", "ABS", "PEEK", "IN", "USR", "STR$", "CHR$",
+	"NOT", "BIN", "OR", "AND", "<=", ">=", "<>", "LINE", "THEN", "TO",
+	"STEP", "DEF FN", "CAT", "FORMAT", "MOVE", "ERASE", "OPEN #", "CLOSE #", "MERGE", "VERIFY",
+	"BEEP", "CIRCLE", "INK", "PAPER", "FLASH", "BRIGHT", "INVERSE", "OVER", "OUT", "LPRINT",
+	"LLIST", "STOP", "READ", "DATA", "RESTORE", "NEW", "BORDER", "CONTINUE", "DIM", "REM",
+	"FOR", "GO TO", "GO SUB", "INPUT", "LOAD", "LIST", "LET", "PAUSE", "NEXT", "POKE",
+	"PRINT", "PLOT", "RUN", "SAVE", "RANDOMIZE", "IF", "CLS", "DRAW", "CLEAR", "RETURN",
+	"COPY",
+};
+
+#define FIRST_TOKEN 0xa5
+
+// A tokenised line, with where each number needing the ROM's conversion starts
+struct BasicLine
+{
+	std::vector<uint8_t> bytes;
+	std::vector<size_t> decimals;
+};
+
+static bool IsNameChar( char c )
+{
+	return isalnum( (unsigned char)c ) != 0;
+}
+
+// Length of the keyword at text, or 0. A space in a keyword matches any number of
+// spaces, none included.
+static size_t MatchKeyword( const char *text, const char *end, const char *keyword )
+{
+	const char *p = text;
+	for( ; *keyword; keyword++ )
+	{
+		if( *keyword == ' ' )
+		{
+			while( p < end && *p == ' ' )
+				p++;
+			continue;
+		}
+		if( p == end || toupper( (unsigned char)*p ) != *keyword )
+			return 0;
+		p++;
+	}
+
+	// Words must end there, so that TOTAL isn't TO TAL
+	if( isalpha( (unsigned char)p[-1] ) && p < end && IsNameChar( *p ) )
+		return 0;
+
+	return p - text;
+}
+
+// Longest keyword at text, returns its token or 0
+static uint8_t FindKeyword( const char *text, const char *end, size_t *length )
+{
+	uint8_t token = 0;
+	*length = 0;
+	for( size_t i = 0; i < sizeof( s_keywords ) / sizeof( s_keywords[0] ); i++ )
+	{
+		size_t n = MatchKeyword( text, end, s_keywords[i] );
+		if( n > *length )
+		{
+			*length = n;
+			token = FIRST_TOKEN + i;
+		}
+	}
+	return token;
+}
+
+// Whole numbers up to 65535 have the ROM's small integer form
+static void AppendNumber( std::vector<uint8_t> &out, unsigned value )
+{
+	out.push_back( NUMBER_MARKER );
+	out.insert( out.end(), { 0, 0, (uint8_t)( value & 0xff ), (uint8_t)( value >> 8 ), 0 } );
+}
+
+// Digits, a point and an exponent as the ROM's DEC-TO-FP reads them
+static size_t NumberLength( const char *text, const char *end )
+{
+	const char *p = text;
+	while( p < end && isdigit( (unsigned char)*p ) )
+		p++;
+	if( p < end && *p == '.' )
+	{
+		p++;
+		while( p < end && isdigit( (unsigned char)*p ) )
+			p++;
+	}
+
+	if( p < end && toupper( (unsigned char)*p ) == 'E' )
+	{
+		const char *q = p + 1;
+		if( q < end && ( *q == '+' || *q == '-' ) )
+			q++;
+		if( q < end && isdigit( (unsigned char)*q ) )
+		{
+			while( q < end && isdigit( (unsigned char)*q ) )
+				q++;
+			p = q;
+		}
+	}
+	return p - text;
+}
+
+static const char *SkipSpaces( const char *p, const char *end )
+{
+	while( p < end && *p == ' ' )
+		p++;
+	return p;
+}
+
+// DEF FN's parameters each get five bytes after them for the argument when it's called
+static const char *DefFnParameters( std::vector<uint8_t> &out, const char *p, const char *end )
+{
+	p = SkipSpaces( p, end );
+	if( p == end || !isalpha( (unsigned char)*p ) )
+		return p;
+	out.push_back( *p++ );
+	if( p < end && *p == '$' )
+		out.push_back( *p++ );
+
+	p = SkipSpaces( p, end );
+	if( p == end || *p != '(' )
+		return p;
+	out.push_back( *p++ );
+
+	while( true )
+	{
+		p = SkipSpaces( p, end );
+		if( p == end || !isalpha( (unsigned char)*p ) )
+			return p;
+		out.push_back( *p++ );
+		if( p < end && *p == '$' )
+			out.push_back( *p++ );
+		out.push_back( NUMBER_MARKER );
+		out.insert( out.end(), 5, 0 );
+
+		p = SkipSpaces( p, end );
+		if( p == end || *p != ',' )
+			return p;
+		out.push_back( *p++ );
+	}
+}
+
+// The character at p as the Spectrum has it, with the pound sign and copyright symbol
+// in place of ` and DEL. Returns -1 for anything else outside printable ASCII.
+static int SpectrumChar( const char *p, const char *end, size_t *length )
+{
+	*length = 1;
+	if( (uint8_t)p[0] == 0xc2 && p + 1 < end && ( (uint8_t)p[1] == 0xa3 || (uint8_t)p[1] == 0xa9 ) )
+	{
+		*length = 2;
+		return (uint8_t)p[1] == 0xa3 ? 0x60 : 0x7f;
+	}
+	return p[0] >= 0x20 && p[0] <= 0x7e ? p[0] : -1;
+}
+
+static bool CopyText( std::vector<uint8_t> &out, const char *p, const char *end )
+{
+	while( p < end )
+	{
+		size_t length;
+		int c = SpectrumChar( p, end, &length );
+		if( c < 0 )
+			return false;
+		out.push_back( c );
+		p += length;
+	}
+	return true;
+}
+
+// Tokenises a line's text, without its number, and ends it with ENTER
+static const char *TokeniseLine( BasicLine *line, const char *p, const char *end )
+{
+	std::vector<uint8_t> &out = line->bytes;
+
+	// Spaces either side of a keyword are left out, LIST puts its own in
+	size_t spaces = out.size();
+	bool afterToken = true;
+	bool inName = false;
+
+	while( p < end )
+	{
+		char c = *p;
+		if( c == ' ' )
+		{
+			if( !afterToken )
+				out.push_back( c );
+			inName = false;
+			p++;
+			continue;
+		}
+
+		size_t length;
+		int byte = SpectrumChar( p, end, &length );
+		if( byte < 0 )
+			return "unexpected character";
+
+		// Keywords and numbers only start outside variable names
+		uint8_t token = 0;
+		size_t keywordLength = 0;
+		if( !inName || !isalpha( (unsigned char)c ) )
+			token = FindKeyword( p, end, &keywordLength );
+
+		if( token != 0 )
+		{
+			out.resize( spaces );
+			out.push_back( token );
+			p += keywordLength;
+			afterToken = true;
+			inName = false;
+
+			if( token == TOKEN_REM )
+			{
+				if( !CopyText( out, SkipSpaces( p, end ), end ) )
+					return "unexpected character";
+				p = end;
+			}
+			else if( token == TOKEN_DEF_FN )
+			{
+				p = DefFnParameters( out, p, end );
+				afterToken = false;
+			}
+			else if( token == TOKEN_BIN )
+			{
+				p = SkipSpaces( p, end );
+				double value = 0;
+				for( ; p < end && ( *p == '0' || *p == '1' ); p++ )
+				{
+					out.push_back( *p );
+					value = value * 2 + ( *p - '0' );
+				}
+				if( value > 65535 )
+					return "number too big";
+				AppendNumber( out, (unsigned)value );
+				afterToken = false;
+			}
+			spaces = out.size();
+			continue;
+		}
+
+		afterToken = false;
+		if( c == '"' )
+		{
+			const char *close = (const char *)memchr( p + 1, '"', end - p - 1 );
+			if( close == NULL )
+				return "missing closing quote";
+
+			// A doubled quote is a quote inside the string
+			while( close + 1 < end && close[1] == '"' )
+			{
+				close = (const char *)memchr( close + 2, '"', end - close - 2 );
+				if( close == NULL )
+					return "missing closing quote";
+			}
+			if( !CopyText( out, p, close + 1 ) )
+				return "unexpected character";
+			p = close + 1;
+		}
+		else if( !inName && ( isdigit( (unsigned char)c ) || ( c == '.' && p + 1 < end && isdigit( (unsigned char)p[1] ) ) ) )
+		{
+			size_t n = NumberLength( p, end );
+			std::string text( p, n );
+			double value = strtod( text.c_str(), NULL );
+			if( value >= ldexp( 1.0, 127 ) )
+				return "number too big";
+
+			// Anything but a small whole number is left for the ROM to convert
+			bool small = strspn( text.c_str(), "0123456789" ) == n && value <= 65535;
+			if( !small )
+				line->decimals.push_back( out.size() );
+			out.insert( out.end(), p, p + n );
+			AppendNumber( out, small ? (unsigned)value : 0 );
+			p += n;
+		}
+		else
+		{
+			out.push_back( byte );
+			inName = IsNameChar( c );
+			p += length;
+		}
+		spaces = out.size();
+	}
+
+	out.resize( spaces );
+	out.push_back( 0x0d );
+	return NULL;
+}
+
+// The whole program as it sits from PROG, line numbers big endian then the length
+static bool Tokenise( BasicLine *program, int *firstLine, const char *text, size_t size )
+{
+	std::map<int, BasicLine> lines;
+	const char *end = text + size;
+	int lineCount = 0;
+
+	for( const char *p = text; p < end; )
+	{
+		const char *eol = (const char *)memchr( p, '\n', end - p );
+		const char *next = eol ? eol + 1 : end;
+		if( eol == NULL )
+			eol = end;
+		lineCount++;
+
+		// Tabs count as spaces, trailing blanks and carriage returns are dropped
+		std::string line( p, eol );
+		for( char &c : line )
+			if( c == '\t' )
+				c = ' ';
+		while( !line.empty() && ( line.back() == ' ' || line.back() == '\r' ) )
+			line.pop_back();
+		p = next;
+
+		const char *s = SkipSpaces( line.data(), line.data() + line.size() );
+		const char *e = line.data() + line.size();
+		if( s == e )
+			continue;
+
+		if( !isdigit( (unsigned char)*s ) )
+		{
+			printf( "Line %d: line number expected\n", lineCount );
+			return false;
+		}
+		int number = 0;
+		while( s < e && isdigit( (unsigned char)*s ) && number <= BASIC_MAX_LINE )
+			number = number * 10 + ( *s++ - '0' );
+		if( number > BASIC_MAX_LINE )
+		{
+			printf( "Line %d: line number over %d\n", lineCount, BASIC_MAX_LINE );
+			return false;
+		}
+
+		// A number on its own deletes the line, as it does when typed
+		s = SkipSpaces( s, e );
+		if( s == e )
+		{
+			lines.erase( number );
+			continue;
+		}
+
+		BasicLine body;
+		const char *error = TokeniseLine( &body, s, e );
+		if( error != NULL )
+		{
+			printf( "Line %d: %s\n", lineCount, error );
+			return false;
+		}
+		lines[number] = body;
+	}
+
+	*firstLine = lines.empty() ? 0 : lines.begin()->first;
+	for( auto &line : lines )
+	{
+		std::vector<uint8_t> &bytes = program->bytes;
+		size_t length = line.second.bytes.size();
+		bytes.push_back( line.first >> 8 );
+		bytes.push_back( line.first & 0xff );
+		bytes.push_back( length & 0xff );
+		bytes.push_back( length >> 8 );
+		for( size_t offset : line.second.decimals )
+			program->decimals.push_back( bytes.size() + offset );
+		bytes.insert( bytes.end(), line.second.bytes.begin(), line.second.bytes.end() );
+	}
+	return true;
+}
+
+static uint16_t Peek16( ZState *Z, uint16_t address )
+{
+	return Z80_ReadMemory( Z, address ) | ( Z80_ReadMemory( Z, address + 1 ) << 8 );
+}
+
+static void Poke16( ZState *Z, uint16_t address, uint16_t value )
+{
+	Z80_WriteMemory( Z, address, value & 0xff );
+	Z80_WriteMemory( Z, address + 1, value >> 8 );
+}
+
+static void PokeBytes( ZState *Z, uint16_t address, const uint8_t *bytes, size_t size )
+{
+	for( size_t i = 0; i < size; i++ )
+		Z80_WriteMemory( Z, address + i, bytes[i] );
+}
+
+// Numbers other than small whole ones go through the ROM's own DEC-TO-FP, as when a
+// line is typed, since its result isn't always the closest and programs can tell.
+// The text is copied to the workspace and converted onto the calculator stack, with
+// both the return and any error report ending at a HALT.
+static bool RomNumber( ZState *Z, uint16_t workspace, uint16_t ramtop, const uint8_t *text, size_t length, uint8_t *bytes )
+{
+	PokeBytes( Z, workspace, text, length );
+	Z80_WriteMemory( Z, workspace + length, 0x0d );
+
+	uint16_t stack = workspace + length + 1;
+	Poke16( Z, BASIC_CH_ADD, workspace );
+	Poke16( Z, BASIC_STKBOT, stack );
+	Poke16( Z, BASIC_STKEND, stack );
+	Poke16( Z, BASIC_MEM, BASIC_MEMBOT );
+	Z80_WriteMemory( Z, BASIC_ERR_NR, 0xff );
+
+	Z->reg.SP = ramtop - 3;
+	Poke16( Z, Z->reg.SP, BASIC_HALT );
+	Poke16( Z, BASIC_ERR_SP, Z->reg.SP );
+	Z->reg.IY = 0x5c3a;
+	Z->reg.A = text[0];
+	Z->reg.PC = BASIC_DEC_TO_FP;
+	Z->IFF0 = Z->IFF1 = 0;
+	Z->halted = false;
+
+	for( int i = 0; i < BASIC_CONVERT_RUNS && !Z->halted; i++ )
+		Z80_Run( Z, FRAME_TSTATES );
+
+	if( !Z->halted || Z80_ReadMemory( Z, BASIC_ERR_NR ) != 0xff || Peek16( Z, BASIC_STKEND ) != stack + 5 )
+		return false;
+
+	for( int i = 0; i < 5; i++ )
+		bytes[i] = Z80_ReadMemory( Z, stack + i );
+	return true;
+}
+
+bool Basic_Inject( Machine *M, const char *text, size_t length, int autoRunLine )
+{
+	BasicLine program;
+	int firstLine;
+	if( !Tokenise( &program, &firstLine, text, length ) )
+		return false;
+
+	// The edit line after the variables is either empty or holds RUN and the line
+	std::vector<uint8_t> edit;
+	if( autoRunLine >= 0 )
+	{
+		char digits[16];
+		snprintf( digits, sizeof( digits ), "%d", autoRunLine );
+		edit.push_back( TOKEN_RUN );
+		edit.insert( edit.end(), digits, digits + strlen( digits ) );
+	}
+	edit.push_back( 0x0d );
+	edit.push_back( 0x80 );
+
+	ZState *Z = &M->Z;
+	std::vector<uint8_t> &bytes = program.bytes;
+	uint16_t prog = Peek16( Z, BASIC_PROG );
+	uint16_t ramtop = Peek16( Z, BASIC_RAMTOP );
+	uint32_t vars = prog + bytes.size();
+	uint32_t eLine = vars + 1;
+	uint32_t worksp = eLine + edit.size();
+	if( worksp + BASIC_STACK_ROOM > (uint32_t)ramtop - 3 )
+	{
+		printf( "Program too big, %d bytes\n", (int)bytes.size() );
+		return false;
+	}
+
+	int cycles = Z->cycles;
+	for( size_t offset : program.decimals )
+	{
+		size_t marker = offset;
+		while( bytes[marker] != NUMBER_MARKER )
+			marker++;
+
+		if( worksp + ( marker - offset ) + BASIC_STACK_ROOM > (uint32_t)ramtop - 3 )
+		{
+			printf( "Program too big, %d bytes\n", (int)bytes.size() );
+			Z->cycles = cycles;
+			return false;
+		}
+
+		if( !RomNumber( Z, worksp, ramtop, &bytes[offset], marker - offset, &bytes[marker + 1] ) )
+		{
+			std::string number( bytes.begin() + offset, bytes.begin() + marker );
+			printf( "Could not convert number %s\n", number.c_str() );
+			Z->cycles = cycles;
+			return false;
+		}
+	}
+	Z->cycles = cycles;
+
+	PokeBytes( Z, prog, bytes.data(), bytes.size() );
+	Z80_WriteMemory( Z, vars, 0x80 );
+	PokeBytes( Z, eLine, edit.data(), edit.size() );
+
+	// As SET-MIN leaves them, with an empty calculator stack and workspace
+	Poke16( Z, BASIC_VARS, vars );
+	Poke16( Z, BASIC_E_LINE, eLine );
+	Poke16( Z, BASIC_K_CUR, worksp - 2 );
+	Poke16( Z, BASIC_CH_ADD, eLine );
+	Poke16( Z, BASIC_X_PTR, 0 );
+	Poke16( Z, BASIC_WORKSP, worksp );
+	Poke16( Z, BASIC_STKBOT, worksp );
+	Poke16( Z, BASIC_STKEND, worksp );
+	Poke16( Z, BASIC_MEM, BASIC_MEMBOT );
+	Poke16( Z, BASIC_NXTLIN, vars );
+	Poke16( Z, BASIC_DATADD, prog - 1 );
+	Poke16( Z, BASIC_E_PPC, firstLine );
+	Poke16( Z, BASIC_S_TOP, 0 );
+
+	// CHAN-OPEN for the keyboard channel, and out of any INPUT
+	Poke16( Z, BASIC_CURCHL, Peek16( Z, BASIC_CHANS ) );
+	Z80_WriteMemory( Z, BASIC_TV_FLAG, Z80_ReadMemory( Z, BASIC_TV_FLAG ) | 0x01 );
+	Z80_WriteMemory( Z, BASIC_FLAGS, Z80_ReadMemory( Z, BASIC_FLAGS ) & ~0x22 );
+	Z80_WriteMemory( Z, BASIC_FLAGS2, Z80_ReadMemory( Z, BASIC_FLAGS2 ) | 0x10 );
+	Z80_WriteMemory( Z, BASIC_FLAGX, 0 );
+	Z80_WriteMemory( Z, BASIC_MODE, 0 );
+	Z80_WriteMemory( Z, BASIC_ERR_NR, 0xff );
+
+	// Back to the main loop with its stack as the ROM's initialisation sets it
+	Z->reg.SP = ramtop - 1;
+	Poke16( Z, BASIC_ERR_SP, ramtop - 3 );
+	Z->reg.IY = 0x5c3a;
+	Z->reg.PC = autoRunLine >= 0 ? BASIC_LINE_SCAN_CALL : BASIC_MAIN_EXEC;
+	Z->IMODE = 1;
+	Z->IFF0 = Z->IFF1 = 1;
+	Z->halted = false;
+	return true;
+}
+
+bool Basic_Load( Machine *M, const char *name, int autoRunLine )
+{
+	MappedFile file;
+	if( !MapFile_Open( &file, name ) )
+		return false;
+
+	bool ok = Basic_Inject( M, (const char *)file.data, file.size, autoRunLine );
+	MapFile_Close( &file );
+	return ok;
+}
@@ -0,0 +1,21 @@
+#if !defined( BASIC_H )
+#define BASIC_H 1
+
+#include <stddef.h>
+
+struct Machine;
+
+// Tokenises a plain text BASIC listing and writes it straight into the program area,
+// replacing any program and variables and fixing up the system variables after it.
+// Each line starts with its number and keywords are spelt out, in either case, with
+// GO TO, GO SUB and DEF FN allowed without their space. Numbers get their hidden five
+// byte form, and lines are put in order with a repeated number replacing the earlier
+// line. Text in quotes and after REM is kept as it is.
+//
+// With autoRunLine zero or more the program is then run from that line as if RUN had
+// been typed, otherwise the machine is left at the editor with the program listed.
+// The 48K ROM is assumed to be paged in. Errors are printed with the line they're on.
+bool Basic_Inject( Machine *M, const char *text, size_t length, int autoRunLine );
+bool Basic_Load( Machine *M, const char *name, int autoRunLine );
+
+#endif // BASIC_H
@@ -0,0 +1,134 @@
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <mutex>
+
+#include "boot.h"
+#include "hash.h"
+
+// The bottom character row, where the copyright message starts with a (c) and ends
+// with the d of Ltd. The ROM is waiting for a key once the d is there.
+#define PROMPT_ROW 0x50e0
+#define PROMPT_LAST_COLUMN 27
+#define ROM_CHARSET 0x3d00
+#define CHAR_COPYRIGHT 0x7f
+
+static std::mutex s_mutex;
+static MachineState s_state;
+static uint64_t s_romHash;
+static bool s_valid;
+
+// Versioned as a state from a build with other timing would run on differently
+static void CacheName( char *name, size_t size, const char *cacheDir, uint64_t romHash )
+{
+	snprintf( name, size, "%s/boot_%016llx_%d_%d.state", cacheDir, (unsigned long long)romHash,
+		MACHINE_STATE_VERSION, MACHINE_TIMING_VERSION );
+}
+
+static bool CharacterAt( Machine *M, int column, uint8_t c )
+{
+	for( int i = 0; i < 8; i++ )
+	{
+		if( Z80_ReadMemory( &M->Z, PROMPT_ROW + i * 0x100 + column ) != M->rom[ROM_CHARSET + ( c - ' ' ) * 8 + i] )
+			return false;
+	}
+	return true;
+}
+
+static bool AtPrompt( Machine *M )
+{
+	return CharacterAt( M, 0, CHAR_COPYRIGHT ) && CharacterAt( M, PROMPT_LAST_COLUMN, 'd' );
+}
+
+// Each missing directory along the path, so the cache can go anywhere
+static void MakeDirectories( const char *path )
+{
+	char dir[1024];
+	snprintf( dir, sizeof( dir ), "%s", path );
+	for( char *p = dir + 1; *p; p++ )
+	{
+		if( *p != '/' )
+			continue;
+		*p = 0;
+		mkdir( dir, 0755 );
+		*p = '/';
+	}
+	mkdir( dir, 0755 );
+}
+
+static bool ReadCache( Machine *M, const char *cacheDir, uint64_t romHash )
+{
+	char name[1024];
+	CacheName( name, sizeof( name ), cacheDir, romHash );
+
+	FILE *fp = fopen( name, "rb" );
+	if( fp == NULL )
+		return false;
+
+	bool ok = fread( &s_state, sizeof( s_state ), 1, fp ) == 1 && Machine_RestoreState( M, &s_state ) && AtPrompt( M );
+	fclose( fp );
+	return ok;
+}
+
+// Written under another name and renamed, so other processes never see part of it
+static void WriteCache( const char *cacheDir, uint64_t romHash )
+{
+	char name[1024], temp[1024 + 32];
+	CacheName( name, sizeof( name ), cacheDir, romHash );
+	snprintf( temp, sizeof( temp ), "%s.%d", name, (int)getpid() );
+
+	MakeDirectories( cacheDir );
+	FILE *fp = fopen( temp, "wb" );
+	if( fp == NULL )
+		return;
+
+	bool ok = fwrite( &s_state, sizeof( s_state ), 1, fp ) == 1;
+	ok = fclose( fp ) == 0 && ok;
+	if( !ok || rename( temp, name ) != 0 )
+		remove( temp );
+}
+
+bool Boot_Machine( Machine *M, const char *cacheDir )
+{
+	std::lock_guard<std::mutex> lock( s_mutex );
+
+	uint64_t romHash = Hash_Bytes( M->rom, MACHINE_ROM_SIZE, HASH_SEED );
+	if( s_valid && s_romHash == romHash && Machine_RestoreState( M, &s_state ) )
+		return true;
+
+	s_valid = false;
+	if( cacheDir == NULL || !ReadCache( M, cacheDir, romHash ) )
+	{
+		Machine_Reset( M );
+		for( int i = 0; i < BOOT_MAX_FRAMES && !AtPrompt( M ); i++ )
+			Machine_RunFrame( M, NULL, NULL );
+		if( !AtPrompt( M ) )
+			return false;
+
+		Machine_SaveState( M, &s_state );
+		if( cacheDir != NULL )
+			WriteCache( cacheDir, romHash );
+	}
+
+	s_romHash = romHash;
+	s_valid = true;
+	return true;
+}
+
+const char *Boot_CacheDir()
+{
+	static char dir[1024];
+
+	const char *cache = getenv( "XDG_CACHE_HOME" );
+	const char *home = getenv( "HOME" );
+	if( cache != NULL && cache[0] == '/' )
+		snprintf( dir, sizeof( dir ), "%s/speccy", cache );
+	else if( home != NULL && home[0] != 0 )
+		snprintf( dir, sizeof( dir ), "%s/.cache/speccy", home );
+	else
+		return NULL;
+
+	return dir;
+}
@@ -0,0 +1,20 @@
+#if !defined( BOOT_H )
+#define BOOT_H 1
+
+#include "machine.h"
+
+// Frames from reset to wait for the copyright message, it appears after about 85
+#define BOOT_MAX_FRAMES 300
+
+// Puts M, set up by Machine_Init, at the ROM's ready prompt. The state there is made
+// once by running from reset until the copyright message is on the screen, then kept
+// in memory and in a file in cacheDir ( if not NULL ) named by the ROM's hash and the
+// state and timing versions, so later boots are a copy. Returns false if the message
+// never appears. Traps are global, so boot before setting any that change what the
+// ROM does.
+bool Boot_Machine( Machine *M, const char *cacheDir );
+
+// $XDG_CACHE_HOME/speccy or ~/.cache/speccy, NULL if neither can be found
+const char *Boot_CacheDir();
+
+#endif // BOOT_H
@@ -0,0 +1,2049 @@
+#include <setjmp.h>
+
+#include "calc.h"
+#include "machine.h"
+#include "hash.h"
+
+// Hash of the 48K ROM the routines below are transcribed from
+#define CALC_ROM_HASH 0xacd853ea10ff3d49ull
+
+#define CALC_RE_ENTRY 0x3365
+#define CALC_TABLE 0x32d7
+#define CALC_CONSTANTS 0x32c5
+
+#define CALC_STKEND 0x5c65
+#define CALC_BREG 0x5c67
+#define CALC_MEM 0x5c68
+
+#define OP_RST_28 0xef
+#define OP_RET 0xc9
+
+// Memory writes one literal can make before it is left to the ROM
+#define CALC_UNDO_SIZE 1024
+
+// Literals run per trap at the top level, and in all including nested calculator code
+#define CALC_MAX_LITERALS 256
+#define CALC_MAX_NESTED 4096
+
+// The Z80 state a routine works on. Only the carry, zero and sign flags are kept,
+// in place of F, as nothing in the calculator looks at the others.
+struct Calc
+{
+	ZState *Z;
+	RegisterSet *r;
+
+	bool carry;
+	bool zero;
+	bool sign;
+
+	// Set by end-calc with the address it returns to
+	bool exit;
+	uint16_t exitPC;
+
+	int literals;
+
+	int undoCount;
+	uint16_t undoAddress[CALC_UNDO_SIZE];
+	uint8_t undoValue[CALC_UNDO_SIZE];
+
+	jmp_buf bail;
+};
+
+static const uint8_t *s_rom;
+
+// Gives up on the literal, the trap puts memory and registers back and the ROM runs it
+static void Bail( Calc *c )
+{
+	longjmp( c->bail, 1 );
+}
+
+static void Undo( Calc *c )
+{
+	while( c->undoCount > 0 )
+	{
+		c->undoCount--;
+		Z80_WriteMemory( c->Z, c->undoAddress[c->undoCount], c->undoValue[c->undoCount] );
+	}
+}
+
+static uint8_t Peek( Calc *c, uint16_t address )
+{
+	return Z80_ReadMemory( c->Z, address );
+}
+
+static void Poke( Calc *c, uint16_t address, uint8_t value )
+{
+	if( c->undoCount == CALC_UNDO_SIZE )
+		Bail( c );
+
+	c->undoAddress[c->undoCount] = address;
+	c->undoValue[c->undoCount] = Peek( c, address );
+	c->undoCount++;
+
+	Z80_WriteMemory( c->Z, address, value );
+}
+
+static uint16_t Peek16( Calc *c, uint16_t address )
+{
+	return Peek( c, address ) | ( Peek( c, address + 1 ) << 8 );
+}
+
+static void Poke16( Calc *c, uint16_t address, uint16_t value )
+{
+	Poke( c, address, value & 0xff );
+	Poke( c, address + 1, value >> 8 );
+}
+
+static void Push( Calc *c, uint16_t value )
+{
+	c->r->SP -= 2;
+	Poke16( c, c->r->SP, value );
+}
+
+static uint16_t Pop( Calc *c )
+{
+	uint16_t value = Peek16( c, c->r->SP );
+	c->r->SP += 2;
+	return value;
+}
+
+static void PushAF( Calc *c )
+{
+	c->r->F = ( c->r->F & ~( M_S | M_Z | M_C ) ) | ( c->sign ? M_S : 0 ) | ( c->zero ? M_Z : 0 ) | ( c->carry ? M_C : 0 );
+	Push( c, c->r->AF );
+}
+
+static void PopAF( Calc *c )
+{
+	c->r->AF = Pop( c );
+	c->sign = ( c->r->F & M_S ) != 0;
+	c->zero = ( c->r->F & M_Z ) != 0;
+	c->carry = ( c->r->F & M_C ) != 0;
+}
+
+// Return addresses are never looked at, so calls only move SP and every routine
+// ends with Ret as the ROM's do
+static void Call( Calc *c, void (*routine)( Calc * ) )
+{
+	c->r->SP -= 2;
+	routine( c );
+}
+
+static void Ret( Calc *c )
+{
+	c->r->SP += 2;
+}
+
+static void Exx( Calc *c )
+{
+	RegisterSet *r = c->r;
+	RegisterSet *s = &c->Z->sreg;
+
+	uint16_t t;
+	t = r->BC; r->BC = s->BC; s->BC = t;
+	t = r->DE; r->DE = s->DE; s->DE = t;
+	t = r->HL; r->HL = s->HL; s->HL = t;
+}
+
+static void ExDeHl( Calc *c )
+{
+	uint16_t t = c->r->DE;
+	c->r->DE = c->r->HL;
+	c->r->HL = t;
+}
+
+static void ExSpHl( Calc *c )
+{
+	uint16_t t = Peek16( c, c->r->SP );
+	Poke16( c, c->r->SP, c->r->HL );
+	c->r->HL = t;
+}
+
+static void Ldir( Calc *c )
+{
+	RegisterSet *r = c->r;
+	do
+	{
+		Poke( c, r->DE++, Peek( c, r->HL++ ) );
+	}
+	while( --r->BC );
+}
+
+static uint8_t SetSZ( Calc *c, uint8_t value )
+{
+	c->zero = value == 0;
+	c->sign = ( value & 0x80 ) != 0;
+	return value;
+}
+
+static uint8_t Add8( Calc *c, uint8_t a, uint8_t b, bool carry )
+{
+	unsigned sum = a + b + ( carry ? 1 : 0 );
+	c->carry = sum > 0xff;
+	return SetSZ( c, (uint8_t)sum );
+}
+
+static uint8_t Sub8( Calc *c, uint8_t a, uint8_t b, bool carry )
+{
+	int diff = a - b - ( carry ? 1 : 0 );
+	c->carry = diff < 0;
+	return SetSZ( c, (uint8_t)diff );
+}
+
+static void Add( Calc *c, uint8_t v ) { c->r->A = Add8( c, c->r->A, v, false ); }
+static void Adc( Calc *c, uint8_t v ) { c->r->A = Add8( c, c->r->A, v, c->carry ); }
+static void Sub( Calc *c, uint8_t v ) { c->r->A = Sub8( c, c->r->A, v, false ); }
+static void Sbc( Calc *c, uint8_t v ) { c->r->A = Sub8( c, c->r->A, v, c->carry ); }
+static void Cp( Calc *c, uint8_t v ) { Sub8( c, c->r->A, v, false ); }
+static void Neg( Calc *c ) { c->r->A = Sub8( c, 0, c->r->A, false ); }
+static void Cpl( Calc *c ) { c->r->A = ~c->r->A; }
+
+static void And( Calc *c, uint8_t v ) { c->carry = false; c->r->A = SetSZ( c, c->r->A & v ); }
+static void Or( Calc *c, uint8_t v ) { c->carry = false; c->r->A = SetSZ( c, c->r->A | v ); }
+static void Xor( Calc *c, uint8_t v ) { c->carry = false; c->r->A = SetSZ( c, c->r->A ^ v ); }
+
+static uint8_t Inc8( Calc *c, uint8_t v ) { return SetSZ( c, v + 1 ); }
+static uint8_t Dec8( Calc *c, uint8_t v ) { return SetSZ( c, v - 1 ); }
+
+static void IncAtHL( Calc *c ) { Poke( c, c->r->HL, Inc8( c, Peek( c, c->r->HL ) ) ); }
+
+// The accumulator rotates only change the carry
+static void Rlca( Calc *c )
+{
+	uint8_t a = c->r->A;
+	c->carry = ( a & 0x80 ) != 0;
+	c->r->A = ( a << 1 ) | ( a >> 7 );
+}
+
+static void Rrca( Calc *c )
+{
+	uint8_t a = c->r->A;
+	c->carry = ( a & 1 ) != 0;
+	c->r->A = ( a >> 1 ) | ( a << 7 );
+}
+
+static void Rla( Calc *c )
+{
+	uint8_t a = c->r->A;
+	c->r->A = ( a << 1 ) | ( c->carry ? 1 : 0 );
+	c->carry = ( a & 0x80 ) != 0;
+}
+
+static void Rra( Calc *c )
+{
+	uint8_t a = c->r->A;
+	c->r->A = ( a >> 1 ) | ( c->carry ? 0x80 : 0 );
+	c->carry = ( a & 1 ) != 0;
+}
+
+static uint8_t Rl( Calc *c, uint8_t v )
+{
+	uint8_t result = ( v << 1 ) | ( c->carry ? 1 : 0 );
+	c->carry = ( v & 0x80 ) != 0;
+	return SetSZ( c, result );
+}
+
+static uint8_t Rr( Calc *c, uint8_t v )
+{
+	uint8_t result = ( v >> 1 ) | ( c->carry ? 0x80 : 0 );
+	c->carry = ( v & 1 ) != 0;
+	return SetSZ( c, result );
+}
+
+static uint8_t Rrc( Calc *c, uint8_t v )
+{
+	c->carry = ( v & 1 ) != 0;
+	return SetSZ( c, ( v >> 1 ) | ( v << 7 ) );
+}
+
+static uint8_t Sla( Calc *c, uint8_t v )
+{
+	c->carry = ( v & 0x80 ) != 0;
+	return SetSZ( c, v << 1 );
+}
+
+static uint8_t Sra( Calc *c, uint8_t v )
+{
+	c->carry = ( v & 1 ) != 0;
+	return SetSZ( c, ( v >> 1 ) | ( v & 0x80 ) );
+}
+
+static uint8_t Srl( Calc *c, uint8_t v )
+{
+	c->carry = ( v & 1 ) != 0;
+	return SetSZ( c, v >> 1 );
+}
+
+static void Bit( Calc *c, int bit, uint8_t v )
+{
+	c->zero = ( v & ( 1 << bit ) ) == 0;
+}
+
+static void AddHL( Calc *c, uint16_t v )
+{
+	uint32_t sum = c->r->HL + v;
+	c->carry = sum > 0xffff;
+	c->r->HL = (uint16_t)sum;
+}
+
+static void AdcHL( Calc *c, uint16_t v )
+{
+	uint32_t sum = c->r->HL + v + ( c->carry ? 1 : 0 );
+	c->carry = sum > 0xffff;
+	c->r->HL = (uint16_t)sum;
+	c->zero = c->r->HL == 0;
+	c->sign = ( c->r->HL & 0x8000 ) != 0;
+}
+
+static void SbcHL( Calc *c, uint16_t v )
+{
+	int32_t diff = c->r->HL - v - ( c->carry ? 1 : 0 );
+	c->carry = diff < 0;
+	c->r->HL = (uint16_t)diff;
+	c->zero = c->r->HL == 0;
+	c->sign = ( c->r->HL & 0x8000 ) != 0;
+}
+
+static void Routine( Calc *c, uint16_t address );
+static void TestNorm( Calc *c );
+
+// TEST-ROOM 1F05, an out of memory report is left to the ROM
+static void TestRoom( Calc *c )
+{
+	RegisterSet *r = c->r;
+	r->HL = Peek16( c, CALC_STKEND );
+	AddHL( c, r->BC );
+	if( c->carry )
+		Bail( c );
+	ExDeHl( c );
+	r->HL = 0x0050;
+	AddHL( c, r->DE );
+	if( c->carry )
+		Bail( c );
+	SbcHL( c, r->SP );
+	if( !c->carry )
+		Bail( c );
+	Ret( c );
+}
+
+// INT-FETCH 2D7F
+static void IntFetch( Calc *c )
+{
+	RegisterSet *r = c->r;
+	r->HL++;
+	r->C = Peek( c, r->HL );
+	r->HL++;
+	r->A = Peek( c, r->HL );
+	Xor( c, r->C );
+	Sub( c, r->C );
+	r->E = r->A;
+	r->HL++;
+	r->A = Peek( c, r->HL );
+	Adc( c, r->C );
+	Xor( c, r->C );
+	r->D = r->A;
+	Ret( c );
+}
+
+// INT-STORE 2D8E
+static void IntStore( Calc *c )
+{
+	RegisterSet *r = c->r;
+	Push( c, r->HL );
+	Poke( c, r->HL, 0 );
+	r->HL++;
+	Poke( c, r->HL, r->C );
+	r->HL++;
+	r->A = r->E;
+	Xor( c, r->C );
+	Sub( c, r->C );
+	Poke( c, r->HL, r->A );
+	r->HL++;
+	r->A = r->D;
+	Adc( c, r->C );
+	Xor( c, r->C );
+	Poke( c, r->HL, r->A );
+	r->HL++;
+	Poke( c, r->HL, 0 );
+	r->HL = Pop( c );
+	Ret( c );
+}
+
+// PREP-ADD 2F9B
+static void PrepAdd( Calc *c )
+{
+	RegisterSet *r = c->r;
+	r->A = Peek( c, r->HL );
+	Poke( c, r->HL, 0 );
+	And( c, r->A );
+	if( c->zero )
+	{
+		Ret( c );
+		return;
+	}
+	r->HL++;
+	Bit( c, 7, Peek( c, r->HL ) );
+	Poke( c, r->HL, Peek( c, r->HL ) | 0x80 );
+	r->HL--;
+	if( c->zero )
+	{
+		Ret( c );
+		return;
+	}
+	Push( c, r->BC );
+	r->BC = 5;
+	AddHL( c, r->BC );
+	r->B = r->C;
+	r->C = r->A;
+	c->carry = true;
+	do
+	{
+		r->HL--;
+		r->A = Peek( c, r->HL );
+		Cpl( c );
+		Adc( c, 0 );
+		Poke( c, r->HL, r->A );
+	}
+	while( --r->B );
+	r->A = r->C;
+	r->BC = Pop( c );
+	Ret( c );
+}
+
+// FETCH-TWO 2FBA
+static void FetchTwo( Calc *c )
+{
+	RegisterSet *r = c->r;
+	Push( c, r->HL );
+	PushAF( c );
+	r->C = Peek( c, r->HL );
+	r->HL++;
+	r->B = Peek( c, r->HL );
+	Poke( c, r->HL, r->A );
+	r->HL++;
+	r->A = r->C;
+	r->C = Peek( c, r->HL );
+	Push( c, r->BC );
+	r->HL++;
+	r->C = Peek( c, r->HL );
+	r->HL++;
+	r->B = Peek( c, r->HL );
+	ExDeHl( c );
+	r->D = r->A;
+	r->E = Peek( c, r->HL );
+	Push( c, r->DE );
+	r->HL++;
+	r->D = Peek( c, r->HL );
+	r->HL++;
+	r->E = Peek( c, r->HL );
+	Push( c, r->DE );
+	Exx( c );
+	r->DE = Pop( c );
+	r->HL = Pop( c );
+	r->BC = Pop( c );
+	Exx( c );
+	r->HL++;
+	r->D = Peek( c, r->HL );
+	r->HL++;
+	r->E = Peek( c, r->HL );
+	PopAF( c );
+	r->HL = Pop( c );
+	Ret( c );
+}
+
+// 2FFB, part of SHIFT-FP
+static void ClearAddend( Calc *c )
+{
+	RegisterSet *r = c->r;
+	r->L = 0;
+	r->D = r->A;
+	r->E = r->L;
+	Exx( c );
+	r->DE = 0;
+	Ret( c );
+}
+
+// ADDEND-0 2FF9
+static void ZeroAddend( Calc *c )
+{
+	Exx( c );
+	Xor( c, c->r->A );
+	ClearAddend( c );
+}
+
+// ADD-BACK 3004
+static void AddBack( Calc *c )
+{
+	RegisterSet *r = c->r;
+	r->E = Inc8( c, r->E );
+	if( !c->zero )
+	{
+		Ret( c );
+		return;
+	}
+	r->D = Inc8( c, r->D );
+	if( !c->zero )
+	{
+		Ret( c );
+		return;
+	}
+	Exx( c );
+	r->E = Inc8( c, r->E );
+	if( c->zero )
+		r->D = Inc8( c, r->D );
+	Exx( c );
+	Ret( c );
+}
+
+// SHIFT-FP 2FDD
+static void ShiftFp( Calc *c )
+{
+	RegisterSet *r = c->r;
+	And( c, r->A );
+	if( c->zero )
+	{
+		Ret( c );
+		return;
+	}
+	Cp( c, 0x21 );
+	if( !c->carry )
+	{
+		ZeroAddend( c );
+		return;
+	}
+	Push( c, r->BC );
+	r->B = r->A;
+	do
+	{
+		Exx( c );
+		r->L = Sra( c, r->L );
+		r->D = Rr( c, r->D );
+		r->E = Rr( c, r->E );
+		Exx( c );
+		r->D = Rr( c, r->D );
+		r->E = Rr( c, r->E );
+	}
+	while( --r->B );
+	r->BC = Pop( c );
+	if( !c->carry )
+	{
+		Ret( c );
+		return;
+	}
+	Call( c, AddBack );
+	if( !c->zero )
+	{
+		Ret( c );
+		return;
+	}
+	ZeroAddend( c );
+}
+
+// RESTK 3297
+static void Restack( Calc *c )
+{
+	RegisterSet *r = c->r;
+	r->A = Peek( c, r->HL );
+	And( c, r->A );
+	if( !c->zero )
+	{
+		Ret( c );
+		return;
+	}
+	Push( c, r->DE );
+	Call( c, IntFetch );
+	Xor( c, r->A );
+	r->HL++;
+	Poke( c, r->HL, r->A );
+	r->HL--;
+	Poke( c, r->HL, r->A );
+	r->B = 0x91;
+	r->A = r->D;
+	And( c, r->A );
+	bool shift = true;
+	if( c->zero )
+	{
+		Or( c, r->E );
+		r->B = r->D;
+		if( c->zero )
+		{
+			shift = false;
+		}
+		else
+		{
+			r->D = r->E;
+			r->E = r->B;
+			r->B = 0x89;
+		}
+	}
+	if( shift )
+	{
+		ExDeHl( c );
+		do
+		{
+			r->B--;
+			AddHL( c, r->HL );
+		}
+		while( !c->carry );
+		r->C = Rrc( c, r->C );
+		r->H = Rr( c, r->H );
+		r->L = Rr( c, r->L );
+		ExDeHl( c );
+	}
+	r->HL--;
+	Poke( c, r->HL, r->E );
+	r->HL--;
+	Poke( c, r->HL, r->D );
+	r->HL--;
+	Poke( c, r->HL, r->B );
+	r->DE = Pop( c );
+	Ret( c );
+}
+
+// 3296, restacks the value at DE
+static void RestackOther( Calc *c )
+{
+	ExDeHl( c );
+	Restack( c );
+}
+
+// RE-ST-TWO 3293
+static void RestackTwo( Calc *c )
+{
+	Call( c, RestackOther );
+	RestackOther( c );
+}
+
+// TEST-ZERO 34E9, carry set for zero
+static void TestZero( Calc *c )
+{
+	RegisterSet *r = c->r;
+	Push( c, r->HL );
+	Push( c, r->BC );
+	r->B = r->A;
+	r->A = Peek( c, r->HL );
+	r->HL++;
+	Or( c, Peek( c, r->HL ) );
+	r->HL++;
+	Or( c, Peek( c, r->HL ) );
+	r->HL++;
+	Or( c, Peek( c, r->HL ) );
+	r->A = r->B;
+	r->BC = Pop( c );
+	r->HL = Pop( c );
+	if( c->zero )
+		c->carry = true;
+	Ret( c );
+}
+
+// HL=HL*DE 30A9, carry set on overflow
+static void MultiplyInt( Calc *c )
+{
+	RegisterSet *r = c->r;
+	Push( c, r->BC );
+	r->B = 0x10;
+	r->A = r->H;
+	r->C = r->L;
+	r->HL = 0;
+	do
+	{
+		AddHL( c, r->HL );
+		if( c->carry )
+			break;
+		r->C = Rl( c, r->C );
+		Rla( c );
+		if( c->carry )
+		{
+			AddHL( c, r->DE );
+			if( c->carry )
+				break;
+		}
+	}
+	while( --r->B );
+	r->BC = Pop( c );
+	Ret( c );
+}
+
+// PREP-M/D 30C0
+static void PrepMultiplyDivide( Calc *c )
+{
+	RegisterSet *r = c->r;
+	Call( c, TestZero );
+	if( c->carry )
+	{
+		Ret( c );
+		return;
+	}
+	r->HL++;
+	Xor( c, Peek( c, r->HL ) );
+	Poke( c, r->HL, Peek( c, r->HL ) | 0x80 );
+	r->HL--;
+	Ret( c );
+}
+
+// 3195, packs the normalised result into the first value
+static void StoreResult( Calc *c )
+{
+	RegisterSet *r = c->r;
+	Push( c, r->HL );
+	r->HL++;
+	Exx( c );
+	Push( c, r->DE );
+	Exx( c );
+	r->BC = Pop( c );
+	r->A = r->B;
+	Rla( c );
+	Poke( c, r->HL, Rl( c, Peek( c, r->HL ) ) );
+	Rra( c );
+	Poke( c, r->HL, r->A );
+	r->HL++;
+	Poke( c, r->HL, r->C );
+	r->HL++;
+	Poke( c, r->HL, r->D );
+	r->HL++;
+	Poke( c, r->HL, r->E );
+	r->HL = Pop( c );
+	r->DE = Pop( c );
+	Exx( c );
+	r->HL = Pop( c );
+	Exx( c );
+	Ret( c );
+}
+
+// SKIP-ZERO 315E
+static void SkipZero( Calc *c )
+{
+	RegisterSet *r = c->r;
+	Exx( c );
+	And( c, r->D );
+	Call( c, ClearAddend );
+	Rlca( c );
+	Poke( c, r->HL, r->A );
+	if( !c->carry )
+	{
+		r->HL++;
+		Poke( c, r->HL, r->A );
+		r->HL--;
+	}
+	StoreResult( c );
+}
+
+// ZERO-RSLT 315D
+static void ZeroResult( Calc *c )
+{
+	Xor( c, c->r->A );
+	SkipZero( c );
+}
+
+// NEAR-ZERO 3159, a result too small for the exponent is zero or the smallest value
+static void NearZero( Calc *c )
+{
+	c->r->A = 0x80;
+	if( !c->zero )
+	{
+		ZeroResult( c );
+		return;
+	}
+	SkipZero( c );
+}
+
+// NORMALISE 316C
+static void Normalise( Calc *c )
+{
+	RegisterSet *r = c->r;
+	r->B = 0x20;
+	for( ;; )
+	{
+		Exx( c );
+		Bit( c, 7, r->D );
+		Exx( c );
+		if( !c->zero )
+			break;
+		Rlca( c );
+		r->E = Rl( c, r->E );
+		r->D = Rl( c, r->D );
+		Exx( c );
+		r->E = Rl( c, r->E );
+		r->D = Rl( c, r->D );
+		Exx( c );
+		Poke( c, r->HL, Dec8( c, Peek( c, r->HL ) ) );
+		if( c->zero )
+		{
+			NearZero( c );
+			return;
+		}
+		if( --r->B == 0 )
+		{
+			ZeroResult( c );
+			return;
+		}
+	}
+
+	// NORML-NOW 3186, rounding
+	Rla( c );
+	if( c->carry )
+	{
+		Call( c, AddBack );
+		if( c->zero )
+		{
+			Exx( c );
+			r->D = 0x80;
+			Exx( c );
+			IncAtHL( c );
+			if( c->zero )
+				Bail( c );
+		}
+	}
+	StoreResult( c );
+}
+
+// TEST-NORM 3155
+static void TestNorm( Calc *c )
+{
+	if( !c->carry )
+	{
+		Normalise( c );
+		return;
+	}
+	c->r->A = Peek( c, c->r->HL );
+	And( c, c->r->A );
+	NearZero( c );
+}
+
+// DIVN-EXPT 313D
+static void DivideExponent( Calc *c )
+{
+	RegisterSet *r = c->r;
+	Rla( c );
+	c->carry = !c->carry;
+	Rra( c );
+	if( c->sign )
+	{
+		if( !c->carry )
+			Bail( c );
+		And( c, r->A );
+	}
+	r->A = Inc8( c, r->A );
+	if( c->zero && !c->carry )
+	{
+		Exx( c );
+		Bit( c, 7, r->D );
+		Exx( c );
+		if( !c->zero )
+			Bail( c );
+	}
+	Poke( c, r->HL, r->A );
+	Exx( c );
+	r->A = r->B;
+	Exx( c );
+	TestNorm( c );
+}
+
+// addition 3014
+static void Addition( Calc *c )
+{
+	RegisterSet *r = c->r;
+	r->A = Peek( c, r->DE );
+	Or( c, Peek( c, r->HL ) );
+	if( c->zero )
+	{
+		// Both small integers
+		Push( c, r->DE );
+		r->HL++;
+		Push( c, r->HL );
+		r->HL++;
+		r->E = Peek( c, r->HL );
+		r->HL++;
+		r->D = Peek( c, r->HL );
+		r->HL += 3;
+		r->A = Peek( c, r->HL );
+		r->HL++;
+		r->C = Peek( c, r->HL );
+		r->HL++;
+		r->B = Peek( c, r->HL );
+		r->HL = Pop( c );
+		ExDeHl( c );
+		AddHL( c, r->BC );
+		ExDeHl( c );
+		Adc( c, Peek( c, r->HL ) );
+		Rrca( c );
+		Adc( c, 0 );
+		if( c->zero )
+		{
+			Sbc( c, r->A );
+			Poke( c, r->HL, r->A );
+			r->HL++;
+			Poke( c, r->HL, r->E );
+			r->HL++;
+			Poke( c, r->HL, r->D );
+			r->HL -= 3;
+			r->DE = Pop( c );
+			Ret( c );
+			return;
+		}
+		r->HL--;
+		r->DE = Pop( c );
+	}
+
+	// FULL-ADDN 303E
+	Call( c, RestackTwo );
+	Exx( c );
+	Push( c, r->HL );
+	Exx( c );
+	Push( c, r->DE );
+	Push( c, r->HL );
+	Call( c, PrepAdd );
+	r->B = r->A;
+	ExDeHl( c );
+	Call( c, PrepAdd );
+	r->C = r->A;
+	Cp( c, r->B );
+	if( c->carry )
+	{
+		r->A = r->B;
+		r->B = r->C;
+		ExDeHl( c );
+	}
+
+	// SHIFT-LEN 3055
+	PushAF( c );
+	Sub( c, r->B );
+	Call( c, FetchTwo );
+	Call( c, ShiftFp );
+	PopAF( c );
+	r->HL = Pop( c );
+	Poke( c, r->HL, r->A );
+	Push( c, r->HL );
+	r->L = r->B;
+	r->H = r->C;
+	AddHL( c, r->DE );
+	Exx( c );
+	ExDeHl( c );
+	AdcHL( c, r->BC );
+	ExDeHl( c );
+	r->A = r->H;
+	Adc( c, r->L );
+	r->L = r->A;
+	Rra( c );
+	Xor( c, r->L );
+	Exx( c );
+	ExDeHl( c );
+	r->HL = Pop( c );
+	Rra( c );
+	if( c->carry )
+	{
+		r->A = 1;
+		Call( c, ShiftFp );
+		IncAtHL( c );
+		if( c->zero )
+			Bail( c );
+	}
+
+	// TEST-NEG 307C
+	Exx( c );
+	r->A = r->L;
+	And( c, 0x80 );
+	Exx( c );
+	r->HL++;
+	Poke( c, r->HL, r->A );
+	r->HL--;
+	if( !c->zero )
+	{
+		r->A = r->E;
+		Neg( c );
+		c->carry = !c->carry;
+		r->E = r->A;
+		r->A = r->D;
+		Cpl( c );
+		Adc( c, 0 );
+		r->D = r->A;
+		Exx( c );
+		r->A = r->E;
+		Cpl( c );
+		Adc( c, 0 );
+		r->E = r->A;
+		r->A = r->D;
+		Cpl( c );
+		Adc( c, 0 );
+		if( c->carry )
+		{
+			Rra( c );
+			Exx( c );
+			IncAtHL( c );
+			if( c->zero )
+				Bail( c );
+			Exx( c );
+		}
+		r->D = r->A;
+		Exx( c );
+	}
+
+	// GO-NC-MLT 30A5
+	Xor( c, r->A );
+	TestNorm( c );
+}
+
+// negate 346E and abs 346A, 3474 on with B the sign to give
+static void SetSign( Calc *c )
+{
+	RegisterSet *r = c->r;
+	r->A = Peek( c, r->HL );
+	And( c, r->A );
+	if( !c->zero )
+	{
+		r->HL++;
+		r->A = r->B;
+		And( c, 0x80 );
+		Or( c, Peek( c, r->HL ) );
+		Rla( c );
+		c->carry = !c->carry;
+		Rra( c );
+		Poke( c, r->HL, r->A );
+		r->HL--;
+		Ret( c );
+		return;
+	}
+
+	// INT-CASE 3483
+	Push( c, r->DE );
+	Push( c, r->HL );
+	Call( c, IntFetch );
+	r->HL = Pop( c );
+	r->A = r->B;
+	Or( c, r->C );
+	Cpl( c );
+	r->C = r->A;
+	Call( c, IntStore );
+	r->DE = Pop( c );
+	Ret( c );
+}
+
+static void Negate( Calc *c )
+{
+	Call( c, TestZero );
+	if( c->carry )
+	{
+		Ret( c );
+		return;
+	}
+	c->r->B = 0;
+	SetSign( c );
+}
+
+static void Abs( Calc *c )
+{
+	c->r->B = 0xff;
+	SetSign( c );
+}
+
+// subtract 300F
+static void Subtract( Calc *c )
+{
+	ExDeHl( c );
+	Call( c, Negate );
+	ExDeHl( c );
+	Addition( c );
+}
+
+// multiply 30CA
+static void Multiply( Calc *c )
+{
+	RegisterSet *r = c->r;
+	r->A = Peek( c, r->DE );
+	Or( c, Peek( c, r->HL ) );
+	if( c->zero )
+	{
+		// Both small integers
+		Push( c, r->DE );
+		Push( c, r->HL );
+		Push( c, r->DE );
+		Call( c, IntFetch );
+		ExDeHl( c );
+		ExSpHl( c );
+		r->B = r->C;
+		Call( c, IntFetch );
+		r->A = r->B;
+		Xor( c, r->C );
+		r->C = r->A;
+		r->HL = Pop( c );
+		Call( c, MultiplyInt );
+		ExDeHl( c );
+		r->HL = Pop( c );
+		if( !c->carry )
+		{
+			r->A = r->D;
+			Or( c, r->E );
+			if( c->zero )
+				r->C = r->A;
+			Call( c, IntStore );
+			r->DE = Pop( c );
+			Ret( c );
+			return;
+		}
+		r->DE = Pop( c );
+	}
+
+	// MULT-LONG 30F0
+	Call( c, RestackTwo );
+	Xor( c, r->A );
+	Call( c, PrepMultiplyDivide );
+	if( c->carry )
+	{
+		Ret( c );
+		return;
+	}
+	Exx( c );
+	Push( c, r->HL );
+	Exx( c );
+	Push( c, r->DE );
+	ExDeHl( c );
+	Call( c, PrepMultiplyDivide );
+	ExDeHl( c );
+	if( c->carry )
+	{
+		ZeroResult( c );
+		return;
+	}
+	Push( c, r->HL );
+	Call( c, FetchTwo );
+	r->A = r->B;
+	And( c, r->A );
+	SbcHL( c, r->HL );
+	Exx( c );
+	Push( c, r->HL );
+	SbcHL( c, r->HL );
+	Exx( c );
+	r->B = 0x21;
+
+	// STRT-MLT 3125 first, then MLT-LOOP 3114
+	bool first = true;
+	do
+	{
+		if( !first )
+		{
+			if( c->carry )
+			{
+				AddHL( c, r->DE );
+				Exx( c );
+				AdcHL( c, r->DE );
+				Exx( c );
+			}
+			Exx( c );
+			r->H = Rr( c, r->H );
+			r->L = Rr( c, r->L );
+			Exx( c );
+			r->H = Rr( c, r->H );
+			r->L = Rr( c, r->L );
+		}
+		first = false;
+
+		Exx( c );
+		r->B = Rr( c, r->B );
+		r->C = Rr( c, r->C );
+		Exx( c );
+		r->C = Rr( c, r->C );
+		Rra( c );
+	}
+	while( --r->B );
+
+	ExDeHl( c );
+	Exx( c );
+	ExDeHl( c );
+	Exx( c );
+	r->BC = Pop( c );
+	r->HL = Pop( c );
+	r->A = r->B;
+	Add( c, r->C );
+	if( c->zero )
+		And( c, r->A );
+
+	// MAKE-EXPT 313B
+	r->A = Dec8( c, r->A );
+	c->carry = !c->carry;
+	DivideExponent( c );
+}
+
+// division 31AF, division by zero is left to the ROM to report
+static void Division( Calc *c )
+{
+	RegisterSet *r = c->r;
+	Call( c, RestackTwo );
+	ExDeHl( c );
+	Xor( c, r->A );
+	Call( c, PrepMultiplyDivide );
+	if( c->carry )
+		Bail( c );
+	ExDeHl( c );
+	Call( c, PrepMultiplyDivide );
+	if( c->carry )
+	{
+		Ret( c );
+		return;
+	}
+	Exx( c );
+	Push( c, r->HL );
+	Exx( c );
+	Push( c, r->DE );
+	Push( c, r->HL );
+	Call( c, FetchTwo );
+	Exx( c );
+	Push( c, r->HL );
+	r->H = r->B;
+	r->L = r->C;
+	Exx( c );
+	r->H = r->C;
+	r->L = r->B;
+	Xor( c, r->A );
+	r->B = 0xdf;
+
+	// DIV-START 31E2 first, then DIV-LOOP 31D2
+	bool loop = false;
+	for( ;; )
+	{
+		bool subtractOnly = false;
+		if( loop )
+		{
+			Rla( c );
+			r->C = Rl( c, r->C );
+			Exx( c );
+			r->C = Rl( c, r->C );
+			r->B = Rl( c, r->B );
+			Exx( c );
+
+			// DIV-34TH 31DB
+			AddHL( c, r->HL );
+			Exx( c );
+			AdcHL( c, r->HL );
+			Exx( c );
+			subtractOnly = c->carry;
+		}
+
+		if( subtractOnly )
+		{
+			// SUBN-ONLY 31F2
+			And( c, r->A );
+			SbcHL( c, r->DE );
+			Exx( c );
+			SbcHL( c, r->DE );
+			Exx( c );
+			c->carry = true;
+		}
+		else
+		{
+			SbcHL( c, r->DE );
+			Exx( c );
+			SbcHL( c, r->DE );
+			Exx( c );
+			if( !c->carry )
+			{
+				c->carry = true;
+			}
+			else
+			{
+				AddHL( c, r->DE );
+				Exx( c );
+				AdcHL( c, r->DE );
+				Exx( c );
+				And( c, r->A );
+			}
+		}
+
+		// COUNT-ONE 31FA
+		r->B = Inc8( c, r->B );
+		if( c->sign )
+		{
+			loop = true;
+			continue;
+		}
+		PushAF( c );
+		if( !c->zero )
+			break;
+		loop = false;
+	}
+
+	r->E = r->A;
+	r->D = r->C;
+	Exx( c );
+	r->E = r->C;
+	r->D = r->B;
+	PopAF( c );
+	r->B = Rr( c, r->B );
+	PopAF( c );
+	r->B = Rr( c, r->B );
+	Exx( c );
+	r->BC = Pop( c );
+	r->HL = Pop( c );
+	r->A = r->B;
+	Sub( c, r->C );
+	DivideExponent( c );
+}
+
+// NIL-BYTES 3272, clears the last A bits of the value
+static void NilBytes( Calc *c )
+{
+	RegisterSet *r = c->r;
+	Push( c, r->DE );
+	ExDeHl( c );
+	r->HL--;
+	r->B = r->A;
+	r->B = Srl( c, r->B );
+	r->B = Srl( c, r->B );
+	r->B = Srl( c, r->B );
+	if( !c->zero )
+	{
+		do
+		{
+			Poke( c, r->HL, 0 );
+			r->HL--;
+		}
+		while( --r->B );
+	}
+	And( c, 7 );
+	if( !c->zero )
+	{
+		r->B = r->A;
+		r->A = 0xff;
+		do
+		{
+			r->A = Sla( c, r->A );
+		}
+		while( --r->B );
+		And( c, Peek( c, r->HL ) );
+		Poke( c, r->HL, r->A );
+	}
+	ExDeHl( c );
+	r->DE = Pop( c );
+	Ret( c );
+}
+
+// 326D, the exponent in A
+static void TruncateBits( Calc *c )
+{
+	Sub( c, 0xa0 );
+	if( !c->sign )
+	{
+		Ret( c );
+		return;
+	}
+	Neg( c );
+	NilBytes( c );
+}
+
+// truncate 3214
+static void Truncate( Calc *c )
+{
+	RegisterSet *r = c->r;
+	r->A = Peek( c, r->HL );
+	And( c, r->A );
+	if( c->zero )
+	{
+		Ret( c );
+		return;
+	}
+	Cp( c, 0x81 );
+	if( c->carry )
+	{
+		Poke( c, r->HL, 0 );
+		r->A = 0x20;
+		NilBytes( c );
+		return;
+	}
+	Cp( c, 0x91 );
+	if( c->zero )
+	{
+		// Only -65536 becomes a small integer
+		r->HL += 3;
+		r->A = 0x80;
+		And( c, Peek( c, r->HL ) );
+		r->HL--;
+		Or( c, Peek( c, r->HL ) );
+		r->HL--;
+		if( c->zero )
+		{
+			r->A = 0x80;
+			Xor( c, Peek( c, r->HL ) );
+		}
+		r->HL--;
+		if( !c->zero )
+		{
+			r->A = Peek( c, r->HL );
+			TruncateBits( c );
+			return;
+		}
+		Poke( c, r->HL, r->A );
+		r->HL++;
+		Poke( c, r->HL, 0xff );
+		r->HL--;
+		r->A = 0x18;
+		NilBytes( c );
+		return;
+	}
+	if( !c->carry )
+	{
+		TruncateBits( c );
+		return;
+	}
+
+	// T-SMALL 3241
+	Push( c, r->DE );
+	Cpl( c );
+	Add( c, 0x91 );
+	r->HL++;
+	r->D = Peek( c, r->HL );
+	r->HL++;
+	r->E = Peek( c, r->HL );
+	r->HL -= 2;
+	r->C = 0;
+	Bit( c, 7, r->D );
+	if( !c->zero )
+		r->C = Dec8( c, r->C );
+	r->D |= 0x80;
+	r->B = 8;
+	Sub( c, r->B );
+	Add( c, r->B );
+	if( !c->carry )
+	{
+		r->E = r->D;
+		r->D = 0;
+		Sub( c, r->B );
+	}
+	if( !c->zero )
+	{
+		r->B = r->A;
+		do
+		{
+			r->D = Srl( c, r->D );
+			r->E = Rr( c, r->E );
+		}
+		while( --r->B );
+	}
+	Call( c, IntStore );
+	r->DE = Pop( c );
+	Ret( c );
+}
+
+// FP-0/1 350B, 1 for carry set
+static void ZeroOrOne( Calc *c )
+{
+	RegisterSet *r = c->r;
+	Push( c, r->HL );
+	r->A = 0;
+	Poke( c, r->HL, r->A );
+	r->HL++;
+	Poke( c, r->HL, r->A );
+	r->HL++;
+	Rla( c );
+	Poke( c, r->HL, r->A );
+	Rra( c );
+	r->HL++;
+	Poke( c, r->HL, r->A );
+	r->HL++;
+	Poke( c, r->HL, r->A );
+	r->HL = Pop( c );
+	Ret( c );
+}
+
+// SIGN-TO-C 3507
+static void SignToCarry( Calc *c )
+{
+	RegisterSet *r = c->r;
+	r->HL++;
+	Xor( c, Peek( c, r->HL ) );
+	r->HL--;
+	Rlca( c );
+	ZeroOrOne( c );
+}
+
+// greater-0 34F9
+static void GreaterZero( Calc *c )
+{
+	Call( c, TestZero );
+	if( c->carry )
+	{
+		Ret( c );
+		return;
+	}
+	c->r->A = 0xff;
+	SignToCarry( c );
+}
+
+// less-0 3506
+static void LessZero( Calc *c )
+{
+	Xor( c, c->r->A );
+	SignToCarry( c );
+}
+
+// not 3501
+static void Not( Calc *c )
+{
+	Call( c, TestZero );
+	ZeroOrOne( c );
+}
+
+// or 351B
+static void OrLiteral( Calc *c )
+{
+	ExDeHl( c );
+	Call( c, TestZero );
+	ExDeHl( c );
+	if( c->carry )
+	{
+		Ret( c );
+		return;
+	}
+	c->carry = true;
+	ZeroOrOne( c );
+}
+
+// no-&-no 3524
+static void NumberAndNumber( Calc *c )
+{
+	ExDeHl( c );
+	Call( c, TestZero );
+	ExDeHl( c );
+	if( !c->carry )
+	{
+		Ret( c );
+		return;
+	}
+	And( c, c->r->A );
+	ZeroOrOne( c );
+}
+
+// str-&-no 352D
+static void StringAndNumber( Calc *c )
+{
+	RegisterSet *r = c->r;
+	ExDeHl( c );
+	Call( c, TestZero );
+	ExDeHl( c );
+	if( !c->carry )
+	{
+		Ret( c );
+		return;
+	}
+	Push( c, r->DE );
+	r->DE--;
+	Xor( c, r->A );
+	Poke( c, r->DE, r->A );
+	r->DE--;
+	Poke( c, r->DE, r->A );
+	r->DE = Pop( c );
+	Ret( c );
+}
+
+// exchange 343C
+static void Exchange( Calc *c )
+{
+	RegisterSet *r = c->r;
+	r->B = 5;
+	do
+	{
+		r->A = Peek( c, r->DE );
+		r->C = Peek( c, r->HL );
+		ExDeHl( c );
+		Poke( c, r->DE, r->A );
+		Poke( c, r->HL, r->C );
+		r->HL++;
+		r->DE++;
+	}
+	while( --r->B );
+	ExDeHl( c );
+	Ret( c );
+}
+
+// Numeric comparisons 353B, strings are left to the ROM
+static void Compare( Calc *c )
+{
+	RegisterSet *r = c->r;
+	r->A = r->B;
+	Sub( c, 8 );
+	Bit( c, 2, r->A );
+	if( c->zero )
+		r->A = Dec8( c, r->A );
+	Rrca( c );
+	if( c->carry )
+	{
+		PushAF( c );
+		Push( c, r->HL );
+		Call( c, Exchange );
+		r->DE = Pop( c );
+		ExDeHl( c );
+		PopAF( c );
+	}
+	Bit( c, 2, r->A );
+	if( !c->zero )
+		Bail( c );
+	Rrca( c );
+	PushAF( c );
+	Call( c, Subtract );
+
+	// END-TESTS 358C
+	PopAF( c );
+	PushAF( c );
+	if( c->carry )
+		Call( c, Not );
+	PopAF( c );
+	PushAF( c );
+	if( !c->carry )
+		Call( c, GreaterZero );
+	PopAF( c );
+	Rrca( c );
+	if( !c->carry )
+		Call( c, Not );
+	Ret( c );
+}
+
+// sgn 3492
+static void Sgn( Calc *c )
+{
+	RegisterSet *r = c->r;
+	Call( c, TestZero );
+	if( c->carry )
+	{
+		Ret( c );
+		return;
+	}
+	Push( c, r->DE );
+	r->DE = 1;
+	r->HL++;
+	Poke( c, r->HL, Rl( c, Peek( c, r->HL ) ) );
+	r->HL--;
+	Sbc( c, r->A );
+	r->C = r->A;
+	Call( c, IntStore );
+	r->DE = Pop( c );
+	Ret( c );
+}
+
+// TEST-5-SP 33A9
+static void TestFiveSpaces( Calc *c )
+{
+	RegisterSet *r = c->r;
+	Push( c, r->DE );
+	Push( c, r->HL );
+	r->BC = 5;
+	Call( c, TestRoom );
+	r->HL = Pop( c );
+	r->DE = Pop( c );
+	Ret( c );
+}
+
+// MOVE-FP 33C0, also duplicate
+static void MoveFp( Calc *c )
+{
+	Call( c, TestFiveSpaces );
+	Ldir( c );
+	Ret( c );
+}
+
+// STK-DATA 33C8, stacks the value at HL' compacted as the literals have it
+static void StackData( Calc *c )
+{
+	RegisterSet *r = c->r;
+	Call( c, TestFiveSpaces );
+	Exx( c );
+	Push( c, r->HL );
+	Exx( c );
+	ExSpHl( c );
+	Push( c, r->BC );
+	r->A = Peek( c, r->HL );
+	And( c, 0xc0 );
+	Rlca( c );
+	Rlca( c );
+	r->C = r->A;
+	r->C = Inc8( c, r->C );
+	r->A = Peek( c, r->HL );
+	And( c, 0x3f );
+	if( c->zero )
+	{
+		r->HL++;
+		r->A = Peek( c, r->HL );
+	}
+	Add( c, 0x50 );
+	Poke( c, r->DE, r->A );
+	r->A = 5;
+	Sub( c, r->C );
+	r->HL++;
+	r->DE++;
+	r->B = 0;
+	Ldir( c );
+	r->BC = Pop( c );
+	ExSpHl( c );
+	Exx( c );
+	r->HL = Pop( c );
+	Exx( c );
+	r->B = r->A;
+	Xor( c, r->A );
+	for( ;; )
+	{
+		r->B = Dec8( c, r->B );
+		if( c->zero )
+			break;
+		Poke( c, r->DE, r->A );
+		r->DE++;
+	}
+	Ret( c );
+}
+
+// stk-data 33C6
+static void StackLiteral( Calc *c )
+{
+	c->r->HL = c->r->DE;
+	StackData( c );
+}
+
+// SKIP-CONS 33F7
+static void SkipConstants( Calc *c )
+{
+	RegisterSet *r = c->r;
+	for( ;; )
+	{
+		And( c, r->A );
+		if( c->zero )
+			break;
+		PushAF( c );
+		Push( c, r->DE );
+		r->DE = 0;
+		Call( c, StackData );
+		r->DE = Pop( c );
+		PopAF( c );
+		r->A = Dec8( c, r->A );
+	}
+	Ret( c );
+}
+
+// stk-const 341B
+static void StackConstant( Calc *c )
+{
+	RegisterSet *r = c->r;
+	r->HL = r->DE;
+	Exx( c );
+	Push( c, r->HL );
+	r->HL = CALC_CONSTANTS;
+	Exx( c );
+	Call( c, SkipConstants );
+	Call( c, StackData );
+	Exx( c );
+	r->HL = Pop( c );
+	Exx( c );
+	Ret( c );
+}
+
+// LOC-MEM 3406
+static void LocateMemory( Calc *c )
+{
+	RegisterSet *r = c->r;
+	r->C = r->A;
+	Rlca( c );
+	Rlca( c );
+	Add( c, r->C );
+	r->C = r->A;
+	r->B = 0;
+	AddHL( c, r->BC );
+	Ret( c );
+}
+
+// st-mem 342D
+static void StoreMemory( Calc *c )
+{
+	RegisterSet *r = c->r;
+	Push( c, r->HL );
+	ExDeHl( c );
+	r->HL = Peek16( c, CALC_MEM );
+	Call( c, LocateMemory );
+	ExDeHl( c );
+	Call( c, MoveFp );
+	ExDeHl( c );
+	r->HL = Pop( c );
+	Ret( c );
+}
+
+// get-mem 340F
+static void GetMemory( Calc *c )
+{
+	RegisterSet *r = c->r;
+	Push( c, r->DE );
+	r->HL = Peek16( c, CALC_MEM );
+	Call( c, LocateMemory );
+	Call( c, MoveFp );
+	r->HL = Pop( c );
+	Ret( c );
+}
+
+// 3687, part of jump
+static void JumpBy( Calc *c )
+{
+	RegisterSet *r = c->r;
+	r->E = Peek( c, r->HL );
+	r->A = r->E;
+	Rla( c );
+	Sbc( c, r->A );
+	r->D = r->A;
+	AddHL( c, r->DE );
+	Exx( c );
+	Ret( c );
+}
+
+// jump 3686
+static void Jump( Calc *c )
+{
+	Exx( c );
+	JumpBy( c );
+}
+
+// jump-true 368F
+static void JumpTrue( Calc *c )
+{
+	RegisterSet *r = c->r;
+	r->DE += 2;
+	r->A = Peek( c, r->DE );
+	r->DE -= 2;
+	And( c, r->A );
+	if( !c->zero )
+	{
+		Jump( c );
+		return;
+	}
+	Exx( c );
+	r->HL++;
+	Exx( c );
+	Ret( c );
+}
+
+// dec-jr-nz 367A
+static void DecJumpNonZero( Calc *c )
+{
+	RegisterSet *r = c->r;
+	Exx( c );
+	Push( c, r->HL );
+	r->HL = CALC_BREG;
+	Poke( c, r->HL, Dec8( c, Peek( c, r->HL ) ) );
+	r->HL = Pop( c );
+	if( !c->zero )
+	{
+		JumpBy( c );
+		return;
+	}
+	r->HL++;
+	Exx( c );
+	Ret( c );
+}
+
+// end-calc 369B, RET leaves the calculator
+static void EndCalc( Calc *c )
+{
+	PopAF( c );
+	Exx( c );
+	ExSpHl( c );
+	Exx( c );
+	c->exitPC = Pop( c );
+	c->exit = true;
+}
+
+// RE-ENTRY 3365, runs the next literal
+static void ReEntry( Calc *c );
+
+// SCAN-ENT 336C, with the literal in A
+static void ScanEntry( Calc *c )
+{
+	RegisterSet *r = c->r;
+	Push( c, r->HL );
+	And( c, r->A );
+	if( c->sign )
+	{
+		// Series, constants and memory, with the index in A
+		r->D = r->A;
+		r->L = ( ( r->A & 0x60 ) >> 4 ) + 0x7c;
+		r->A = r->D;
+		And( c, 0x1f );
+	}
+	else
+	{
+		Cp( c, 0x18 );
+		if( c->carry )
+		{
+			// Binary operations, HL to the first value and DE to the second
+			Exx( c );
+			r->BC = 0xfffb;
+			r->D = r->H;
+			r->E = r->L;
+			AddHL( c, r->BC );
+			Exx( c );
+		}
+		Rlca( c );
+		r->L = r->A;
+	}
+
+	// ENT-TABLE 338E
+	r->DE = CALC_TABLE;
+	r->H = 0;
+	AddHL( c, r->DE );
+	r->E = Peek( c, r->HL );
+	r->HL++;
+	r->D = Peek( c, r->HL );
+	r->HL = CALC_RE_ENTRY;
+	ExSpHl( c );
+	Push( c, r->DE );
+	const uint16_t routine = r->DE;
+	Exx( c );
+	r->BC = Peek16( c, CALC_STKEND + 1 );
+	Ret( c );
+	Routine( c, routine );
+}
+
+// fp-calc-2 33A2, the literal from BREG
+static void SingleOperation( Calc *c )
+{
+	PopAF( c );
+	c->r->A = Peek( c, CALC_BREG );
+	Exx( c );
+	ScanEntry( c );
+}
+
+static void ReEntry( Calc *c )
+{
+	RegisterSet *r = c->r;
+	if( ++c->literals > CALC_MAX_NESTED )
+		Bail( c );
+
+	Poke16( c, CALC_STKEND, r->DE );
+	Exx( c );
+	r->A = Peek( c, r->HL );
+	r->HL++;
+	ScanEntry( c );
+}
+
+// STK-PNTRS 35BF
+static void StackPointers( Calc *c )
+{
+	RegisterSet *r = c->r;
+	r->HL = Peek16( c, CALC_STKEND );
+	r->DE = 0xfffb;
+	Push( c, r->HL );
+	AddHL( c, r->DE );
+	r->DE = Pop( c );
+	Ret( c );
+}
+
+// A routine written in calculator literals, RST 28h up to an end-calc followed by RET
+static void CalculatorCode( Calc *c, uint16_t address )
+{
+	RegisterSet *r = c->r;
+	Push( c, address + 1 );
+
+	// CALCULATE 335B
+	Call( c, StackPointers );
+	r->A = r->B;
+	Poke( c, CALC_BREG, r->A );
+	Exx( c );
+	ExSpHl( c );
+	Exx( c );
+
+	while( !c->exit )
+		ReEntry( c );
+	c->exit = false;
+
+	if( Peek( c, c->exitPC ) != OP_RET )
+		Bail( c );
+	Ret( c );
+}
+
+static void Routine( Calc *c, uint16_t address )
+{
+	switch( address )
+	{
+	case 0x368f: JumpTrue( c ); break;
+	case 0x343c: Exchange( c ); break;
+	case 0x33a1: Ret( c ); break;
+	case 0x300f: Subtract( c ); break;
+	case 0x30ca: Multiply( c ); break;
+	case 0x31af: Division( c ); break;
+	case 0x351b: OrLiteral( c ); break;
+	case 0x3524: NumberAndNumber( c ); break;
+	case 0x353b: Compare( c ); break;
+	case 0x3014: Addition( c ); break;
+	case 0x352d: StringAndNumber( c ); break;
+	case 0x346e: Negate( c ); break;
+	case 0x3492: Sgn( c ); break;
+	case 0x346a: Abs( c ); break;
+	case 0x3501: Not( c ); break;
+	case 0x33c0: MoveFp( c ); break;
+	case 0x3686: Jump( c ); break;
+	case 0x33c6: StackLiteral( c ); break;
+	case 0x367a: DecJumpNonZero( c ); break;
+	case 0x3506: LessZero( c ); break;
+	case 0x34f9: GreaterZero( c ); break;
+	case 0x369b: EndCalc( c ); break;
+	case 0x3214: Truncate( c ); break;
+	case 0x33a2: SingleOperation( c ); break;
+	case 0x3297: Restack( c ); break;
+	case 0x341b: StackConstant( c ); break;
+	case 0x342d: StoreMemory( c ); break;
+	case 0x340f: GetMemory( c ); break;
+	default:
+		if( Peek( c, address ) != OP_RST_28 )
+			Bail( c );
+		CalculatorCode( c, address );
+		break;
+	}
+}
+
+static bool CalculatorTrap( Machine *M )
+{
+	ZState *Z = &M->Z;
+
+	// The trap is shared by every machine, only run it over the ROM that was checked
+	if( Z->page[CALC_RE_ENTRY >> Z_PAGE_SHIFT].read != s_rom + ( CALC_RE_ENTRY & ~Z_PAGE_MASK ) )
+		return false;
+
+	Calc c;
+	c.Z = Z;
+	c.r = &Z->reg;
+	c.carry = ( Z->reg.F & M_C ) != 0;
+	c.zero = ( Z->reg.F & M_Z ) != 0;
+	c.sign = ( Z->reg.F & M_S ) != 0;
+	c.exit = false;
+	c.literals = 0;
+
+	for( int i = 0; i < CALC_MAX_LITERALS; i++ )
+	{
+		const RegisterSet reg = Z->reg;
+		const RegisterSet sreg = Z->sreg;
+		c.undoCount = 0;
+
+		if( setjmp( c.bail ) != 0 )
+		{
+			Undo( &c );
+			Z->reg = reg;
+			Z->sreg = sreg;
+			return false;
+		}
+
+		ReEntry( &c );
+		if( c.exit )
+		{
+			Z->reg.PC = c.exitPC;
+			return true;
+		}
+	}
+
+	// Long calculations give the ROM a literal now and then so time moves on
+	return false;
+}
+
+bool Calc_Enable( const uint8_t *rom )
+{
+	if( Hash_Bytes( rom, MACHINE_ROM_SIZE, HASH_SEED ) != CALC_ROM_HASH )
+		return false;
+
+	s_rom = rom;
+	return Machine_SetTrap( CALC_RE_ENTRY, CalculatorTrap );
+}
+
+void Calc_Disable()
+{
+	Machine_SetTrap( CALC_RE_ENTRY, NULL );
+	s_rom = NULL;
+}
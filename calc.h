@@ -0,0 +1,15 @@
+#if !defined( CALC_H )
+#define CALC_H 1
+
+#include <stdint.h>
+
+// Runs the 48K ROM's floating point calculator natively. RE-ENTRY is trapped and
+// each literal is carried out on the calculator stack in memory as the ROM's own
+// routine would, leaving memory and registers as the ROM leaves them apart from
+// F between literals, R, the bytes below SP and the time taken. Literals that
+// aren't handled, or that would end in an error report, are left to the ROM.
+// Only the standard 48K ROM image is accepted.
+bool Calc_Enable( const uint8_t *rom );
+void Calc_Disable();
+
+#endif // CALC_H
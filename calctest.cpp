@@ -0,0 +1,253 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "machine.h"
+#include "boot.h"
+#include "calc.h"
+
+// Frames a run is given to reach its HALT
+#define RUN_FRAMES 500
+
+// The HALT every run ends on, errors included, and the code after it
+#define PROGRAM 0x8000
+
+#define ERR_SP 0x5c3d
+
+// Numbers kept on the calculator stack at most
+#define MAX_DEPTH 12
+
+// Bytes below SP that the ROM's calls leave behind and the native routines needn't
+#define STACK_SCRATCH 256
+
+// Random calculator literals run once by the ROM and once with the native routines,
+// and compared. Interrupts are off so both runs see the same machine whatever the time
+// taken, and ERR-SP points at the HALT so a run that ends in an error report stops
+// there as well.
+
+static std::mt19937 s_random;
+
+static int Random( int n )
+{
+	return s_random() % n;
+}
+
+static void Emit( std::vector<uint8_t> &code, std::initializer_list<uint8_t> bytes )
+{
+	code.insert( code.end(), bytes );
+}
+
+// Literals that work on numbers and don't jump, by the stack entries they take
+static const uint8_t s_unary[] =
+{
+	0x1b, 0x1f, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26,	// negate to exp
+	0x27, 0x28, 0x29, 0x2a, 0x30, 0x36, 0x37, 0x39, 0x3a,	// int to truncate
+	0x3d,													// re-stack
+};
+
+static const uint8_t s_binary[] =
+{
+	0x03, 0x04, 0x05, 0x07, 0x08,							// subtract to no-&-no but to-power
+	0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x32,			// comparisons, addition and n-mod-m
+};
+
+// A number in full floating point form, between about 2^-16 and 2^16 either way
+static void EmitStackData( std::vector<uint8_t> &code )
+{
+	uint8_t exponent = 0x70 + Random( 0x21 );
+	Emit( code, { 0x34, 0xc0, (uint8_t)( exponent - 0x50 ),
+		(uint8_t)Random( 256 ), (uint8_t)Random( 256 ), (uint8_t)Random( 256 ), (uint8_t)Random( 256 ) } );
+}
+
+// A sequence of literals between RST 28h and end-calc, with depth the numbers on the
+// stack before and after
+static void EmitCalculation( std::vector<uint8_t> &code, int *depth )
+{
+	Emit( code, { 0xef } );
+
+	int literals = 1 + Random( 12 );
+	for( int i = 0; i < literals; i++ )
+	{
+		int kind = Random( 100 );
+		if( *depth < 2 || ( kind < 30 && *depth < MAX_DEPTH ) )
+		{
+			// stk-data, or stk-zero to stk-ten, or get-mem-0 to 5
+			int push = Random( 3 );
+			if( push == 0 )
+				EmitStackData( code );
+			else if( push == 1 )
+				Emit( code, { (uint8_t)( 0xa0 + Random( 5 ) ) } );
+			else
+				Emit( code, { (uint8_t)( 0xe0 + Random( 6 ) ) } );
+			++*depth;
+		}
+		else if( kind < 55 )
+		{
+			// Mostly kept in range, so most runs get to the end rather than an error report
+			uint8_t literal = s_unary[Random( sizeof( s_unary ) )];
+			if( ( literal == 0x22 || literal == 0x23 ) && Random( 4 ) )
+				Emit( code, { 0x1f } );		// sin
+			else if( ( literal == 0x25 || literal == 0x28 ) && Random( 4 ) )
+				Emit( code, { 0x2a, 0xa1, 0x0f } );	// abs, stk-one, addition
+			else if( literal == 0x26 && Random( 4 ) )
+				Emit( code, { 0x20 } );		// cos
+			Emit( code, { literal } );
+		}
+		else if( kind < 80 )
+		{
+			// to-power overflows so readily it is given less often
+			Emit( code, { Random( 10 ) ? s_binary[Random( sizeof( s_binary ) )] : (uint8_t)0x06 } );
+			--*depth;
+		}
+		else if( kind < 88 )
+		{
+			// st-mem-0 to 5
+			Emit( code, { (uint8_t)( 0xc0 + Random( 6 ) ) } );
+		}
+		else if( kind < 92 )
+		{
+			// exchange
+			Emit( code, { 0x01 } );
+		}
+		else if( kind < 96 && *depth < MAX_DEPTH )
+		{
+			// duplicate
+			Emit( code, { 0x31 } );
+			++*depth;
+		}
+		else
+		{
+			// delete
+			Emit( code, { 0x02 } );
+			--*depth;
+		}
+	}
+
+	Emit( code, { 0x38 } );
+}
+
+static void EmitProgram( std::vector<uint8_t> &code, int calculations )
+{
+	// HALT, then from the entry DI : LD HL,PROGRAM : PUSH HL : LD (ERR-SP),SP
+	Emit( code, { 0x76, 0xf3, 0x21, PROGRAM & 0xff, PROGRAM >> 8, 0xe5, 0xed, 0x73, ERR_SP & 0xff, ERR_SP >> 8 } );
+
+	int depth = 0;
+	for( int i = 0; i < calculations; i++ )
+	{
+		// Small integers as well, LD BC,nn : CALL STACK-BC
+		if( depth < MAX_DEPTH && Random( 2 ) )
+		{
+			Emit( code, { 0x01, (uint8_t)Random( 256 ), (uint8_t)Random( 256 ), 0xcd, 0x2b, 0x2d } );
+			depth++;
+		}
+
+		EmitCalculation( code, &depth );
+	}
+
+	Emit( code, { 0x76 } );
+}
+
+static double Run( Machine *M, MachineState *result )
+{
+	auto start = std::chrono::steady_clock::now();
+	for( int i = 0; i < RUN_FRAMES && !M->Z.halted; i++ )
+		Machine_RunFrame( M, NULL, NULL );
+	double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+
+	Machine_SaveState( M, result );
+	return seconds;
+}
+
+// Everything the native routines promise to leave as the ROM does: the registers but
+// R and the flags other than sign, zero and carry, and memory but the scratch below SP.
+// That covers the calculator stack, the MEM area and the system variables.
+static bool Compare( int run, const MachineState *rom, const MachineState *native )
+{
+	RegisterSet a = rom->reg, b = native->reg;
+	a.R = b.R = 0;
+	a.F &= M_S | M_Z | M_C;
+	b.F &= M_S | M_Z | M_C;
+
+	bool same = memcmp( &a, &b, sizeof( a ) ) == 0 && memcmp( &rom->sreg, &native->sreg, sizeof( rom->sreg ) ) == 0;
+	if( !same )
+		printf( "Run %d: registers differ, PC %04x/%04x AF %04x/%04x HL %04x/%04x\n", run, a.PC, b.PC, a.AF, b.AF, a.HL, b.HL );
+
+	const int scratch = a.SP - MACHINE_ROM_SIZE - STACK_SCRATCH;
+	for( int i = 0; i < MACHINE_RAM_SIZE; i++ )
+	{
+		if( i >= scratch && i < a.SP - MACHINE_ROM_SIZE )
+			continue;
+
+		if( rom->ram[i] != native->ram[i] )
+		{
+			printf( "Run %d: RAM differs at %04x, %02x/%02x\n", run, MACHINE_ROM_SIZE + i, rom->ram[i], native->ram[i] );
+			return false;
+		}
+	}
+
+	return same;
+}
+
+int main( int argc, char *argv[] )
+{
+	int runs = argc > 1 ? atoi( argv[1] ) : 200;
+	s_random.seed( argc > 2 ? atoi( argv[2] ) : 1 );
+
+	static uint8_t rom[MACHINE_ROM_SIZE];
+	static uint8_t ram[MACHINE_RAM_SIZE];
+	static Machine M;
+	static MachineState booted, start, interpreted, native;
+
+	if( !Machine_LoadROM( rom, "roms/48.rom" ) )
+	{
+		printf( "Could not read rom file\n" );
+		return 1;
+	}
+
+	Machine_Init( &M, rom, ram );
+	if( !Boot_Machine( &M, NULL ) )
+	{
+		printf( "The ROM never reached its copyright message\n" );
+		return 1;
+	}
+	Machine_SaveState( &M, &booted );
+
+	int failed = 0, errors = 0;
+	double romTime = 0, nativeTime = 0;
+	for( int run = 0; run < runs; run++ )
+	{
+		Machine_RestoreState( &M, &booted );
+
+		std::vector<uint8_t> code;
+		EmitProgram( code, 1 + Random( 8 ) );
+		for( size_t i = 0; i < code.size(); i++ )
+			Z80_WriteMemory( &M.Z, PROGRAM + i, code[i] );
+		M.Z.reg.PC = PROGRAM + 1;
+		Machine_SaveState( &M, &start );
+
+		Calc_Disable();
+		romTime += Run( &M, &interpreted );
+
+		Machine_RestoreState( &M, &start );
+		if( !Calc_Enable( rom ) )
+		{
+			printf( "Rom not recognised\n" );
+			return 1;
+		}
+		nativeTime += Run( &M, &native );
+
+		// Stopped at the first HALT by an error report
+		if( interpreted.reg.PC == PROGRAM + 1 )
+			errors++;
+
+		if( !interpreted.halted || !Compare( run, &interpreted, &native ) )
+			failed++;
+	}
+
+	printf( "CalcTest: %d runs, %d ended in errors, %d failed. ROM %.3fs, native %.3fs\n", runs, errors, failed, romTime, nativeTime );
+	return failed ? 1 : 0;
+}
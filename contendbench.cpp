@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include "machine.h"
+
+#define PROGRAM 0x8000
+#define TURBO_LOOP 0x6000
+
+// Least share of the multiplier contended code must speed up by
+#define TURBO_MIN_SCALE 0.9
+
+// Copies a block and works over the copy, forever with interrupts off. One copy stays
+// in the top 32K, where the cost of contention is only the checks, and one goes
+// through the screen.
+struct Workload
+{
+	const char *name;
+	uint8_t code[26];
+};
+
+static const Workload s_workloads[] =
+{
+	{ "Upper RAM", {
+		0xf3,					// DI
+		0x21, 0x00, 0x90,		// LD HL,0x9000
+		0x11, 0x00, 0xa0,		// LD DE,0xa000
+		0x01, 0x00, 0x10,		// LD BC,0x1000
+		0xed, 0xb0,				// LDIR
+		0x21, 0x00, 0xa0,		// LD HL,0xa000
+		0x06, 0x00,				// LD B,0
+		0x7e, 0x86, 0x77, 0x23,	// LD A,(HL) : ADD A,(HL) : LD (HL),A : INC HL
+		0x10, 0xfa,				// DJNZ
+		0xc3, 0x01, 0x80 } },	// JP 0x8001
+	{ "Screen", {
+		0xf3,
+		0x21, 0x00, 0x90,
+		0x11, 0x00, 0x40,		// LD DE,0x4000
+		0x01, 0x00, 0x1b,		// LD BC,0x1b00
+		0xed, 0xb0,
+		0x21, 0x00, 0x40,		// LD HL,0x4000
+		0x06, 0x00,
+		0x7e, 0x86, 0x77, 0x23,
+		0x10, 0xfa,
+		0xc3, 0x01, 0x80 } },
+};
+
+static double Run( const Workload *w, bool contention, int frames, uint8_t *rom, uint8_t *ram )
+{
+	static Machine M;
+	Machine_Init( &M, rom, ram );
+	Machine_SetContention( &M, contention );
+	Machine_Reset( &M );
+
+	for( size_t i = 0; i < sizeof( w->code ); i++ )
+		Z80_WriteMemory( &M.Z, PROGRAM + i, w->code[i] );
+	M.Z.reg.PC = PROGRAM;
+
+	auto start = std::chrono::steady_clock::now();
+	for( int i = 0; i < frames; i++ )
+		Machine_RunFrame( &M, NULL, NULL );
+	return std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+}
+
+// INC BC : JP back, run from contended memory with interrupts off. Returns the loops
+// run in a frame, averaged over the frames.
+static int LoopsPerFrame( int turbo, int frames, uint8_t *rom, uint8_t *ram )
+{
+	static const uint8_t code[] = { 0xf3, 0x03, 0xc3, 0x01, 0x60 };
+
+	static Machine M;
+	Machine_Init( &M, rom, ram );
+	Machine_SetContention( &M, true );
+	Machine_SetTurbo( &M, turbo );
+	Machine_Reset( &M );
+
+	for( size_t i = 0; i < sizeof( code ); i++ )
+		Z80_WriteMemory( &M.Z, TURBO_LOOP + i, code[i] );
+	M.Z.reg.PC = TURBO_LOOP;
+	Machine_RunFrame( &M, NULL, NULL );
+
+	int loops = 0;
+	for( int i = 0; i < frames; i++ )
+	{
+		M.Z.reg.BC = 0;
+		Machine_RunFrame( &M, NULL, NULL );
+		loops += M.Z.reg.BC;
+	}
+	return loops / frames;
+}
+
+static void Usage()
+{
+	printf( "Usage: contendbench [-frames n] [-runs n]\n" );
+}
+
+int main( int argc, char *argv[] )
+{
+	int frames = 1000;
+	int runs = 10;
+
+	for( int i = 1; i < argc; i++ )
+	{
+		if( strcmp( argv[i], "-frames" ) == 0 && i + 1 < argc )
+			frames = atoi( argv[++i] );
+		else if( strcmp( argv[i], "-runs" ) == 0 && i + 1 < argc )
+			runs = atoi( argv[++i] );
+		else
+		{
+			Usage();
+			return 1;
+		}
+	}
+
+	// The workloads don't touch the ROM
+	static uint8_t rom[MACHINE_ROM_SIZE];
+	static uint8_t ram[MACHINE_RAM_SIZE];
+
+	for( const Workload &w : s_workloads )
+	{
+		// The fastest of each, taking turns so both see the same load
+		double off = 1e9, on = 1e9;
+		for( int i = 0; i < runs; i++ )
+		{
+			off = std::min( off, Run( &w, false, frames, rom, ram ) );
+			on = std::min( on, Run( &w, true, frames, rom, ram ) );
+		}
+
+		printf( "%s: %d frames, uncontended %.3fs (%.0fx real time), contended %.3fs (%.0fx real time), %+.1f%%\n", w.name, frames,
+			off, frames / ( off * 50 ), on, frames / ( on * 50 ), ( on / off - 1 ) * 100 );
+	}
+
+	// Contended code speeds up with the clock, a little less than the multiplier as the
+	// waits for the ULA take the same time at any speed
+	bool ok = true;
+	const int base = LoopsPerFrame( 1, frames, rom, ram );
+	for( int turbo = 2; turbo <= 4; turbo *= 2 )
+	{
+		const int loops = LoopsPerFrame( turbo, frames, rom, ram );
+		const bool scaled = loops >= base * turbo * TURBO_MIN_SCALE;
+		printf( "Turbo %d: %d loops per frame in contended memory, %.2fx turbo 1%s\n", turbo, loops, loops / (double)base,
+			scaled ? "" : ", FAILED" );
+		ok = ok && scaled;
+	}
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,57 @@
+#include "display.h"
+#include "speccy.h"
+
+const uint8_t g_displayColors[DISPLAY_PALETTE_SIZE][3] =
+{
+	{ 0x00, 0x00, 0x00 },
+	{ 0x00, 0x00, 0xcd },
+	{ 0xcd, 0x00, 0x00 },
+	{ 0xcd, 0x00, 0xcd },
+	{ 0x00, 0xcd, 0x00 },
+	{ 0x00, 0xcd, 0xcd },
+	{ 0xcd, 0xcd, 0x00 },
+	{ 0xcd, 0xcd, 0xcd },
+
+	{ 0x00, 0x00, 0x00 },
+	{ 0x00, 0x00, 0xff },
+	{ 0xff, 0x00, 0x00 },
+	{ 0xff, 0x00, 0xff },
+	{ 0x00, 0xff, 0x00 },
+	{ 0x00, 0xff, 0xff },
+	{ 0xff, 0xff, 0x00 },
+	{ 0xff, 0xff, 0xff },
+};
+
+void Display_DecodeLine( uint32_t *dest, const uint8_t *mem, int sy, uint8_t frame, const uint32_t *palette )
+{
+	const int srcY = ( ( sy >> 3 ) & 7 ) | ( ( sy & 7 ) << 3 ) | ( sy & ( 3 << 6 ) );
+	const uint8_t *src = mem + ( srcY * 32 );
+	const uint8_t *attr = mem + ( PIXEL_HEIGHT * 32 ) + ( ( sy >> 3 ) * 32 );
+
+	for( int x = 0; x < PIXEL_WIDTH; x+=8 )
+	{
+		int8_t flash = ( frame << 3 ) & *attr;
+		flash >>= 7;
+
+		uint8_t attrInk = ( *attr ^ flash ) & 0x7;
+		uint8_t attrPaper = ( ( *attr ^ flash ) >> 3 ) & 0x7;
+		uint8_t attrBright = ( *attr >> 6 ) & 0x1;
+
+		uint32_t ink = palette[DISPLAY_COLOR( attrBright, attrInk )];
+		uint32_t paper = palette[DISPLAY_COLOR( attrBright, attrPaper )];
+		for( int b = 7; b >= 0; b-- )
+		{
+			if( *src & ( 1 << b ) )
+			{
+				*dest = ink;
+			}
+			else
+			{
+				*dest = paper;
+			}
+			dest++;
+		}
+		src++;
+		attr++;
+	}
+}
@@ -0,0 +1,20 @@
+#if !defined( DISPLAY_H )
+#define DISPLAY_H 1
+
+#include <stdint.h>
+
+#define DISPLAY_BITMAP_SIZE 6144
+#define DISPLAY_ATTR_SIZE 768
+#define DISPLAY_FILE_SIZE ( DISPLAY_BITMAP_SIZE + DISPLAY_ATTR_SIZE )
+
+#define DISPLAY_PALETTE_SIZE 16
+#define DISPLAY_COLOR( bright, index ) ( ( (bright) << 3 ) | (index) )
+
+// RGB for each DISPLAY_COLOR
+extern const uint8_t g_displayColors[DISPLAY_PALETTE_SIZE][3];
+
+// Decodes row sy ( 0 - 191 ) of the display file at mem into PIXEL_WIDTH pixels,
+// looking up ink and paper in palette which is indexed by DISPLAY_COLOR
+void Display_DecodeLine( uint32_t *dest, const uint8_t *mem, int sy, uint8_t frame, const uint32_t *palette );
+
+#endif // DISPLAY_H
@@ -0,0 +1,320 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined( __SSE2__ )
+#include <emmintrin.h>
+#endif
+
+#include "filter.h"
+#include "threadpool.h"
+
+// Source rows per thread pool job
+#define BAND_HEIGHT 16
+
+// Per channel factors ( 256 == 1.0 ) for 12 pixels, a multiple of both the
+// 3 pixel RGB triad and the 4 pixel SIMD width
+#define PATTERN_WIDTH 12
+
+struct FilterDesc
+{
+	const char *name;
+	int scale;
+	bool inPlace;
+	void (*Run)( const FilterImage *src, FilterImage *dst, int y0, int y1 );
+};
+
+struct FilterJob
+{
+	const FilterDesc *desc;
+	const FilterImage *src;
+	FilterImage *dst;
+};
+
+static uint16_t s_scanlineFactors[PATTERN_WIDTH * 4];
+static uint16_t s_maskFactors[PATTERN_WIDTH * 4];
+
+static FilterType s_chain[FILTER_MAX_CHAIN];
+static int s_chainLength = 0;
+static FilterImage s_buffers[FILTER_MAX_CHAIN];
+
+static void ModulateRow( const uint32_t *src, uint32_t *dst, int width, const uint16_t *factors )
+{
+	int x = 0;
+
+#if defined( __SSE2__ )
+	const __m128i zero = _mm_setzero_si128();
+	for( ; x + 4 <= width; x += 4 )
+	{
+		const uint16_t *f = factors + ( ( x % PATTERN_WIDTH ) * 4 );
+		__m128i p = _mm_loadu_si128( (const __m128i *)( src + x ) );
+		__m128i lo = _mm_unpacklo_epi8( p, zero );
+		__m128i hi = _mm_unpackhi_epi8( p, zero );
+		lo = _mm_srli_epi16( _mm_mullo_epi16( lo, _mm_loadu_si128( (const __m128i *)f ) ), 8 );
+		hi = _mm_srli_epi16( _mm_mullo_epi16( hi, _mm_loadu_si128( (const __m128i *)( f + 8 ) ) ), 8 );
+		_mm_storeu_si128( (__m128i *)( dst + x ), _mm_packus_epi16( lo, hi ) );
+	}
+#endif
+
+	for( ; x < width; x++ )
+	{
+		const uint16_t *f = factors + ( ( x % PATTERN_WIDTH ) * 4 );
+		uint32_t p = src[x];
+		uint32_t out = 0;
+		for( int c = 0; c < 4; c++ )
+		{
+			out |= ( ( ( ( p >> ( c * 8 ) ) & 0xff ) * f[c] ) >> 8 ) << ( c * 8 );
+		}
+		dst[x] = out;
+	}
+}
+
+static void RunScanlines( const FilterImage *src, FilterImage *dst, int y0, int y1 )
+{
+	for( int y = y0; y < y1; y++ )
+	{
+		const uint32_t *in = src->pixels + ( y * src->pitch );
+		uint32_t *out = dst->pixels + ( y * dst->pitch );
+		if( y & 1 )
+			ModulateRow( in, out, src->width, s_scanlineFactors );
+		else if( in != out )
+			memcpy( out, in, src->width * sizeof( uint32_t ) );
+	}
+}
+
+static void RunRGBMask( const FilterImage *src, FilterImage *dst, int y0, int y1 )
+{
+	for( int y = y0; y < y1; y++ )
+	{
+		ModulateRow( src->pixels + ( y * src->pitch ), dst->pixels + ( y * dst->pitch ), src->width, s_maskFactors );
+	}
+}
+
+static void Scale2xSpan( const uint32_t *above, const uint32_t *row, const uint32_t *below, uint32_t *out0, uint32_t *out1, int width, int x0, int x1 )
+{
+	for( int x = x0; x < x1; x++ )
+	{
+		const uint32_t B = above[x];
+		const uint32_t D = row[x > 0 ? x - 1 : x];
+		const uint32_t E = row[x];
+		const uint32_t F = row[x < width - 1 ? x + 1 : x];
+		const uint32_t H = below[x];
+
+		out0[x * 2 + 0] = ( D == B && B != F && D != H ) ? D : E;
+		out0[x * 2 + 1] = ( B == F && B != D && F != H ) ? F : E;
+		out1[x * 2 + 0] = ( D == H && D != B && H != F ) ? D : E;
+		out1[x * 2 + 1] = ( H == F && D != H && B != F ) ? F : E;
+	}
+}
+
+static void RunScale2x( const FilterImage *src, FilterImage *dst, int y0, int y1 )
+{
+	for( int y = y0; y < y1; y++ )
+	{
+		const uint32_t *row = src->pixels + ( y * src->pitch );
+		const uint32_t *above = y > 0 ? row - src->pitch : row;
+		const uint32_t *below = y < src->height - 1 ? row + src->pitch : row;
+		uint32_t *out0 = dst->pixels + ( ( y * 2 ) * dst->pitch );
+		uint32_t *out1 = out0 + dst->pitch;
+		const int width = src->width;
+
+		int x = 0;
+#if defined( __SSE2__ )
+		// The first and last pixels need clamped neighbours, leave them to the scalar path
+		Scale2xSpan( above, row, below, out0, out1, width, 0, 1 );
+		x = 1;
+		for( ; x + 4 < width; x += 4 )
+		{
+			const __m128i B = _mm_loadu_si128( (const __m128i *)( above + x ) );
+			const __m128i D = _mm_loadu_si128( (const __m128i *)( row + x - 1 ) );
+			const __m128i E = _mm_loadu_si128( (const __m128i *)( row + x ) );
+			const __m128i F = _mm_loadu_si128( (const __m128i *)( row + x + 1 ) );
+			const __m128i H = _mm_loadu_si128( (const __m128i *)( below + x ) );
+
+			const __m128i DB = _mm_cmpeq_epi32( D, B );
+			const __m128i BF = _mm_cmpeq_epi32( B, F );
+			const __m128i DH = _mm_cmpeq_epi32( D, H );
+			const __m128i FH = _mm_cmpeq_epi32( F, H );
+
+			const __m128i m0 = _mm_andnot_si128( DH, _mm_andnot_si128( BF, DB ) );
+			const __m128i m1 = _mm_andnot_si128( FH, _mm_andnot_si128( DB, BF ) );
+			const __m128i m2 = _mm_andnot_si128( FH, _mm_andnot_si128( DB, DH ) );
+			const __m128i m3 = _mm_andnot_si128( BF, _mm_andnot_si128( DH, FH ) );
+
+			const __m128i e0 = _mm_or_si128( _mm_and_si128( m0, D ), _mm_andnot_si128( m0, E ) );
+			const __m128i e1 = _mm_or_si128( _mm_and_si128( m1, F ), _mm_andnot_si128( m1, E ) );
+			const __m128i e2 = _mm_or_si128( _mm_and_si128( m2, D ), _mm_andnot_si128( m2, E ) );
+			const __m128i e3 = _mm_or_si128( _mm_and_si128( m3, F ), _mm_andnot_si128( m3, E ) );
+
+			_mm_storeu_si128( (__m128i *)( out0 + ( x * 2 ) ), _mm_unpacklo_epi32( e0, e1 ) );
+			_mm_storeu_si128( (__m128i *)( out0 + ( x * 2 ) + 4 ), _mm_unpackhi_epi32( e0, e1 ) );
+			_mm_storeu_si128( (__m128i *)( out1 + ( x * 2 ) ), _mm_unpacklo_epi32( e2, e3 ) );
+			_mm_storeu_si128( (__m128i *)( out1 + ( x * 2 ) + 4 ), _mm_unpackhi_epi32( e2, e3 ) );
+		}
+#endif
+		Scale2xSpan( above, row, below, out0, out1, width, x, width );
+	}
+}
+
+static const FilterDesc s_filters[FILTER_COUNT] =
+{
+	{ "scale2x", 2, false, RunScale2x },
+	{ "scanlines", 1, true, RunScanlines },
+	{ "mask", 1, true, RunRGBMask },
+};
+
+static int MaskShift( uint32_t mask )
+{
+	int shift = 0;
+	while( mask && ( mask & 1 ) == 0 )
+	{
+		mask >>= 1;
+		shift++;
+	}
+	return shift / 8;
+}
+
+void Filter_Init( uint32_t rMask, uint32_t gMask, uint32_t bMask )
+{
+	const int channel[3] = { MaskShift( rMask ), MaskShift( gMask ), MaskShift( bMask ) };
+
+	for( int x = 0; x < PATTERN_WIDTH; x++ )
+	{
+		for( int c = 0; c < 4; c++ )
+		{
+			s_scanlineFactors[x * 4 + c] = 256;
+			s_maskFactors[x * 4 + c] = 256;
+		}
+
+		// Each pixel of a triad keeps one primary at full strength
+		for( int c = 0; c < 3; c++ )
+		{
+			s_scanlineFactors[x * 4 + channel[c]] = 180;
+			if( c != x % 3 )
+				s_maskFactors[x * 4 + channel[c]] = 160;
+		}
+	}
+
+	memset( s_buffers, 0, sizeof( s_buffers ) );
+}
+
+void Filter_Shutdown()
+{
+	for( int i = 0; i < FILTER_MAX_CHAIN; i++ )
+	{
+		free( s_buffers[i].pixels );
+	}
+	memset( s_buffers, 0, sizeof( s_buffers ) );
+}
+
+void Filter_SetChain( const FilterType *types, int count )
+{
+	if( count > FILTER_MAX_CHAIN )
+		count = FILTER_MAX_CHAIN;
+
+	memcpy( s_chain, types, count * sizeof( FilterType ) );
+	s_chainLength = count;
+}
+
+bool Filter_ParseChain( const char *str )
+{
+	FilterType chain[FILTER_MAX_CHAIN];
+	int count = 0;
+
+	while( *str )
+	{
+		const char *end = strchr( str, ',' );
+		size_t len = end ? (size_t)( end - str ) : strlen( str );
+
+		if( len == 4 && strncmp( str, "none", 4 ) == 0 )
+		{
+			count = 0;
+		}
+		else
+		{
+			int i;
+			for( i = 0; i < FILTER_COUNT; i++ )
+			{
+				if( strlen( s_filters[i].name ) == len && strncmp( str, s_filters[i].name, len ) == 0 )
+					break;
+			}
+
+			if( i == FILTER_COUNT || count == FILTER_MAX_CHAIN )
+			{
+				printf( "Unknown filter chain: %s\n", str );
+				return false;
+			}
+			chain[count++] = (FilterType)i;
+		}
+
+		str += len;
+		if( *str == ',' )
+			str++;
+	}
+
+	Filter_SetChain( chain, count );
+	return true;
+}
+
+int Filter_ChainLength()
+{
+	return s_chainLength;
+}
+
+void Filter_OutputSize( int width, int height, int *outWidth, int *outHeight )
+{
+	for( int i = 0; i < s_chainLength; i++ )
+	{
+		width *= s_filters[s_chain[i]].scale;
+		height *= s_filters[s_chain[i]].scale;
+	}
+
+	*outWidth = width;
+	*outHeight = height;
+}
+
+static void RunBand( void *context, int index )
+{
+	const FilterJob *job = (const FilterJob *)context;
+	const int y0 = index * BAND_HEIGHT;
+	const int y1 = y0 + BAND_HEIGHT < job->src->height ? y0 + BAND_HEIGHT : job->src->height;
+
+	job->desc->Run( job->src, job->dst, y0, y1 );
+}
+
+const FilterImage *Filter_Apply( const FilterImage *src )
+{
+	const FilterImage *in = src;
+
+	for( int i = 0; i < s_chainLength; i++ )
+	{
+		const FilterDesc *desc = &s_filters[s_chain[i]];
+		FilterImage *out = &s_buffers[i];
+
+		// Never modify the caller's image
+		if( desc->inPlace && in != src )
+		{
+			out = (FilterImage *)in;
+		}
+		else
+		{
+			const int width = in->width * desc->scale;
+			const int height = in->height * desc->scale;
+			if( out->width != width || out->height != height )
+			{
+				free( out->pixels );
+				out->pixels = (uint32_t *)malloc( width * height * sizeof( uint32_t ) );
+				out->width = width;
+				out->height = height;
+				out->pitch = width;
+			}
+		}
+
+		FilterJob job = { desc, in, out };
+		ThreadPool_Run( RunBand, &job, ( in->height + BAND_HEIGHT - 1 ) / BAND_HEIGHT );
+
+		in = out;
+	}
+
+	return in;
+}
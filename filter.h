@@ -0,0 +1,40 @@
+#if !defined( FILTER_H )
+#define FILTER_H 1
+
+#include <stdint.h>
+
+enum FilterType
+{
+	FILTER_SCALE2X,		// edge directed 2x smoothing scale (EPX/AdvMAME2x)
+	FILTER_SCANLINES,	// darken odd lines
+	FILTER_RGBMASK,		// aperture grille style RGB triads
+
+	FILTER_COUNT
+};
+
+#define FILTER_MAX_CHAIN 8
+
+struct FilterImage
+{
+	uint32_t *pixels;
+	int width;
+	int height;
+	int pitch;	// in pixels
+};
+
+// Channel masks give the layout of the 32-bit pixels being filtered, bands
+// are processed on the ThreadPool which must be initialised by the caller
+void Filter_Init( uint32_t rMask, uint32_t gMask, uint32_t bMask );
+void Filter_Shutdown();
+
+void Filter_SetChain( const FilterType *types, int count );
+bool Filter_ParseChain( const char *str );
+int Filter_ChainLength();
+
+void Filter_OutputSize( int width, int height, int *outWidth, int *outHeight );
+
+// Runs the chain over src, returns the final image which is owned by the
+// filter system and valid until the next call. Returns src for an empty chain.
+const FilterImage *Filter_Apply( const FilterImage *src );
+
+#endif // FILTER_H
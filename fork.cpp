@@ -0,0 +1,123 @@
+#include <atomic>
+#include <assert.h>
+
+#include "fork.h"
+
+struct ForkPage
+{
+	std::atomic<int> refs;
+	uint8_t data[Z_PAGE_SIZE];
+};
+
+struct Fork
+{
+	// Must be first, write faults get back to the fork from the ZState
+	Machine M;
+
+	ForkPage *page[MACHINE_RAM_PAGES];
+};
+
+static ForkPage *NewPage( const uint8_t *data )
+{
+	ForkPage *page = new ForkPage;
+	page->refs = 1;
+	memcpy( page->data, data, Z_PAGE_SIZE );
+	return page;
+}
+
+static void ReleasePage( ForkPage *page )
+{
+	if( page->refs.fetch_sub( 1 ) == 1 )
+		delete page;
+}
+
+static uint8_t *ForkWriteFault( ZState *Z, uint16_t address )
+{
+	Fork *F = (Fork *)Z;
+
+	int index = ( address >> Z_PAGE_SHIFT ) - MACHINE_RAM_PAGE;
+	if( index < 0 )
+		return NULL;	// ROM
+
+	// Still shared, take a private copy. If the other owners have gone since the
+	// clone the page can be taken over as it is.
+	ForkPage *page = F->page[index];
+	if( page->refs.load() != 1 )
+	{
+		ForkPage *copy = NewPage( page->data );
+		ReleasePage( page );
+		F->page[index] = page = copy;
+	}
+
+	ZPage *zp = &Z->page[MACHINE_RAM_PAGE + index];
+	zp->read = page->data;
+	zp->write = page->data;
+	return page->data;
+}
+
+static void MapPages( Fork *F, bool writable )
+{
+	ZState *Z = &F->M.Z;
+	for( int i = 0; i < MACHINE_RAM_PAGES; i++ )
+	{
+		ZPage *zp = &Z->page[MACHINE_RAM_PAGE + i];
+		zp->read = F->page[i]->data;
+		zp->write = writable ? F->page[i]->data : NULL;
+	}
+}
+
+Fork *Fork_Create( const Machine *M )
+{
+	assert( M->model == MODEL_48K );
+
+	Fork *F = new Fork;
+	F->M = *M;
+	F->M.ram = NULL;
+	F->M.border = NULL;
+	F->M.beeper = NULL;
+	F->M.Z.WriteFault = ForkWriteFault;
+
+	for( int i = 0; i < MACHINE_RAM_PAGES; i++ )
+		F->page[i] = NewPage( M->Z.page[MACHINE_RAM_PAGE + i].read );
+
+	MapPages( F, true );
+	return F;
+}
+
+Fork *Fork_Clone( Fork *parent )
+{
+	Fork *F = new Fork;
+	*F = *parent;
+
+	for( int i = 0; i < MACHINE_RAM_PAGES; i++ )
+		F->page[i]->refs.fetch_add( 1 );
+
+	// Both sides now fault on their first write to each page
+	MapPages( parent, false );
+	MapPages( F, false );
+	return F;
+}
+
+void Fork_Destroy( Fork *F )
+{
+	for( int i = 0; i < MACHINE_RAM_PAGES; i++ )
+		ReleasePage( F->page[i] );
+
+	delete F;
+}
+
+Machine *Fork_Machine( Fork *F )
+{
+	return &F->M;
+}
+
+size_t Fork_PrivateBytes( const Fork *F )
+{
+	size_t bytes = sizeof( Fork );
+	for( int i = 0; i < MACHINE_RAM_PAGES; i++ )
+	{
+		if( F->page[i]->refs.load() == 1 )
+			bytes += sizeof( ForkPage );
+	}
+	return bytes;
+}
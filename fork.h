@@ -0,0 +1,24 @@
+#if !defined( FORK_H )
+#define FORK_H 1
+
+#include "machine.h"
+
+// A machine whose RAM pages are shared copy-on-write with the fork it was
+// cloned from, and whose ROM is shared with every other fork. Cloning costs
+// a reference per RAM page, a page is only copied on its first write.
+// Forks may run on different threads, but a fork must not be cloned or
+// destroyed while it is running.
+struct Fork;
+
+// Root fork holding a copy of M's current state
+Fork *Fork_Create( const Machine *M );
+Fork *Fork_Clone( Fork *parent );
+void Fork_Destroy( Fork *F );
+
+// Run it with Machine_RunFrame, save and restore it with Machine_SaveState / Machine_RestoreState
+Machine *Fork_Machine( Fork *F );
+
+// Bytes held by this fork alone, the fork itself plus the pages it has copied
+size_t Fork_PrivateBytes( const Fork *F );
+
+#endif // FORK_H
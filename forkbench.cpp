@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <vector>
+
+#include "boot.h"
+#include "fork.h"
+#include "machine.h"
+#include "threadpool.h"
+
+#define KEY_COUNT 40
+
+struct Explore
+{
+	std::vector<Fork *> forks;
+	int frames;
+};
+
+static double Seconds( std::chrono::steady_clock::time_point start )
+{
+	return std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+}
+
+// Each fork holds a different key for a frame, then runs on
+static void ExploreJob( void *context, int index )
+{
+	Explore *explore = (Explore *)context;
+	Machine *M = Fork_Machine( explore->forks[index] );
+
+	int key = index % KEY_COUNT;
+	M->keyState.row[SK_ROW( key )] &= ~SK_MASK( key );
+	Machine_RunFrame( M, NULL, NULL );
+	memset( &M->keyState, 0xff, sizeof( M->keyState ) );
+
+	for( int i = 1; i < explore->frames; i++ )
+		Machine_RunFrame( M, NULL, NULL );
+}
+
+static void Usage()
+{
+	printf( "Usage: forkbench [-forks n] [-frames n] [-clones n] [-threads n]\n" );
+}
+
+int main( int argc, char *argv[] )
+{
+	int forkCount = 256;
+	int frames = 50;
+	int clones = 100000;
+	int threads = 0;
+
+	for( int i = 1; i < argc; i++ )
+	{
+		if( strcmp( argv[i], "-forks" ) == 0 && i + 1 < argc )
+			forkCount = atoi( argv[++i] );
+		else if( strcmp( argv[i], "-frames" ) == 0 && i + 1 < argc )
+			frames = atoi( argv[++i] );
+		else if( strcmp( argv[i], "-clones" ) == 0 && i + 1 < argc )
+			clones = atoi( argv[++i] );
+		else if( strcmp( argv[i], "-threads" ) == 0 && i + 1 < argc )
+			threads = atoi( argv[++i] );
+		else
+		{
+			Usage();
+			return 1;
+		}
+	}
+
+	static uint8_t rom[MACHINE_ROM_SIZE];
+	static uint8_t ram[MACHINE_RAM_SIZE];
+	static Machine M;
+
+	if( !Machine_LoadROM( rom, "roms/48.rom" ) )
+	{
+		printf( "Could not read rom file\n" );
+		return 1;
+	}
+
+	Machine_Init( &M, rom, ram );
+	if( !Boot_Machine( &M, Boot_CacheDir() ) )
+	{
+		printf( "The ROM never reached its copyright message\n" );
+		return 1;
+	}
+
+	Fork *root = Fork_Create( &M );
+
+	// Clone and throw away, the cost of a fork that is never run
+	auto start = std::chrono::steady_clock::now();
+	for( int i = 0; i < clones; i++ )
+		Fork_Destroy( Fork_Clone( root ) );
+	double cloneTime = Seconds( start );
+
+	printf( "Clone: %d forks in %.3fs (%.0f forks/s)\n", clones, cloneTime, clones / cloneTime );
+
+	ThreadPool_Init( threads );
+
+	Explore explore;
+	explore.frames = frames;
+	for( int i = 0; i < forkCount; i++ )
+		explore.forks.push_back( Fork_Clone( root ) );
+
+	start = std::chrono::steady_clock::now();
+	ThreadPool_Run( ExploreJob, &explore, forkCount );
+	double runTime = Seconds( start );
+
+	size_t privateBytes = 0;
+	for( Fork *F : explore.forks )
+		privateBytes += Fork_PrivateBytes( F );
+
+	printf( "Explore: %d forks x %d frames in %.3fs on %d threads (%.0f frames/s)\n", forkCount, frames, runTime,
+		ThreadPool_ThreadCount(), forkCount * frames / runTime );
+	printf( "Memory: %.1fKB per fork after running, %.1fKB for a full machine state\n",
+		privateBytes / (double)forkCount / 1024.0, sizeof( MachineState ) / 1024.0 );
+
+	for( Fork *F : explore.forks )
+		Fork_Destroy( F );
+	Fork_Destroy( root );
+
+	ThreadPool_Shutdown();
+
+	return 0;
+}
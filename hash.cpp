@@ -0,0 +1,49 @@
+#include <string.h>
+
+#include "hash.h"
+
+#define K1 0x87c37b91114253d5ull
+#define K2 0x4cf5ad432745937full
+
+static inline uint64_t Rotl( uint64_t v, int r )
+{
+	return ( v << r ) | ( v >> ( 64 - r ) );
+}
+
+static inline uint64_t Mix( uint64_t h )
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ull;
+	h ^= h >> 33;
+	return h;
+}
+
+uint64_t Hash_Bytes( const void *data, size_t size, uint64_t seed )
+{
+	const uint8_t *p = (const uint8_t *)data;
+	uint64_t h = seed ^ ( size * K1 );
+
+	while( size >= 8 )
+	{
+		uint64_t w;
+		memcpy( &w, p, 8 );
+		w *= K1;
+		w = Rotl( w, 31 );
+		w *= K2;
+		h ^= w;
+		h = Rotl( h, 27 ) * 5 + 0x52dce729;
+		p += 8;
+		size -= 8;
+	}
+
+	uint64_t tail = 0;
+	for( size_t i = 0; i < size; i++ )
+	{
+		tail |= (uint64_t)p[i] << ( i * 8 );
+	}
+	h ^= tail * K2;
+
+	return Mix( h );
+}
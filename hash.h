@@ -0,0 +1,12 @@
+#if !defined( HASH_H )
+#define HASH_H 1
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define HASH_SEED 0x9e3779b97f4a7c15ull
+
+// Fast non-cryptographic 64-bit hash, chain calls by passing the previous result as seed
+uint64_t Hash_Bytes( const void *data, size_t size, uint64_t seed );
+
+#endif // HASH_H
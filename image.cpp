@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zlib.h>
+
+#include "image.h"
+
+bool Image_WritePPM( const char *name, const uint8_t *rgb, int width, int height )
+{
+	FILE *fp = fopen( name, "wb" );
+	if( fp == NULL )
+		return false;
+
+	fprintf( fp, "P6\n%d %d\n255\n", width, height );
+	bool ok = fwrite( rgb, width * height * 3, 1, fp ) == 1;
+
+	return fclose( fp ) == 0 && ok;
+}
+
+static void Put32( uint8_t *p, uint32_t v )
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static bool WriteChunk( FILE *fp, const char *type, const uint8_t *data, uint32_t size )
+{
+	uint8_t header[8];
+	Put32( header, size );
+	memcpy( header + 4, type, 4 );
+
+	uint32_t crc = crc32( 0, header + 4, 4 );
+	if( size > 0 )
+		crc = crc32( crc, data, size );
+
+	uint8_t footer[4];
+	Put32( footer, crc );
+
+	return fwrite( header, 8, 1, fp ) == 1
+		&& ( size == 0 || fwrite( data, size, 1, fp ) == 1 )
+		&& fwrite( footer, 4, 1, fp ) == 1;
+}
+
+bool Image_WritePNG( const char *name, const uint8_t *indices, int width, int height, const uint8_t (*palette)[3], int paletteSize )
+{
+	static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+	const int depth = paletteSize <= 16 ? 4 : 8;
+	const int stride = depth == 4 ? ( width + 1 ) / 2 : width;
+
+	// Filter type 0 per row followed by the packed indices
+	const uLong rawSize = ( stride + 1 ) * height;
+	uint8_t *raw = (uint8_t *)malloc( rawSize );
+	uLong packedSize = compressBound( rawSize );
+	uint8_t *packed = (uint8_t *)malloc( packedSize );
+
+	uint8_t *dest = raw;
+	for( int y = 0; y < height; y++ )
+	{
+		const uint8_t *src = indices + ( y * width );
+		*dest++ = 0;
+		if( depth == 4 )
+		{
+			for( int x = 0; x < width; x += 2 )
+			{
+				uint8_t hi = src[x] << 4;
+				uint8_t lo = x + 1 < width ? src[x + 1] : 0;
+				*dest++ = hi | lo;
+			}
+		}
+		else
+		{
+			memcpy( dest, src, width );
+			dest += width;
+		}
+	}
+
+	bool ok = compress2( packed, &packedSize, raw, rawSize, Z_DEFAULT_COMPRESSION ) == Z_OK;
+
+	uint8_t ihdr[13];
+	Put32( ihdr, width );
+	Put32( ihdr + 4, height );
+	ihdr[8] = depth;
+	ihdr[9] = 3;	// indexed colour
+	ihdr[10] = 0;
+	ihdr[11] = 0;
+	ihdr[12] = 0;
+
+	FILE *fp = ok ? fopen( name, "wb" ) : NULL;
+	if( fp )
+	{
+		ok = fwrite( signature, sizeof( signature ), 1, fp ) == 1
+			&& WriteChunk( fp, "IHDR", ihdr, sizeof( ihdr ) )
+			&& WriteChunk( fp, "PLTE", palette[0], paletteSize * 3 )
+			&& WriteChunk( fp, "IDAT", packed, packedSize )
+			&& WriteChunk( fp, "IEND", NULL, 0 );
+		ok = fclose( fp ) == 0 && ok;
+	}
+	else
+	{
+		ok = false;
+	}
+
+	free( packed );
+	free( raw );
+
+	return ok;
+}
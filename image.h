@@ -0,0 +1,12 @@
+#if !defined( IMAGE_H )
+#define IMAGE_H 1
+
+#include <stdint.h>
+
+// 24-bit binary PPM from packed RGB
+bool Image_WritePPM( const char *name, const uint8_t *rgb, int width, int height );
+
+// Indexed PNG, 4 bits per pixel when the palette has 16 or fewer entries
+bool Image_WritePNG( const char *name, const uint8_t *indices, int width, int height, const uint8_t (*palette)[3], int paletteSize );
+
+#endif // IMAGE_H
@@ -0,0 +1,482 @@
+#include <assert.h>
+#include <stdlib.h>
+
+#include "machine.h"
+#include "mapfile.h"
+#include "snapshot.h"
+
+struct TrapEntry
+{
+	uint16_t address;
+	MachineTrap handler;
+};
+
+static uint32_t s_traps[Z_TRAP_WORDS];
+static TrapEntry s_trapEntry[MACHINE_MAX_TRAPS];
+static int s_trapCount;
+
+static bool TrapDispatch( ZState *Z )
+{
+	uint16_t pc = Z->reg.PC;
+
+	for( int i = 0; i < s_trapCount; i++ )
+	{
+		if( s_trapEntry[i].address == pc )
+			return s_trapEntry[i].handler( (Machine *)Z );
+	}
+	return false;
+}
+
+static uint8_t ULARead( ZState *Z, uint16_t addr )
+{
+	Machine *M = (Machine *)Z;
+
+	if( M->InputHook )
+		M->InputHook( M );
+
+	uint8_t value = 0x00;
+	for( int i = 0; i < 8; i++ )
+	{
+		if( ( addr & ( 0x0100 << i ) ) == 0 )
+		{
+			value = M->keyState.row[i] & 0x1f;
+			break;
+		}
+	}
+
+	if( M->EarHook )
+		value = M->EarHook( M, value );
+
+	return value;
+}
+
+static void ULAWrite( ZState *Z, uint16_t addr, uint8_t value )
+{
+	Machine *M = (Machine *)Z;
+
+	if( M->border && ( ( value ^ M->ula ) & 0x7 ) )
+	{
+		BorderLog *log = M->border;
+		BorderEvent *e = &log->event[log->head & BORDER_LOG_MASK];
+		e->tstate = Machine_FrameTState( M );
+		e->color = value & 0x7;
+		log->head++;
+	}
+
+	if( M->beeper && ( ( value ^ M->ula ) & 0x10 ) )
+	{
+		BeeperLog *log = M->beeper;
+		log->tstate[log->head & BEEPER_LOG_MASK] = Machine_FrameTState( M );
+		log->head++;
+	}
+	M->ula = value;
+}
+
+// Points the ROM pages and the top 16K at the banks port 0x7ffd selects. The region
+// list is kept in step, so rebuilding the page table keeps the paging.
+static void Page128( Machine *M, uint8_t value )
+{
+	ZState *Z = &M->Z;
+	M->port7ffd = value;
+
+	uint8_t *rom = M->rom + ( ( value >> 4 ) & 1 ) * MACHINE_ROM_SIZE;
+	uint8_t *bank = M->ram + ( value & 7 ) * MACHINE_BANK_SIZE;
+	Z->memory[0].ptr = rom;
+	Z->memory[3].ptr = bank;
+
+	ZPage *top = &Z->page[0xc000 >> Z_PAGE_SHIFT];
+	for( int i = 0; i < MACHINE_BANK_PAGES; i++ )
+	{
+		Z->page[i].read = rom + i * Z_PAGE_SIZE;
+		top[i].read = top[i].write = bank + i * Z_PAGE_SIZE;
+	}
+}
+
+static void Port7FFDWrite( ZState *Z, uint16_t addr, uint8_t value )
+{
+	Machine *M = (Machine *)Z;
+	if( ( M->port7ffd & 0x20 ) == 0 )
+		Page128( M, value );
+}
+
+bool Machine_LoadROM( uint8_t *rom, const char *name )
+{
+	FILE *fp = fopen( name, "rb" );
+	if( fp == NULL )
+		return false;
+
+	bool ok = fread( rom, MACHINE_ROM_SIZE, 1, fp ) == 1;
+	fclose( fp );
+
+	return ok;
+}
+
+// The ULA fetches screen bytes for 128 T-states of each of the 192 screen lines,
+// starting a T-state before the first. An access in the first six of each eight is
+// held until the fetches are done.
+#define CONTENTION_START ( ( VBLANK_HEIGHT + TOP_BORDER_HEIGHT ) * TSTATES_PER_LINE - 1 )
+#define CONTENTION_LINE 128
+
+// Instructions overrun the end of the frame by up to a few accesses
+#define CONTENTION_PAD 64
+
+// A table for each turbo multiplier, built when first wanted
+static uint8_t *s_contention[MACHINE_MAX_TURBO + 1];
+
+// With turbo the CPU has several T-states to each of the ULA's, and a held access
+// waits for the ULA T-state it would have waited for at the normal speed
+static const uint8_t *ContentionTable( int turbo )
+{
+	if( s_contention[turbo] )
+		return s_contention[turbo];
+
+	static const uint8_t pattern[8] = { 6, 5, 4, 3, 2, 1, 0, 0 };
+
+	uint8_t *table = (uint8_t *)calloc( FRAME_TSTATES * turbo + CONTENTION_PAD, 1 );
+	for( int line = 0; line < PIXEL_HEIGHT; line++ )
+	{
+		int start = CONTENTION_START + line * TSTATES_PER_LINE;
+		for( int t = start; t < start + CONTENTION_LINE; t++ )
+		{
+			int free = ( t + pattern[( t - start ) & 7] ) * turbo;
+			for( int i = 0; i < turbo; i++ )
+			{
+				// The later sub-T-states of a free slot are free as well
+				int cpuT = t * turbo + i;
+				table[cpuT] = (uint8_t)( free > cpuT ? free - cpuT : 0 );
+			}
+		}
+	}
+
+	s_contention[turbo] = table;
+	return table;
+}
+
+static void InitCommon( Machine *M, MachineModel model, uint8_t *rom, uint8_t *ram )
+{
+	memset( M, 0, sizeof( Machine ) );
+
+	ZState *Z = &M->Z;
+	Z80_Init( Z );
+
+	M->model = model;
+	M->turbo = 1;
+	M->rom = rom;
+	M->ram = ram;
+
+	Z->peripheral[0].mask = 0x0001;
+	Z->peripheral[0].address = 0x0000;
+	Z->peripheral[0].Read = ULARead;
+	Z->peripheral[0].Write = ULAWrite;
+	Z->peripheralCount = 1;
+
+	Z->traps = s_traps;
+	Z->Trap = TrapDispatch;
+
+	memset( &M->keyState, 0xff, sizeof( M->keyState ) );
+}
+
+static void AddMemory( ZState *Z, uint16_t base, uint32_t size, ZMemoryType type, uint8_t *ptr )
+{
+	ZMemory *mem = &Z->memory[Z->memoryCount++];
+	mem->base = base;
+	mem->size = size;
+	mem->type = type;
+	mem->ptr = ptr;
+}
+
+void Machine_Init( Machine *M, uint8_t *rom, uint8_t *ram )
+{
+	InitCommon( M, MODEL_48K, rom, ram );
+
+	// The ULA shares the bottom 16K of RAM
+	ZState *Z = &M->Z;
+	AddMemory( Z, 0x0000, MACHINE_ROM_SIZE, MEM_ROM, rom );
+	AddMemory( Z, 0x4000, MACHINE_BANK_SIZE, MEM_RAM, ram );
+	AddMemory( Z, 0x8000, MACHINE_RAM_SIZE - MACHINE_BANK_SIZE, MEM_RAM, ram + MACHINE_BANK_SIZE );
+	Z->memory[1].contended = true;
+	Z80_MapMemory( Z );
+
+	M->contention = ContentionTable( 1 );
+}
+
+void Machine_SetContention( Machine *M, bool enabled )
+{
+	if( M->model != MODEL_48K )
+		return;
+
+	// Only the flags change, so pages owned elsewhere are left alone
+	ZState *Z = &M->Z;
+	Z->memory[1].contended = enabled;
+	uint64_t pages = ( ( 1ull << MACHINE_BANK_PAGES ) - 1 ) << MACHINE_RAM_PAGE;
+	Z->contended = enabled ? Z->contended | pages : Z->contended & ~pages;
+	M->contention = enabled ? ContentionTable( M->turbo ) : NULL;
+}
+
+bool Machine_SetTurbo( Machine *M, int multiplier )
+{
+	if( multiplier < 1 || multiplier > MACHINE_MAX_TURBO )
+		return false;
+
+	M->turbo = multiplier;
+	if( M->contention )
+		M->contention = ContentionTable( multiplier );
+	return true;
+}
+
+void Machine_Init128( Machine *M, uint8_t *rom, uint8_t *ram )
+{
+	InitCommon( M, MODEL_128K, rom, ram );
+
+	// Banks 5 and 2 are always at 0x4000 and 0x8000, the ROM and the top bank are paged
+	ZState *Z = &M->Z;
+	AddMemory( Z, 0x0000, MACHINE_ROM_SIZE, MEM_ROM, rom );
+	AddMemory( Z, 0x4000, MACHINE_BANK_SIZE, MEM_RAM, ram + 5 * MACHINE_BANK_SIZE );
+	AddMemory( Z, 0x8000, MACHINE_BANK_SIZE, MEM_RAM, ram + 2 * MACHINE_BANK_SIZE );
+	AddMemory( Z, 0xc000, MACHINE_BANK_SIZE, MEM_RAM, ram );
+	Z80_MapMemory( Z );
+
+	// A15 and A1 low
+	Z->peripheral[1].mask = 0x8002;
+	Z->peripheral[1].address = 0x0000;
+	Z->peripheral[1].Write = Port7FFDWrite;
+	Z->peripheralCount = 2;
+}
+
+void Machine_Reset( Machine *M )
+{
+	Z80_Reset( &M->Z );
+
+	if( M->model == MODEL_128K )
+		Page128( M, 0 );
+
+	if( M->ay )
+	{
+		memset( M->ay->reg, 0, sizeof( M->ay->reg ) );
+		M->ay->selected = 0;
+	}
+}
+
+const uint8_t *Machine_Screen( const Machine *M )
+{
+	if( M->model == MODEL_128K )
+		return M->ram + ( ( M->port7ffd & 0x08 ) ? 7 : 5 ) * MACHINE_BANK_SIZE;
+
+	return M->ram;
+}
+
+bool Machine_BasicRomPaged( const Machine *M )
+{
+	return M->model == MODEL_48K || ( M->port7ffd & 0x10 ) != 0;
+}
+
+bool Machine_SetTrap( uint16_t address, MachineTrap handler )
+{
+	int i = 0;
+	while( i < s_trapCount && s_trapEntry[i].address != address )
+		i++;
+
+	if( handler == NULL )
+	{
+		if( i == s_trapCount )
+			return true;
+
+		s_trapEntry[i] = s_trapEntry[--s_trapCount];
+		s_traps[address >> 5] &= ~( 1u << ( address & 31 ) );
+		return true;
+	}
+
+	if( i == MACHINE_MAX_TRAPS )
+		return false;
+
+	if( i == s_trapCount )
+		s_trapCount++;
+
+	s_trapEntry[i].address = address;
+	s_trapEntry[i].handler = handler;
+	s_traps[address >> 5] |= 1u << ( address & 31 );
+	return true;
+}
+
+uint32_t Machine_FrameTState( const Machine *M )
+{
+	return ( M->lineEnd - M->Z.cycles ) / M->turbo;
+}
+
+uint64_t Machine_Time( const Machine *M )
+{
+	return (uint64_t)M->frameCount * FRAME_TSTATES + Machine_FrameTState( M );
+}
+
+void Machine_RunFrame( Machine *M, MachineLineCallback lineCallback, void *context )
+{
+	if( M->border )
+	{
+		M->border->head = 0;
+		M->border->tail = 0;
+		M->border->color = M->ula & 0x7;
+	}
+
+	if( M->beeper )
+	{
+		M->beeper->head = 0;
+		M->beeper->level = ( M->ula >> 4 ) & 1;
+	}
+
+	if( M->ay )
+	{
+		M->ay->head = 0;
+		memcpy( M->ay->start, M->ay->reg, sizeof( M->ay->reg ) );
+	}
+
+	const int lineTStates = TSTATES_PER_LINE * M->turbo;
+	for( int scanline = 0; scanline < SCREEN_HEIGHT + VBLANK_HEIGHT; scanline++ )
+	{
+		M->lineEnd = ( scanline + 1 ) * lineTStates;
+		M->Z.contention = M->contention ? M->contention + M->lineEnd : NULL;
+		Z80_Run( &M->Z, lineTStates );
+		if( lineCallback )
+			lineCallback( M, scanline, context );
+	}
+
+	// Code run outside the frame isn't timed
+	M->Z.contention = NULL;
+
+	M->frame++;
+	M->frameCount++;
+	Z80_MaskableInterrupt( &M->Z );
+}
+
+// Copies a full RAM image in through the page table, leaving unchanged pages alone so shared pages stay shared
+static void WriteRAM( Machine *M, const uint8_t *ram )
+{
+	ZState *Z = &M->Z;
+
+	for( int i = 0; i < MACHINE_RAM_PAGES; i++ )
+	{
+		const uint8_t *src = ram + i * Z_PAGE_SIZE;
+		ZPage *page = &Z->page[MACHINE_RAM_PAGE + i];
+		if( memcmp( page->read, src, Z_PAGE_SIZE ) == 0 )
+			continue;
+
+		uint8_t *dest = page->write;
+		if( dest == NULL )
+			dest = Z->WriteFault( Z, ( MACHINE_RAM_PAGE + i ) << Z_PAGE_SHIFT );
+		memcpy( dest, src, Z_PAGE_SIZE );
+	}
+}
+
+bool Machine_LoadSnapshot( Machine *M, const char *name )
+{
+	MappedFile file;
+	if( !MapFile_Open( &file, name ) )
+		return false;
+
+	// Straight into RAM when nothing needs to see the writes
+	static uint8_t s_scratch[MACHINE_RAM_SIZE];
+	const bool direct = M->model == MODEL_48K && M->ram && M->Z.WriteFault == NULL;
+
+	Snapshot snap;
+	bool ok = Snapshot_Parse( file.data, file.size, &snap, direct ? M->ram : s_scratch );
+	MapFile_Close( &file );
+
+	if( !ok )
+		return false;
+
+	// The 128K runs a 48K snapshot with 48 BASIC paged in and paging locked, as USR 0 leaves it
+	if( M->model == MODEL_128K )
+		Page128( M, 0x30 );
+
+	if( !direct )
+		WriteRAM( M, s_scratch );
+
+	ZState *Z = &M->Z;
+	Z->reg = snap.reg;
+	Z->sreg = snap.sreg;
+	Z->IFF0 = snap.IFF1;
+	Z->IFF1 = snap.IFF2;
+	Z->IMODE = snap.IMODE;
+	Z->NMI = 0;
+	Z->INT = 0;
+	Z->halted = snap.halted;
+	M->ula = snap.border;
+
+	return true;
+}
+
+void Machine_SaveRegisters( const Machine *M, MachineState *state )
+{
+	assert( M->model == MODEL_48K );
+	const ZState *Z = &M->Z;
+
+	state->magic = MACHINE_STATE_MAGIC;
+	state->version = MACHINE_STATE_VERSION;
+	state->size = sizeof( MachineState );
+	state->frameCount = M->frameCount;
+
+	state->reg = Z->reg;
+	state->sreg = Z->sreg;
+	state->cycles = Z->cycles;
+
+	state->IFF0 = Z->IFF0;
+	state->IFF1 = Z->IFF1;
+	state->NMI = Z->NMI;
+	state->INT = Z->INT;
+	state->IMODE = Z->IMODE;
+	state->halted = Z->halted;
+	state->ula = M->ula;
+	state->frame = M->frame;
+
+	state->keyState = M->keyState;
+}
+
+void Machine_SaveState( const Machine *M, MachineState *state )
+{
+	const ZState *Z = &M->Z;
+
+	Machine_SaveRegisters( M, state );
+
+	// Through the page table, the RAM need not be contiguous
+	for( int i = 0; i < MACHINE_RAM_PAGES; i++ )
+		memcpy( state->ram + i * Z_PAGE_SIZE, Z->page[MACHINE_RAM_PAGE + i].read, Z_PAGE_SIZE );
+}
+
+bool Machine_RestoreRegisters( Machine *M, const MachineState *state )
+{
+	if( M->model != MODEL_48K )
+		return false;
+
+	if( state->magic != MACHINE_STATE_MAGIC || state->version != MACHINE_STATE_VERSION || state->size != sizeof( MachineState ) )
+		return false;
+
+	ZState *Z = &M->Z;
+
+	M->frameCount = state->frameCount;
+
+	Z->reg = state->reg;
+	Z->sreg = state->sreg;
+	Z->cycles = state->cycles;
+
+	Z->IFF0 = state->IFF0;
+	Z->IFF1 = state->IFF1;
+	Z->NMI = state->NMI;
+	Z->INT = state->INT;
+	Z->IMODE = state->IMODE;
+	Z->halted = state->halted;
+	M->ula = state->ula;
+	M->frame = state->frame;
+
+	M->keyState = state->keyState;
+
+	return true;
+}
+
+bool Machine_RestoreState( Machine *M, const MachineState *state )
+{
+	if( !Machine_RestoreRegisters( M, state ) )
+		return false;
+
+	WriteRAM( M, state->ram );
+
+	return true;
+}
@@ -0,0 +1,164 @@
+#if !defined( MACHINE_H )
+#define MACHINE_H 1
+
+#include "z80.h"
+#include "speccy.h"
+
+#define MACHINE_ROM_SIZE 0x4000
+#define MACHINE_RAM_SIZE 0xc000
+#define MACHINE_RAM_PAGE ( MACHINE_ROM_SIZE >> Z_PAGE_SHIFT )
+#define MACHINE_RAM_PAGES ( MACHINE_RAM_SIZE >> Z_PAGE_SHIFT )
+
+// The 128K has two ROMs, the 128 editor then 48 BASIC, and eight RAM banks
+#define MACHINE_128_ROM_SIZE ( MACHINE_ROM_SIZE * 2 )
+#define MACHINE_128_RAM_SIZE 0x20000
+#define MACHINE_BANK_SIZE 0x4000
+#define MACHINE_BANK_PAGES ( MACHINE_BANK_SIZE >> Z_PAGE_SHIFT )
+
+enum MachineModel
+{
+	MODEL_48K,
+	MODEL_128K,
+};
+
+struct Machine
+{
+	// Must be first, the ULA gets back to the machine from the ZState it is called with
+	ZState Z;
+
+	MachineModel model;
+
+	uint8_t *rom;
+
+	// Contiguous RAM, NULL when the pages are owned elsewhere ( forks ). The 128K's
+	// banks follow each other in order.
+	uint8_t *ram;
+
+	uint8_t ula;
+
+	// 128K only, the last value written to port 0x7ffd. It pages in the ROM and the
+	// RAM bank at 0xc000 and picks the screen, and once bit 5 is set it's fixed
+	// until reset.
+	uint8_t port7ffd;
+	uint8_t frame;
+	uint32_t frameCount;
+	int lineEnd;
+
+	// CPU T-states to each of the ULA's, 1 at the normal speed
+	int turbo;
+
+	// Delay by CPU T-state for the frame, NULL without contention
+	const uint8_t *contention;
+
+	SpeccyKeyState keyState;
+
+	// Optional, called before the ULA reads keyState
+	void (*InputHook)( Machine *M );
+
+	// Optional, given the keyboard bits read from the ULA, returns them with the EAR input added
+	uint8_t (*EarHook)( Machine *M, uint8_t value );
+
+	// Optional, border changes are only logged when set
+	BorderLog *border;
+
+	// Optional, speaker changes are only logged when set
+	BeeperLog *beeper;
+
+	// The 128K's AY, set by AY_Attach
+	AYRegisters *ay;
+};
+
+typedef void (*MachineLineCallback)( Machine *M, int scanline, void *context );
+
+// Called in place of the instruction at a trapped address, returns false to run it as normal
+typedef bool (*MachineTrap)( Machine *M );
+
+#define MACHINE_MAX_TRAPS 32
+
+bool Machine_LoadROM( uint8_t *rom, const char *name );
+
+// The 48K starts with the ULA's contention of 0x4000-0x7fff and port 0xfe
+void Machine_Init( Machine *M, uint8_t *rom, uint8_t *ram );
+void Machine_Reset( Machine *M );
+
+// Turns contention on or off, only the 48K has it
+void Machine_SetContention( Machine *M, bool enabled );
+
+// Runs the CPU multiplier times faster, up to MACHINE_MAX_TURBO. Frames keep their
+// scanlines and single interrupt, and contention is held to the ULA's T-states, so
+// the CPU just gets more T-states to each line. Timings given by the machine, such as
+// Machine_FrameTState and the logs, stay in the ULA's T-states. Software that times
+// itself, like a tape loader, runs too fast.
+#define MACHINE_MAX_TURBO 16
+bool Machine_SetTurbo( Machine *M, int multiplier );
+
+// rom holds both ROMs and ram all eight banks. Paging only changes pointers in the
+// page table, so it costs the same however often it's done. The frame timing is the
+// 48K's.
+void Machine_Init128( Machine *M, uint8_t *rom, uint8_t *ram );
+
+// The display file and attributes, the shadow screen in bank 7 when the 128K has it
+// switched in
+const uint8_t *Machine_Screen( const Machine *M );
+
+// Whether the 48 BASIC ROM, whose routines the traps stand in for, is paged in
+bool Machine_BasicRomPaged( const Machine *M );
+
+// Traps are shared by every machine, a NULL handler removes one
+bool Machine_SetTrap( uint16_t address, MachineTrap handler );
+
+// Runs one frame, calling lineCallback ( if set ) as each scanline completes
+void Machine_RunFrame( Machine *M, MachineLineCallback lineCallback, void *context );
+
+// The ULA's T-states since the start of the current frame
+uint32_t Machine_FrameTState( const Machine *M );
+
+// T-states since the machine started
+uint64_t Machine_Time( const Machine *M );
+
+// Loads a .sna, .z80 or .szx snapshot, the format is taken from the contents
+bool Machine_LoadSnapshot( Machine *M, const char *name );
+
+
+#define MACHINE_STATE_MAGIC 0x54534d53	// 'SMST'
+#define MACHINE_STATE_VERSION 1
+
+// Bumped when the emulation's timing changes, a state saved by an older build would
+// run on differently from the same point booted by this one
+#define MACHINE_TIMING_VERSION 2
+
+// Flat, versioned copy of everything needed to resume a machine between frames.
+// Saving and restoring is a header check plus a handful of copies. 48K model only.
+struct MachineState
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;
+	uint32_t frameCount;
+
+	RegisterSet reg;
+	RegisterSet sreg;
+	int32_t cycles;
+
+	uint8_t IFF0;
+	uint8_t IFF1;
+	uint8_t NMI;
+	uint8_t INT;
+	uint8_t IMODE;
+	uint8_t halted;
+	uint8_t ula;
+	uint8_t frame;
+
+	SpeccyKeyState keyState;
+
+	uint8_t ram[MACHINE_RAM_SIZE];
+};
+
+void Machine_SaveState( const Machine *M, MachineState *state );
+bool Machine_RestoreState( Machine *M, const MachineState *state );
+
+// Everything but the RAM
+void Machine_SaveRegisters( const Machine *M, MachineState *state );
+bool Machine_RestoreRegisters( Machine *M, const MachineState *state );
+
+#endif // MACHINE_H
@@ -0,0 +1,43 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "mapfile.h"
+
+bool MapFile_Open( MappedFile *file, const char *name )
+{
+	file->data = NULL;
+	file->size = 0;
+
+	int fd = open( name, O_RDONLY );
+	if( fd < 0 )
+		return false;
+
+	struct stat st;
+	if( fstat( fd, &st ) < 0 || st.st_size == 0 )
+	{
+		close( fd );
+		return false;
+	}
+
+	void *ptr = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	close( fd );
+
+	if( ptr == MAP_FAILED )
+		return false;
+
+	file->data = (const uint8_t *)ptr;
+	file->size = st.st_size;
+
+	return true;
+}
+
+void MapFile_Close( MappedFile *file )
+{
+	if( file->data )
+		munmap( (void *)file->data, file->size );
+
+	file->data = NULL;
+	file->size = 0;
+}
@@ -0,0 +1,17 @@
+#if !defined( MAPFILE_H )
+#define MAPFILE_H 1
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct MappedFile
+{
+	const uint8_t *data;
+	size_t size;
+};
+
+// Maps the whole file read-only, returns false if it can't be opened or is empty
+bool MapFile_Open( MappedFile *file, const char *name );
+void MapFile_Close( MappedFile *file );
+
+#endif // MAPFILE_H
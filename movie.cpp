@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+#include "movie.h"
+#include "machine.h"
+#include "hash.h"
+
+#define MOVIE_MAGIC 0x564f4d53	// 'SMOV'
+#define MOVIE_VERSION 1
+
+struct MovieHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t eventCount;
+	uint32_t endFrame;
+	uint64_t endHash;
+};
+
+struct MovieEvent
+{
+	uint32_t frame;
+	uint32_t tstate;
+	SpeccyKeyState keyState;
+};
+
+static std::vector<MovieEvent> s_events;
+static MachineState s_start;
+static MachineState s_scratch;
+static SpeccyKeyState s_keyState;
+static size_t s_next;
+static bool s_playing;
+static uint32_t s_endFrame;
+static uint64_t s_endHash;
+
+static void RecordHook( Machine *M )
+{
+	if( memcmp( &M->keyState, &s_keyState, sizeof( SpeccyKeyState ) ) == 0 )
+		return;
+
+	MovieEvent e;
+	e.frame = M->frameCount;
+	e.tstate = Machine_FrameTState( M );
+	e.keyState = M->keyState;
+	s_events.push_back( e );
+
+	s_keyState = M->keyState;
+}
+
+static void PlayHook( Machine *M )
+{
+	uint32_t tstate = Machine_FrameTState( M );
+
+	while( s_next < s_events.size() )
+	{
+		const MovieEvent *e = &s_events[s_next];
+		if( e->frame > M->frameCount || ( e->frame == M->frameCount && e->tstate > tstate ) )
+			break;
+
+		M->keyState = e->keyState;
+		s_next++;
+	}
+}
+
+uint64_t Movie_StateHash( const Machine *M )
+{
+	Machine_SaveState( M, &s_scratch );
+
+	// The key matrix is input rather than state, and may hold keys pressed after the last read
+	memset( &s_scratch.keyState, 0xff, sizeof( SpeccyKeyState ) );
+
+	return Hash_Bytes( &s_scratch, sizeof( MachineState ), HASH_SEED );
+}
+
+void Movie_Record( Machine *M )
+{
+	Machine_SaveState( M, &s_start );
+	s_keyState = M->keyState;
+	s_events.clear();
+	s_playing = false;
+
+	M->InputHook = RecordHook;
+}
+
+bool Movie_StopRecord( Machine *M, const char *name )
+{
+	M->InputHook = NULL;
+
+	MovieHeader header;
+	header.magic = MOVIE_MAGIC;
+	header.version = MOVIE_VERSION;
+	header.eventCount = (uint32_t)s_events.size();
+	header.endFrame = M->frameCount;
+	header.endHash = Movie_StateHash( M );
+
+	FILE *fp = fopen( name, "wb" );
+	if( fp == NULL )
+		return false;
+
+	bool ok = fwrite( &header, sizeof( header ), 1, fp ) == 1;
+	ok = ok && fwrite( &s_start, sizeof( MachineState ), 1, fp ) == 1;
+	if( header.eventCount > 0 )
+		ok = ok && fwrite( s_events.data(), sizeof( MovieEvent ), header.eventCount, fp ) == header.eventCount;
+
+	ok = fclose( fp ) == 0 && ok;
+	return ok;
+}
+
+bool Movie_Play( Machine *M, const char *name )
+{
+	FILE *fp = fopen( name, "rb" );
+	if( fp == NULL )
+		return false;
+
+	MovieHeader header;
+	bool ok = fread( &header, sizeof( header ), 1, fp ) == 1;
+	ok = ok && header.magic == MOVIE_MAGIC && header.version == MOVIE_VERSION;
+	ok = ok && fread( &s_start, sizeof( MachineState ), 1, fp ) == 1;
+	if( ok )
+	{
+		s_events.resize( header.eventCount );
+		if( header.eventCount > 0 )
+			ok = fread( s_events.data(), sizeof( MovieEvent ), header.eventCount, fp ) == header.eventCount;
+	}
+	fclose( fp );
+
+	if( !ok || !Machine_RestoreState( M, &s_start ) )
+		return false;
+
+	s_next = 0;
+	s_playing = true;
+	s_endFrame = header.endFrame;
+	s_endHash = header.endHash;
+
+	M->InputHook = PlayHook;
+	return true;
+}
+
+bool Movie_Playing( const Machine *M )
+{
+	return s_playing && M->frameCount < s_endFrame;
+}
+
+bool Movie_Verify( const Machine *M )
+{
+	return s_playing && M->frameCount == s_endFrame && Movie_StateHash( M ) == s_endHash;
+}
+
+uint32_t Movie_EndFrame()
+{
+	return s_endFrame;
+}
@@ -0,0 +1,31 @@
+#if !defined( MOVIE_H )
+#define MOVIE_H 1
+
+#include <stdint.h>
+
+struct Machine;
+
+// An input movie is the machine state it starts from, every change to the key
+// matrix stamped with the frame and T-state the ULA first saw it, and a hash of
+// the final state. Changes are picked up and injected on keyboard reads, so
+// replay is exact whatever the host did between frames.
+
+// Starts recording M from its current state
+void Movie_Record( Machine *M );
+bool Movie_StopRecord( Machine *M, const char *name );
+
+// Restores the starting state into M and injects the recorded input from then on
+bool Movie_Play( Machine *M, const char *name );
+
+// True while replaying and the final frame has not been reached
+bool Movie_Playing( const Machine *M );
+
+// Once playback has reached the final frame, whether the state matches the recording
+bool Movie_Verify( const Machine *M );
+
+uint32_t Movie_EndFrame();
+
+// Hash of everything in the machine's state
+uint64_t Movie_StateHash( const Machine *M );
+
+#endif // MOVIE_H
@@ -0,0 +1,108 @@
+#include "SDL.h"
+
+#include "pacing.h"
+#include "audio.h"
+#include "z80.h"
+#include "speccy.h"
+
+#define NS_PER_SECOND 1000000000ull
+
+// Frame period in ns, 69888 T-states at 3.5MHz is 19.968ms (50.08Hz)
+#define FRAME_NS ( (uint64_t)FRAME_TSTATES * NS_PER_SECOND / CPU_CLOCK_HZ )
+
+// If we fall further behind than this, give up on catching up
+#define MAX_LAG_FRAMES 4
+
+// SDL_Delay is only millisecond accurate, spin for the last part
+#define SPIN_NS 2000000ull
+
+static PaceMode s_mode = PACE_REALTIME;
+static int s_factor = 1;
+static uint64_t s_period = FRAME_NS;
+static uint64_t s_deadline = 0;
+static uint32_t s_frameCount = 0;
+
+static uint64_t s_counterFreq = 0;
+
+uint64_t Pacing_Now()
+{
+	uint64_t counter = SDL_GetPerformanceCounter();
+	uint64_t seconds = counter / s_counterFreq;
+	uint64_t rem = counter % s_counterFreq;
+
+	return ( seconds * NS_PER_SECOND ) + ( ( rem * NS_PER_SECOND ) / s_counterFreq );
+}
+
+void Pacing_SetMode( PaceMode mode, int factor )
+{
+	if( factor < 1 )
+		factor = 1;
+
+	s_mode = mode;
+	s_factor = factor;
+
+	if( mode == PACE_SPEED )
+		s_period = FRAME_NS / factor;
+	else
+		s_period = FRAME_NS;
+
+	s_deadline = Pacing_Now() + s_period;
+	s_frameCount = 0;
+
+	Audio_SetSync( mode == PACE_AUDIO );
+}
+
+void Pacing_Init( PaceMode mode, int factor )
+{
+	s_counterFreq = SDL_GetPerformanceFrequency();
+	Pacing_SetMode( mode, factor );
+}
+
+PaceMode Pacing_GetMode()
+{
+	return s_mode;
+}
+
+bool Pacing_RenderFrame()
+{
+	if( s_mode != PACE_WARP_SKIP )
+		return true;
+
+	return ( s_frameCount % s_factor ) == 0;
+}
+
+void Pacing_EndFrame()
+{
+	s_frameCount++;
+
+	if( s_mode == PACE_WARP || s_mode == PACE_WARP_SKIP )
+		return;
+
+	// The device takes samples in blocks, so frames are presented at the nearest
+	// point after their time
+	if( s_mode == PACE_AUDIO )
+	{
+		Audio_Wait();
+		return;
+	}
+
+	uint64_t now = Pacing_Now();
+
+	if( now < s_deadline )
+	{
+		uint64_t remaining = s_deadline - now;
+		if( remaining > SPIN_NS )
+			SDL_Delay( (uint32_t)( ( remaining - SPIN_NS ) / 1000000ull ) );
+
+		while( Pacing_Now() < s_deadline )
+			;
+	}
+	else if( now - s_deadline > s_period * MAX_LAG_FRAMES )
+	{
+		s_deadline = now;
+	}
+
+	// Advance from the previous deadline rather than from now so that
+	// oversleeping in one frame is paid back in the next
+	s_deadline += s_period;
+}
@@ -0,0 +1,24 @@
+#if !defined( PACING_H )
+#define PACING_H 1
+
+#include <stdint.h>
+
+enum PaceMode
+{
+	PACE_REALTIME,		// 50.08Hz, one emulated frame per real frame
+	PACE_SPEED,			// factor x real time
+	PACE_WARP,			// unthrottled
+	PACE_WARP_SKIP,		// unthrottled, render and present every factor'th frame
+	PACE_AUDIO,			// one emulated frame per frame of audio played
+};
+
+void Pacing_Init( PaceMode mode, int factor );
+void Pacing_SetMode( PaceMode mode, int factor );
+PaceMode Pacing_GetMode();
+
+uint64_t Pacing_Now();
+
+bool Pacing_RenderFrame();
+void Pacing_EndFrame();
+
+#endif // PACING_H
@@ -8,10 +8,11 @@ solution "Speccy"
 	project "Speccy"
 		kind "ConsoleApp"
 		language "C++"
-		files { z80_files, "speccy.h", "speccy.cpp", "screen.h", "screen.cpp" }
+		files { z80_files, "speccy.h", "speccy.cpp", "machine.h", "machine.cpp", "screen.h", "screen.cpp", "display.h", "display.cpp", "pacing.h", "pacing.cpp", "filter.h", "filter.cpp", "threadpool.h", "threadpool.cpp", "hash.h", "hash.cpp", "image.h", "image.cpp", "rewind.h", "rewind.cpp", "statefile.h", "statefile.cpp", "movie.h", "movie.cpp", "snapshot.h", "snapshot.cpp", "mapfile.h", "mapfile.cpp", "tape.h", "tape.cpp", "tapestream.h", "tapestream.cpp", "calc.h", "calc.cpp", "print.h", "print.cpp", "boot.h", "boot.cpp", "basic.h", "basic.cpp", "audio.h", "audio.cpp", "ay.h", "ay.cpp" }
+		buildoptions { "-std=c++11" }
 		includedirs { "/usr/local/include/SDL2/" }
 		libdirs { "/usr/local/lib/" }
-		links { "SDL2" }
+		links { "SDL2", "z", "pthread" }
 
 		configuration "Debug"
 			defines { "DEBUG" }
@@ -40,4 +41,92 @@ solution "Speccy"
 			targetdir "release/"
 
 
+	project "Shots"
+		kind "ConsoleApp"
+		language "C++"
+		files { "shots.cpp", "speccy.h", "display.h", "display.cpp", "image.h", "image.cpp", "mapfile.h", "mapfile.cpp", "threadpool.h", "threadpool.cpp", "snapshot.h", "snapshot.cpp" }
+		buildoptions { "-std=c++11" }
+		links { "z", "pthread" }
+
+		configuration "Debug"
+			defines { "DEBUG" }
+			flags { "Symbols" }
+			targetdir "debug/"
+
+		configuration "Release"
+			defines {}
+			flags { "Symbols", "Optimize" }
+			targetdir "release/"
+
+
+
+	project "ForkBench"
+		kind "ConsoleApp"
+		language "C++"
+		files { z80_files, "forkbench.cpp", "speccy.h", "machine.h", "machine.cpp", "boot.h", "boot.cpp", "hash.h", "hash.cpp", "fork.h", "fork.cpp", "threadpool.h", "threadpool.cpp", "snapshot.h", "snapshot.cpp", "mapfile.h", "mapfile.cpp" }
+		buildoptions { "-std=c++11" }
+		links { "z", "pthread" }
+
+		configuration "Debug"
+			defines { "DEBUG" }
+			flags { "Symbols" }
+			targetdir "debug/"
+
+		configuration "Release"
+			defines {}
+			flags { "Symbols", "Optimize" }
+			targetdir "release/"
+
+
+	project "PrintTest"
+		kind "ConsoleApp"
+		language "C++"
+		files { z80_files, "printtest.cpp", "speccy.h", "machine.h", "machine.cpp", "print.h", "print.cpp", "hash.h", "hash.cpp", "snapshot.h", "snapshot.cpp", "mapfile.h", "mapfile.cpp" }
+		buildoptions { "-std=c++11" }
+		links { "z", "pthread" }
+
+		configuration "Debug"
+			defines { "DEBUG" }
+			flags { "Symbols" }
+			targetdir "debug/"
+
+		configuration "Release"
+			defines {}
+			flags { "Symbols", "Optimize" }
+			targetdir "release/"
+
+
+	project "CalcTest"
+		kind "ConsoleApp"
+		language "C++"
+		files { z80_files, "calctest.cpp", "speccy.h", "machine.h", "machine.cpp", "calc.h", "calc.cpp", "boot.h", "boot.cpp", "hash.h", "hash.cpp", "snapshot.h", "snapshot.cpp", "mapfile.h", "mapfile.cpp" }
+		buildoptions { "-std=c++11" }
+		links { "z", "pthread" }
+
+		configuration "Debug"
+			defines { "DEBUG" }
+			flags { "Symbols" }
+			targetdir "debug/"
+
+		configuration "Release"
+			defines {}
+			flags { "Symbols", "Optimize" }
+			targetdir "release/"
+
 
+	project "ContendBench"
+		kind "ConsoleApp"
+		language "C++"
+		files { z80_files, "contendbench.cpp", "speccy.h", "machine.h", "machine.cpp", "snapshot.h", "snapshot.cpp", "mapfile.h", "mapfile.cpp" }
+		buildoptions { "-std=c++11" }
+		links { "z", "pthread" }
+
+		configuration "Debug"
+			defines { "DEBUG" }
+			flags { "Symbols" }
+			targetdir "debug/"
+
+		configuration "Release"
+			defines {}
+			flags { "Symbols", "Optimize" }
+			targetdir "release/"
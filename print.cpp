@@ -0,0 +1,721 @@
+#include <string.h>
+
+#include "print.h"
+#include "machine.h"
+#include "hash.h"
+
+// Hash of the 48K ROM the routines below are transcribed from
+#define PRINT_ROM_HASH 0xacd853ea10ff3d49ull
+
+#define PRINT_OUT 0x09f4
+#define PRINT_CL_SCROLL 0x0e00
+#define PRINT_CL_LINE 0x0e44
+
+#define PRINT_CHARS 0x5c36
+#define PRINT_FLAGS 0x5c3b
+#define PRINT_BORDCR 0x5c48
+#define PRINT_UDG 0x5c7b
+#define PRINT_ECHO_E 0x5c82
+#define PRINT_DF_CC 0x5c84
+#define PRINT_DF_CCL 0x5c86
+#define PRINT_S_POSN 0x5c88
+#define PRINT_S_POSNL 0x5c8a
+#define PRINT_ATTR_P 0x5c8d
+#define PRINT_ATTR_T 0x5c8f
+#define PRINT_P_FLAG 0x5c91
+
+// IY offsets the ROM reads FLAGS, TV_FLAG and P_FLAG through
+#define IY_FLAGS 0x01
+#define IY_TV_FLAG 0x02
+#define IY_P_FLAG 0x57
+
+// The Z80 state a routine works on. F is kept exactly, following the
+// interpreter, as callers of the routines are free to look at it.
+struct Print
+{
+	ZState *Z;
+	RegisterSet *r;
+};
+
+static const uint8_t *s_rom;
+
+static uint8_t Peek( Print *p, uint16_t address )
+{
+	return Z80_ReadMemory( p->Z, address );
+}
+
+static void Poke( Print *p, uint16_t address, uint8_t value )
+{
+	Z80_WriteMemory( p->Z, address, value );
+}
+
+static uint16_t Peek16( Print *p, uint16_t address )
+{
+	return Peek( p, address ) | ( Peek( p, address + 1 ) << 8 );
+}
+
+static void Poke16( Print *p, uint16_t address, uint16_t value )
+{
+	Poke( p, address, value & 0xff );
+	Poke( p, address + 1, value >> 8 );
+}
+
+static uint8_t PeekIY( Print *p, uint8_t offset )
+{
+	return Peek( p, p->r->IY + offset );
+}
+
+static void Push( Print *p, uint16_t value )
+{
+	p->r->SP -= 2;
+	Poke16( p, p->r->SP, value );
+}
+
+static uint16_t Pop( Print *p )
+{
+	uint16_t value = Peek16( p, p->r->SP );
+	p->r->SP += 2;
+	return value;
+}
+
+// Return addresses are written as the ROM's calls write them, and every routine
+// ends with Ret, the last one leaving PC where the ROM would
+static void Call( Print *p, uint16_t returnAddress )
+{
+	Push( p, returnAddress );
+}
+
+static void Ret( Print *p )
+{
+	p->r->PC = Pop( p );
+}
+
+static void ExDeHl( Print *p )
+{
+	uint16_t t = p->r->DE;
+	p->r->DE = p->r->HL;
+	p->r->HL = t;
+}
+
+static void ExAf( Print *p )
+{
+	uint16_t t = p->r->AF;
+	p->r->AF = p->Z->sreg.AF;
+	p->Z->sreg.AF = t;
+}
+
+// Where writes to address go, NULL if they are discarded
+static uint8_t *WritePointer( Print *p, uint16_t address )
+{
+	uint8_t *page = p->Z->page[address >> Z_PAGE_SHIFT].write;
+	if( page == NULL && p->Z->WriteFault != NULL )
+		page = p->Z->WriteFault( p->Z, address );
+
+	return page ? page + ( address & Z_PAGE_MASK ) : NULL;
+}
+
+// LDIR a page at a time. A destination one past the source is the ROM's fill, any
+// other destination inside the source or a block that wraps round memory is done
+// a byte at a time.
+static void Ldir( Print *p )
+{
+	RegisterSet *r = p->r;
+	uint32_t count = r->BC ? r->BC : 0x10000;
+	const uint16_t gap = r->DE - r->HL;
+	const bool wraps = r->HL + count > 0x10000 || r->DE + count > 0x10000;
+
+	if( !wraps && ( gap >= count || gap == 1 ) )
+	{
+		const uint8_t fill = Peek( p, r->HL );
+		while( count > 0 )
+		{
+			uint32_t length = Z_PAGE_SIZE - ( r->DE & Z_PAGE_MASK );
+			if( gap != 1 && (uint32_t)( Z_PAGE_SIZE - ( r->HL & Z_PAGE_MASK ) ) < length )
+				length = Z_PAGE_SIZE - ( r->HL & Z_PAGE_MASK );
+			if( count < length )
+				length = count;
+
+			uint8_t *dest = WritePointer( p, r->DE );
+			if( dest != NULL && gap == 1 )
+				memset( dest, fill, length );
+			else if( dest != NULL )
+				memmove( dest, p->Z->page[r->HL >> Z_PAGE_SHIFT].read + ( r->HL & Z_PAGE_MASK ), length );
+
+			r->HL += length;
+			r->DE += length;
+			count -= length;
+		}
+	}
+
+	for( ; count > 0; count-- )
+	{
+		Poke( p, r->DE, Peek( p, r->HL ) );
+		r->HL++;
+		r->DE++;
+	}
+
+	uint8_t v = Peek( p, r->HL - 1 ) + r->A;
+	r->BC = 0;
+	r->F &= ~( M_N | M_P | M_H | M_3 | M_5 );
+	r->F |= v & M_3;
+	r->F |= ( v << 4 ) & M_5;
+}
+
+// Flags as the interpreter sets them
+
+static uint8_t AddWithCarry8( uint8_t a, uint8_t b, uint8_t *flags )
+{
+	uint8_t result;
+	uint8_t cOut;
+
+	if( *flags & M_C )
+	{
+		cOut = ( a >= ( 0xff - b ) );
+		result = a + b + 1;
+	}
+	else
+	{
+		cOut = ( a > ( 0xff - b ) );
+		result = a + b;
+	}
+
+	uint8_t cIns = a ^ result ^ b;
+	uint8_t overflow = ( cIns >> 7 ) ^ cOut;
+
+	*flags = ( result & ( M_S | M_3 | M_5 ) ) | ( cOut << F_C ) | ( overflow << F_V );
+	if( result == 0 )
+		*flags |= M_Z;
+	if( ( cIns >> 4 ) & 1 )
+		*flags |= M_H;
+
+	return result;
+}
+
+static void SetLogic( Print *p, uint8_t flags )
+{
+	RegisterSet *r = p->r;
+	uint8_t v = r->A ^ ( r->A >> 4 );
+	r->F = flags | ( r->A & ( M_S | M_3 | M_5 ) ) | ( ( ( ~0x6996 >> ( v & 0xf ) ) << F_P ) & M_P );
+	if( r->A == 0 )
+		r->F |= M_Z;
+}
+
+static void And( Print *p, uint8_t v ) { p->r->A &= v; SetLogic( p, M_H ); }
+static void Or( Print *p, uint8_t v ) { p->r->A |= v; SetLogic( p, 0 ); }
+static void Xor( Print *p, uint8_t v ) { p->r->A ^= v; SetLogic( p, 0 ); }
+
+static void Sub( Print *p, uint8_t v )
+{
+	RegisterSet *r = p->r;
+	r->F |= M_C;
+	r->A = AddWithCarry8( r->A, ~v, &r->F );
+	r->F ^= M_C | M_H;
+	r->F |= M_N;
+}
+
+static void SbcA( Print *p, uint8_t v )
+{
+	RegisterSet *r = p->r;
+	r->F ^= M_C;
+	r->A = AddWithCarry8( r->A, ~v, &r->F );
+	r->F ^= M_C | M_H;
+	r->F |= M_N;
+}
+
+static void Cp( Print *p, uint8_t v )
+{
+	RegisterSet *r = p->r;
+	uint8_t flags = M_C;
+	AddWithCarry8( r->A, ~v, &flags );
+	flags ^= M_C | M_H;
+	r->F = ( flags & ~( M_3 | M_5 ) ) | ( v & ( M_3 | M_5 ) ) | M_N;
+}
+
+static uint8_t Inc8( Print *p, uint8_t v )
+{
+	RegisterSet *r = p->r;
+	uint8_t flags = r->F & ~M_C;
+	v = AddWithCarry8( v, 1, &flags );
+	r->F = ( ( r->F & M_C ) | ( flags & ~M_C ) ) & ~M_N;
+	return v;
+}
+
+static uint8_t Dec8( Print *p, uint8_t v )
+{
+	RegisterSet *r = p->r;
+	uint8_t flags = r->F | M_C;
+	v = AddWithCarry8( v, ~1, &flags );
+	r->F = ( ( r->F & M_C ) | ( flags & ~M_C ) | M_N ) ^ M_H;
+	return v;
+}
+
+static void Rrca( Print *p )
+{
+	RegisterSet *r = p->r;
+	uint8_t bit = r->A & 1;
+	r->A = ( r->A >> 1 ) | ( bit << 7 );
+	r->F = ( r->F & ~( M_N | M_H | M_C | M_3 | M_5 ) ) | ( bit << F_C ) | ( r->A & ( M_3 | M_5 ) );
+}
+
+static void Rra( Print *p )
+{
+	RegisterSet *r = p->r;
+	uint8_t carry = ( r->F >> F_C ) & 1;
+	r->F = ( r->F & ~( M_N | M_H | M_C ) ) | ( ( r->A & 1 ) << F_C );
+	r->A = ( r->A >> 1 ) | ( carry << 7 );
+	r->F = ( r->F & ~( M_3 | M_5 ) ) | ( r->A & ( M_3 | M_5 ) );
+}
+
+static void AddHL( Print *p, uint16_t v )
+{
+	RegisterSet *r = p->r;
+	uint8_t flags = 0;
+	r->L = AddWithCarry8( r->L, v & 0xff, &flags );
+	r->H = AddWithCarry8( r->H, v >> 8, &flags );
+	r->F = ( r->F & ~( M_C | M_H | M_3 | M_5 | M_N ) ) | ( flags & ( M_C | M_H | M_3 | M_5 ) );
+}
+
+// BIT n,r, memory operands only pass S through
+static void Bit( Print *p, int bit, uint8_t v, uint8_t flagMask )
+{
+	RegisterSet *r = p->r;
+	r->F |= M_H;
+	r->F &= ~( M_N | M_Z | M_P | flagMask );
+	r->F |= flagMask & ( 1 << bit ) & v;
+	if( ( v & ( 1 << bit ) ) == 0 )
+		r->F |= M_Z | M_P;
+}
+
+static void BitIY( Print *p, int bit, uint8_t offset ) { Bit( p, bit, PeekIY( p, offset ), M_S ); }
+static void BitA( Print *p, int bit ) { Bit( p, bit, p->r->A, M_S | M_3 | M_5 ); }
+
+static bool Zero( Print *p ) { return ( p->r->F & M_Z ) != 0; }
+static bool Carry( Print *p ) { return ( p->r->F & M_C ) != 0; }
+
+// CL-ADDR 0E9B, HL to the display file at the top of line 24 - B
+static void ClearAddress( Print *p )
+{
+	RegisterSet *r = p->r;
+	r->A = 0x18;
+	Sub( p, r->B );
+	r->D = r->A;
+	Rrca( p );
+	Rrca( p );
+	Rrca( p );
+	And( p, 0xe0 );
+	r->L = r->A;
+	r->A = r->D;
+	And( p, 0x18 );
+	Or( p, 0x40 );
+	r->H = r->A;
+	Ret( p );
+}
+
+// CL-ATTR 0E88, DE to the attribute for display address HL and BC to B lines of attributes
+static void ClearAttributes( Print *p )
+{
+	RegisterSet *r = p->r;
+	r->A = r->H;
+	Rrca( p );
+	Rrca( p );
+	Rrca( p );
+	r->A = Dec8( p, r->A );
+	Or( p, 0x50 );
+	r->H = r->A;
+	ExDeHl( p );
+	r->H = r->C;
+	r->L = r->B;
+	for( int i = 0; i < 5; i++ )
+		AddHL( p, r->HL );
+	r->B = r->H;
+	r->C = r->L;
+	Ret( p );
+}
+
+// CL-LINE 0E44, clears the bottom B lines
+static void ClearLines( Print *p )
+{
+	RegisterSet *r = p->r;
+	Push( p, r->BC );
+	Call( p, 0x0e48 );
+	ClearAddress( p );
+	r->C = 8;
+
+	do
+	{
+		// CL-LINE-1, each pixel row
+		Push( p, r->BC );
+		Push( p, r->HL );
+		r->A = r->B;
+
+		do
+		{
+			// CL-LINE-2, each third
+			And( p, 0x07 );
+			Rrca( p );
+			Rrca( p );
+			Rrca( p );
+			r->C = r->A;
+			r->A = r->B;
+			r->B = 0;
+			r->C = Dec8( p, r->C );
+			r->DE = r->HL;
+			Poke( p, r->HL, 0 );
+			r->DE++;
+			Ldir( p );
+			r->DE = 0x0701;
+			AddHL( p, r->DE );
+			r->A = Dec8( p, r->A );
+			And( p, 0xf8 );
+			r->B = r->A;
+		}
+		while( !Zero( p ) );
+
+		r->HL = Pop( p );
+		r->H = Inc8( p, r->H );
+		r->BC = Pop( p );
+		r->C = Dec8( p, r->C );
+	}
+	while( !Zero( p ) );
+
+	Call( p, 0x0e71 );
+	ClearAttributes( p );
+	r->HL = r->DE;
+	r->DE++;
+	r->A = Peek( p, PRINT_ATTR_P );
+	BitIY( p, 0, IY_TV_FLAG );
+	if( !Zero( p ) )
+		r->A = Peek( p, PRINT_BORDCR );
+	Poke( p, r->HL, r->A );
+	r->BC--;
+	Ldir( p );
+	r->BC = Pop( p );
+	r->C = 0x21;
+	Ret( p );
+}
+
+// CL-SCROLL 0E00, scrolls the bottom B lines up one and clears the last
+static void ClearScroll( Print *p )
+{
+	RegisterSet *r = p->r;
+	Call( p, 0x0e03 );
+	ClearAddress( p );
+	r->C = 8;
+
+	do
+	{
+		// CL-SCR-1, each pixel row
+		Push( p, r->BC );
+		Push( p, r->HL );
+		r->A = r->B;
+		And( p, 0x07 );
+		r->A = r->B;
+		bool thirdStart = Zero( p );
+
+		do
+		{
+			if( thirdStart )
+			{
+				// CL-SCR-2, the row from the top of the next third
+				ExDeHl( p );
+				r->HL = 0xf8e0;
+				AddHL( p, r->DE );
+				ExDeHl( p );
+				r->BC = 0x0020;
+				r->A = Dec8( p, r->A );
+				Ldir( p );
+			}
+
+			// CL-SCR-3, the rest of the third
+			ExDeHl( p );
+			r->HL = 0xffe0;
+			AddHL( p, r->DE );
+			ExDeHl( p );
+			r->B = r->A;
+			And( p, 0x07 );
+			Rrca( p );
+			Rrca( p );
+			Rrca( p );
+			r->C = r->A;
+			r->A = r->B;
+			r->B = 0;
+			Ldir( p );
+			r->B = 0x07;
+			AddHL( p, r->BC );
+			And( p, 0xf8 );
+			thirdStart = true;
+		}
+		while( !Zero( p ) );
+
+		r->HL = Pop( p );
+		r->H = Inc8( p, r->H );
+		r->BC = Pop( p );
+		r->C = Dec8( p, r->C );
+	}
+	while( !Zero( p ) );
+
+	Call( p, 0x0e3b );
+	ClearAttributes( p );
+	r->HL = 0xffe0;
+	AddHL( p, r->DE );
+	ExDeHl( p );
+	Ldir( p );
+	r->B = 0x01;
+	ClearLines( p );
+}
+
+// PO-FETCH 0B03, the print position of the screen in use
+static void PrintFetch( Print *p )
+{
+	RegisterSet *r = p->r;
+	BitIY( p, 1, IY_FLAGS );
+	r->BC = Peek16( p, PRINT_S_POSN );
+	r->HL = Peek16( p, PRINT_DF_CC );
+	BitIY( p, 0, IY_TV_FLAG );
+	if( !Zero( p ) )
+	{
+		r->BC = Peek16( p, PRINT_S_POSNL );
+		r->HL = Peek16( p, PRINT_DF_CCL );
+	}
+	Ret( p );
+}
+
+// PO-STORE 0ADC
+static void PrintStore( Print *p )
+{
+	RegisterSet *r = p->r;
+	BitIY( p, 1, IY_FLAGS );
+	BitIY( p, 0, IY_TV_FLAG );
+	if( !Zero( p ) )
+	{
+		Poke16( p, PRINT_S_POSNL, r->BC );
+		Poke16( p, PRINT_ECHO_E, r->BC );
+		Poke16( p, PRINT_DF_CCL, r->HL );
+	}
+	else
+	{
+		Poke16( p, PRINT_S_POSN, r->BC );
+		Poke16( p, PRINT_DF_CC, r->HL );
+	}
+	Ret( p );
+}
+
+// PO-ATTR 0BDB, sets the attribute for display address HL from ATTR-T, MASK-T and P-FLAG
+static void PrintAttribute( Print *p )
+{
+	RegisterSet *r = p->r;
+	r->A = r->H;
+	Rrca( p );
+	Rrca( p );
+	Rrca( p );
+	And( p, 0x03 );
+	Or( p, 0x58 );
+	r->H = r->A;
+	r->DE = Peek16( p, PRINT_ATTR_T );
+	r->A = Peek( p, r->HL );
+	Xor( p, r->E );
+	And( p, r->D );
+	Xor( p, r->E );
+
+	// PAPER 9 and INK 9
+	BitIY( p, 6, IY_P_FLAG );
+	if( !Zero( p ) )
+	{
+		And( p, 0xc7 );
+		BitA( p, 2 );
+		if( Zero( p ) )
+			Xor( p, 0x38 );
+	}
+	BitIY( p, 4, IY_P_FLAG );
+	if( !Zero( p ) )
+	{
+		And( p, 0xf8 );
+		BitA( p, 5 );
+		if( Zero( p ) )
+			Xor( p, 0x07 );
+	}
+	Poke( p, r->HL, r->A );
+	Ret( p );
+}
+
+// PR-ALL 0B7F, the character at DE to display address HL, only in the middle of a
+// line as PO-SCR isn't handled
+static void PrintAll( Print *p )
+{
+	RegisterSet *r = p->r;
+	r->A = r->C;
+	r->A = Dec8( p, r->A );
+	r->A = 0x21;
+
+	// PR-ALL-1
+	Cp( p, r->C );
+	Push( p, r->DE );
+	r->DE = Pop( p );
+
+	Push( p, r->BC );
+	Push( p, r->HL );
+	r->A = Peek( p, PRINT_P_FLAG );
+	r->B = 0xff;
+	Rra( p );
+	if( !Carry( p ) )
+		r->B = Inc8( p, r->B );
+	Rra( p );
+	Rra( p );
+	SbcA( p, r->A );
+	r->C = r->A;
+	r->A = 0x08;
+	And( p, r->A );
+	BitIY( p, 1, IY_FLAGS );
+	ExDeHl( p );
+
+	do
+	{
+		// PR-ALL-2, OVER in B and INVERSE in C
+		ExAf( p );
+		r->A = Peek( p, r->DE );
+		And( p, r->B );
+		Xor( p, Peek( p, r->HL ) );
+		Xor( p, r->C );
+		Poke( p, r->DE, r->A );
+		ExAf( p );
+		r->D = Inc8( p, r->D );
+		r->HL++;
+		r->A = Dec8( p, r->A );
+	}
+	while( !Zero( p ) );
+
+	ExDeHl( p );
+	r->H = Dec8( p, r->H );
+	BitIY( p, 1, IY_FLAGS );
+	Call( p, 0x0bce );
+	PrintAttribute( p );
+	r->HL = Pop( p );
+	r->BC = Pop( p );
+	r->C = Dec8( p, r->C );
+	r->HL++;
+	Ret( p );
+}
+
+// PO-CHAR 0B65 from 0B6A, the pattern for character A from the font at BC. Expects
+// the caller's BC on the stack.
+static void PrintChar( Print *p )
+{
+	RegisterSet *r = p->r;
+	ExDeHl( p );
+	r->HL = PRINT_FLAGS;
+	Poke( p, r->HL, Peek( p, r->HL ) & ~0x01 );
+	Cp( p, ' ' );
+	if( Zero( p ) )
+		Poke( p, r->HL, Peek( p, r->HL ) | 0x01 );
+	r->H = 0;
+	r->L = r->A;
+	AddHL( p, r->HL );
+	AddHL( p, r->HL );
+	AddHL( p, r->HL );
+	AddHL( p, r->BC );
+	r->BC = Pop( p );
+	ExDeHl( p );
+	PrintAll( p );
+}
+
+// PO-ANY 0B24, characters and UDGs
+static void PrintAny( Print *p )
+{
+	RegisterSet *r = p->r;
+	Cp( p, 0x80 );
+	if( !Carry( p ) )
+	{
+		// PO-T-UDG 0B52
+		Cp( p, 0x90 );
+		Sub( p, 0xa5 );
+		r->F &= ~M_C;
+		r->A = AddWithCarry8( r->A, 0x15, &r->F );
+		Push( p, r->BC );
+		r->BC = Peek16( p, PRINT_UDG );
+	}
+	else
+	{
+		Push( p, r->BC );
+		r->BC = Peek16( p, PRINT_CHARS );
+	}
+	PrintChar( p );
+}
+
+// PRINT-OUT 09F4 for a character on the screen that doesn't start a line
+static bool PrintOut( Print *p )
+{
+	RegisterSet *r = p->r;
+	const uint8_t c = r->A;
+	if( c < 0x20 || ( c >= 0x80 && c < 0x90 ) || c >= 0xa5 )
+		return false;
+
+	if( PeekIY( p, IY_FLAGS ) & 0x02 )
+		return false;
+
+	const uint8_t column = Peek( p, ( PeekIY( p, IY_TV_FLAG ) & 0x01 ) ? PRINT_S_POSNL : PRINT_S_POSN );
+	if( column == 0x01 || column == 0x21 )
+		return false;
+
+	Call( p, 0x09f7 );
+	PrintFetch( p );
+	Cp( p, 0x20 );
+
+	// PO-ABLE 0AD9
+	Call( p, 0x0adc );
+	PrintAny( p );
+	PrintStore( p );
+	return true;
+}
+
+// The traps are shared by every machine, only run them over the ROM that was checked
+static bool RomPaged( ZState *Z, uint16_t address )
+{
+	return Z->page[address >> Z_PAGE_SHIFT].read == s_rom + ( address & ~Z_PAGE_MASK );
+}
+
+static bool PrintOutTrap( Machine *M )
+{
+	if( !RomPaged( &M->Z, PRINT_OUT ) )
+		return false;
+
+	Print p = { &M->Z, &M->Z.reg };
+	return PrintOut( &p );
+}
+
+static bool ScrollTrap( Machine *M )
+{
+	if( !RomPaged( &M->Z, PRINT_CL_SCROLL ) || M->Z.reg.B == 0 || M->Z.reg.B > 0x18 )
+		return false;
+
+	Print p = { &M->Z, &M->Z.reg };
+	ClearScroll( &p );
+	return true;
+}
+
+static bool ClearTrap( Machine *M )
+{
+	if( !RomPaged( &M->Z, PRINT_CL_LINE ) || M->Z.reg.B == 0 || M->Z.reg.B > 0x18 )
+		return false;
+
+	Print p = { &M->Z, &M->Z.reg };
+	ClearLines( &p );
+	return true;
+}
+
+bool Print_Enable( const uint8_t *rom )
+{
+	if( Hash_Bytes( rom, MACHINE_ROM_SIZE, HASH_SEED ) != PRINT_ROM_HASH )
+		return false;
+
+	s_rom = rom;
+	return Machine_SetTrap( PRINT_OUT, PrintOutTrap ) && Machine_SetTrap( PRINT_CL_SCROLL, ScrollTrap ) &&
+		Machine_SetTrap( PRINT_CL_LINE, ClearTrap );
+}
+
+void Print_Disable()
+{
+	Machine_SetTrap( PRINT_OUT, NULL );
+	Machine_SetTrap( PRINT_CL_SCROLL, NULL );
+	Machine_SetTrap( PRINT_CL_LINE, NULL );
+	s_rom = NULL;
+}
@@ -0,0 +1,15 @@
+#if !defined( PRINT_H )
+#define PRINT_H 1
+
+#include <stdint.h>
+
+// Runs the 48K ROM's screen output natively. PRINT-OUT is trapped for ordinary
+// characters and UDGs going to the screen, CL-SCROLL and CL-LINE for scrolling and
+// clearing, and each leaves memory ( the stack below SP included ) and registers as
+// the ROM's own code would, apart from R and the time taken. Anything else, such as
+// control codes, tokens, the printer or a character that may need a scroll, is left
+// to the ROM. Only the standard 48K ROM image is accepted.
+bool Print_Enable( const uint8_t *rom );
+void Print_Disable();
+
+#endif // PRINT_H
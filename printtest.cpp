@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "machine.h"
+#include "print.h"
+
+// Frames for the ROM to reach the copyright message
+#define BOOT_FRAMES 150
+
+// Frames a run is given to reach its HALT
+#define RUN_FRAMES 500
+
+#define PROGRAM 0x8000
+
+// Random screen output through RST 10h, CL-SCROLL and CL-LINE, run once by the ROM
+// and once with the native routines, and compared. Interrupts are off so both runs
+// see the same machine whatever the time taken.
+
+static std::mt19937 s_random;
+
+static int Random( int n )
+{
+	return s_random() % n;
+}
+
+static void Emit( std::vector<uint8_t> &code, std::initializer_list<uint8_t> bytes )
+{
+	code.insert( code.end(), bytes );
+}
+
+// RST 10h with A, SCR-CT kept high so there's never a scroll? prompt
+static void EmitPrint( std::vector<uint8_t> &code, uint8_t c )
+{
+	Emit( code, { 0x3e, 0xff, 0x32, 0x8c, 0x5c, 0x3e, c, 0xd7 } );
+}
+
+static void EmitProgram( std::vector<uint8_t> &code, int ops )
+{
+	// DI, then CHAN-OPEN stream 2 for the upper screen
+	Emit( code, { 0xf3, 0x3e, 0x02, 0xcd, 0x01, 0x16 } );
+
+	for( int i = 0; i < ops; i++ )
+	{
+		int kind = Random( 100 );
+		if( kind < 60 )
+		{
+			EmitPrint( code, 0x20 + Random( 0x60 ) );
+		}
+		else if( kind < 66 )
+		{
+			// UDGs and block graphics
+			EmitPrint( code, 0x80 + Random( 0x25 ) );
+		}
+		else if( kind < 69 )
+		{
+			// Keywords, printed a character at a time
+			EmitPrint( code, 0xa5 + Random( 0x5b ) );
+		}
+		else if( kind < 74 )
+		{
+			EmitPrint( code, 0x0d );
+		}
+		else if( kind < 80 )
+		{
+			EmitPrint( code, 0x16 );
+			EmitPrint( code, Random( 22 ) );
+			EmitPrint( code, Random( 32 ) );
+		}
+		else if( kind < 90 )
+		{
+			// INK, PAPER, FLASH, BRIGHT, INVERSE and OVER
+			int control = 0x10 + Random( 6 );
+			EmitPrint( code, control );
+			EmitPrint( code, control < 0x12 ? Random( 10 ) : Random( 2 ) );
+		}
+		else if( kind < 94 )
+		{
+			// LD B,n : CALL CL-SCROLL
+			Emit( code, { 0x06, (uint8_t)( 1 + Random( 0x18 ) ), 0xcd, 0x00, 0x0e } );
+		}
+		else if( kind < 98 )
+		{
+			// LD B,n : CALL CL-LINE
+			Emit( code, { 0x06, (uint8_t)( 1 + Random( 0x18 ) ), 0xcd, 0x44, 0x0e } );
+		}
+		else
+		{
+			// CALL CL-SC-ALL
+			Emit( code, { 0xcd, 0xfe, 0x0d } );
+		}
+	}
+
+	Emit( code, { 0x76 } );
+}
+
+static double Run( Machine *M, MachineState *result )
+{
+	auto start = std::chrono::steady_clock::now();
+	for( int i = 0; i < RUN_FRAMES && !M->Z.halted; i++ )
+		Machine_RunFrame( M, NULL, NULL );
+	double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+
+	Machine_SaveState( M, result );
+	return seconds;
+}
+
+// Everything but R and the time taken
+static bool Compare( int run, const MachineState *rom, const MachineState *native )
+{
+	RegisterSet a = rom->reg, b = native->reg;
+	a.R = b.R = 0;
+
+	bool same = memcmp( &a, &b, sizeof( a ) ) == 0 && memcmp( &rom->sreg, &native->sreg, sizeof( rom->sreg ) ) == 0;
+	if( !same )
+		printf( "Run %d: registers differ, PC %04x/%04x AF %04x/%04x\n", run, a.PC, b.PC, a.AF, b.AF );
+
+	for( int i = 0; i < MACHINE_RAM_SIZE; i++ )
+	{
+		if( rom->ram[i] != native->ram[i] )
+		{
+			printf( "Run %d: RAM differs at %04x, %02x/%02x\n", run, MACHINE_ROM_SIZE + i, rom->ram[i], native->ram[i] );
+			return false;
+		}
+	}
+
+	return same;
+}
+
+int main( int argc, char *argv[] )
+{
+	int runs = argc > 1 ? atoi( argv[1] ) : 200;
+	s_random.seed( argc > 2 ? atoi( argv[2] ) : 1 );
+
+	static uint8_t rom[MACHINE_ROM_SIZE];
+	static uint8_t ram[MACHINE_RAM_SIZE];
+	static Machine M;
+	static MachineState booted, start, interpreted, native;
+
+	if( !Machine_LoadROM( rom, "roms/48.rom" ) )
+	{
+		printf( "Could not read rom file\n" );
+		return 1;
+	}
+
+	Machine_Init( &M, rom, ram );
+	Machine_Reset( &M );
+	for( int i = 0; i < BOOT_FRAMES; i++ )
+		Machine_RunFrame( &M, NULL, NULL );
+	Machine_SaveState( &M, &booted );
+
+	int failed = 0;
+	double romTime = 0, nativeTime = 0;
+	for( int run = 0; run < runs; run++ )
+	{
+		Machine_RestoreState( &M, &booted );
+
+		// Something on the screen to scroll and print OVER
+		for( int i = 0; i < 0x1b00; i++ )
+			Z80_WriteMemory( &M.Z, 0x4000 + i, Random( 256 ) );
+
+		std::vector<uint8_t> code;
+		EmitProgram( code, 1 + Random( 200 ) );
+		for( size_t i = 0; i < code.size(); i++ )
+			Z80_WriteMemory( &M.Z, PROGRAM + i, code[i] );
+		M.Z.reg.PC = PROGRAM;
+		Machine_SaveState( &M, &start );
+
+		Print_Disable();
+		romTime += Run( &M, &interpreted );
+
+		Machine_RestoreState( &M, &start );
+		if( !Print_Enable( rom ) )
+		{
+			printf( "Rom not recognised\n" );
+			return 1;
+		}
+		nativeTime += Run( &M, &native );
+
+		if( !interpreted.halted || !Compare( run, &interpreted, &native ) )
+			failed++;
+	}
+
+	printf( "PrintTest: %d runs, %d failed. ROM %.3fs, native %.3fs\n", runs, failed, romTime, nativeTime );
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,375 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include "rewind.h"
+#include "machine.h"
+
+#define REWIND_MAX_ENTRIES 8192
+#define REWIND_QUEUE_SIZE 4
+#define REWIND_INPUT_FRAMES 65536
+#define REWIND_INPUT_MASK ( REWIND_INPUT_FRAMES - 1 )
+
+// Everything in a MachineState up to the RAM is stored uncompressed
+#define STATE_HEADER_SIZE offsetof( MachineState, ram )
+
+// Repeats shorter than this are cheaper left in with the literals
+#define MIN_RUN 4
+
+struct RewindEntry
+{
+	uint32_t frameCount;
+	bool keyframe;
+	uint32_t size;
+	uint8_t *data;
+	uint8_t header[STATE_HEADER_SIZE];
+};
+
+static int s_interval;
+static int s_keyframeInterval;
+static size_t s_budget;
+
+// Captures, oldest first
+static RewindEntry s_entries[REWIND_MAX_ENTRIES];
+static int s_first;
+static int s_count;
+static int s_keyframes;
+static size_t s_bytes;
+static std::atomic<int> s_dropped( 0 );
+
+// Worker side view of the newest keyframe
+static uint8_t s_keyRam[MACHINE_RAM_SIZE];
+static bool s_keyValid;
+static int s_sinceKey;
+
+static uint8_t s_scratch[MACHINE_RAM_SIZE];
+static uint8_t s_packBuffer[MACHINE_RAM_SIZE * 2];
+static MachineState s_restore;
+
+// Raw states waiting for the worker, written by the emulation thread
+static MachineState s_queue[REWIND_QUEUE_SIZE];
+static std::atomic<uint32_t> s_queueHead( 0 );
+static std::atomic<uint32_t> s_queueTail( 0 );
+
+static SpeccyKeyState s_input[REWIND_INPUT_FRAMES];
+
+static std::thread s_thread;
+static std::mutex s_mutex;
+static std::condition_variable s_wake;
+static std::condition_variable s_idle;
+static bool s_quit;
+
+static uint8_t *PutVarint( uint8_t *p, uint32_t v )
+{
+	while( v >= 0x80 )
+	{
+		*p++ = (uint8_t)( v | 0x80 );
+		v >>= 7;
+	}
+	*p++ = (uint8_t)v;
+	return p;
+}
+
+static const uint8_t *GetVarint( const uint8_t *p, uint32_t *v )
+{
+	uint32_t value = 0;
+	int shift = 0;
+	while( *p & 0x80 )
+	{
+		value |= ( *p++ & 0x7f ) << shift;
+		shift += 7;
+	}
+	*v = value | ( *p++ << shift );
+	return p;
+}
+
+// Stream of [literal count][literals][run length][run byte], XOR deltas are
+// mostly long runs of zero
+static uint32_t Pack( const uint8_t *src, uint32_t size, uint8_t *dest )
+{
+	uint8_t *out = dest;
+	uint32_t i = 0;
+
+	while( i < size )
+	{
+		const uint32_t literalStart = i;
+		uint32_t run = 0;
+
+		while( i < size )
+		{
+			uint32_t j = i + 1;
+			while( j < size && src[j] == src[i] )
+				j++;
+
+			if( j - i >= MIN_RUN )
+			{
+				run = j - i;
+				break;
+			}
+			i = j;
+		}
+
+		out = PutVarint( out, i - literalStart );
+		memcpy( out, src + literalStart, i - literalStart );
+		out += i - literalStart;
+
+		out = PutVarint( out, run );
+		if( run > 0 )
+		{
+			*out++ = src[i];
+			i += run;
+		}
+	}
+
+	return (uint32_t)( out - dest );
+}
+
+static void Unpack( const uint8_t *src, uint8_t *dest, uint32_t size )
+{
+	uint8_t *out = dest;
+	uint8_t *end = dest + size;
+
+	while( out < end )
+	{
+		uint32_t count;
+		src = GetVarint( src, &count );
+		memcpy( out, src, count );
+		src += count;
+		out += count;
+
+		src = GetVarint( src, &count );
+		if( count > 0 )
+		{
+			memset( out, *src++, count );
+			out += count;
+		}
+	}
+}
+
+static void XorRam( uint8_t *dest, const uint8_t *a, const uint8_t *b )
+{
+	for( int i = 0; i < MACHINE_RAM_SIZE; i++ )
+	{
+		dest[i] = a[i] ^ b[i];
+	}
+}
+
+static RewindEntry *Entry( int i )
+{
+	return &s_entries[( s_first + i ) % REWIND_MAX_ENTRIES];
+}
+
+static void FreeEntry( RewindEntry *e )
+{
+	s_bytes -= e->size + sizeof( RewindEntry );
+	if( e->keyframe )
+		s_keyframes--;
+	free( e->data );
+	e->data = NULL;
+}
+
+// Deltas are useless without their keyframe so the oldest whole group goes
+static void EvictOldest()
+{
+	do
+	{
+		FreeEntry( Entry( 0 ) );
+		s_first = ( s_first + 1 ) % REWIND_MAX_ENTRIES;
+		s_count--;
+	} while( s_count > 0 && !Entry( 0 )->keyframe );
+
+	if( s_count == 0 )
+		s_keyValid = false;
+}
+
+static void CompressState( const MachineState *state )
+{
+	const bool keyframe = !s_keyValid || s_sinceKey >= s_keyframeInterval;
+	const uint8_t *ram = state->ram;
+
+	if( !keyframe )
+	{
+		XorRam( s_scratch, state->ram, s_keyRam );
+		ram = s_scratch;
+	}
+
+	RewindEntry entry;
+	entry.frameCount = state->frameCount;
+	entry.keyframe = keyframe;
+	entry.size = Pack( ram, MACHINE_RAM_SIZE, s_packBuffer );
+	entry.data = (uint8_t *)malloc( entry.size );
+	memcpy( entry.data, s_packBuffer, entry.size );
+	memcpy( entry.header, state, STATE_HEADER_SIZE );
+
+	std::lock_guard<std::mutex> lock( s_mutex );
+
+	if( keyframe )
+	{
+		memcpy( s_keyRam, state->ram, MACHINE_RAM_SIZE );
+		s_keyValid = true;
+		s_sinceKey = 0;
+		s_keyframes++;
+	}
+	s_sinceKey++;
+
+	if( s_count == REWIND_MAX_ENTRIES )
+	{
+		EvictOldest();
+		if( !keyframe && !s_keyValid )
+		{
+			free( entry.data );
+			return;
+		}
+	}
+
+	*Entry( s_count ) = entry;
+	s_count++;
+	s_bytes += entry.size + sizeof( RewindEntry );
+
+	while( s_bytes > s_budget && s_keyframes > 1 )
+		EvictOldest();
+}
+
+static void CompressThread()
+{
+	while( true )
+	{
+		{
+			std::unique_lock<std::mutex> lock( s_mutex );
+			s_wake.wait( lock, []{ return s_quit || s_queueTail != s_queueHead; } );
+			if( s_quit )
+				return;
+		}
+
+		CompressState( &s_queue[s_queueTail % REWIND_QUEUE_SIZE] );
+
+		std::lock_guard<std::mutex> lock( s_mutex );
+		s_queueTail++;
+		s_idle.notify_all();
+	}
+}
+
+void Rewind_Init( int interval, int keyframeInterval, size_t budgetBytes )
+{
+	s_interval = interval > 0 ? interval : 1;
+	s_keyframeInterval = keyframeInterval > 0 ? keyframeInterval : 1;
+	s_budget = budgetBytes;
+
+	s_first = 0;
+	s_count = 0;
+	s_keyframes = 0;
+	s_bytes = 0;
+	s_dropped = 0;
+	s_keyValid = false;
+	s_queueHead = 0;
+	s_queueTail = 0;
+	s_quit = false;
+
+	s_thread = std::thread( CompressThread );
+}
+
+void Rewind_Shutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock( s_mutex );
+		s_quit = true;
+		s_wake.notify_all();
+	}
+	s_thread.join();
+
+	while( s_count > 0 )
+		EvictOldest();
+}
+
+void Rewind_Capture( const Machine *M )
+{
+	s_input[( M->frameCount - 1 ) & REWIND_INPUT_MASK] = M->keyState;
+
+	if( M->frameCount % s_interval != 0 )
+		return;
+
+	// Never wait for the worker, drop the capture if it has fallen behind
+	const uint32_t head = s_queueHead;
+	if( head - s_queueTail >= REWIND_QUEUE_SIZE )
+	{
+		s_dropped++;
+		return;
+	}
+
+	Machine_SaveState( M, &s_queue[head % REWIND_QUEUE_SIZE] );
+
+	std::lock_guard<std::mutex> lock( s_mutex );
+	s_queueHead = head + 1;
+	s_wake.notify_one();
+}
+
+bool Rewind_Seek( Machine *M, uint32_t frameCount )
+{
+	{
+		std::unique_lock<std::mutex> lock( s_mutex );
+		s_idle.wait( lock, []{ return s_queueTail == s_queueHead; } );
+
+		int index = s_count - 1;
+		while( index >= 0 && Entry( index )->frameCount > frameCount )
+			index--;
+
+		if( index < 0 || frameCount - Entry( index )->frameCount >= REWIND_INPUT_FRAMES )
+			return false;
+
+		int key = index;
+		while( !Entry( key )->keyframe )
+			key--;
+
+		Unpack( Entry( key )->data, s_restore.ram, MACHINE_RAM_SIZE );
+
+		// Later captures are discarded, so this group becomes the one new deltas are made against
+		memcpy( s_keyRam, s_restore.ram, MACHINE_RAM_SIZE );
+		s_keyValid = true;
+		s_sinceKey = index - key + 1;
+
+		if( key != index )
+		{
+			Unpack( Entry( index )->data, s_scratch, MACHINE_RAM_SIZE );
+			XorRam( s_restore.ram, s_restore.ram, s_scratch );
+		}
+
+		memcpy( &s_restore, Entry( index )->header, STATE_HEADER_SIZE );
+
+		while( s_count > index + 1 )
+		{
+			FreeEntry( Entry( s_count - 1 ) );
+			s_count--;
+		}
+	}
+
+	if( !Machine_RestoreState( M, &s_restore ) )
+		return false;
+
+	while( M->frameCount < frameCount )
+	{
+		M->keyState = s_input[M->frameCount & REWIND_INPUT_MASK];
+		Machine_RunFrame( M, NULL, NULL );
+	}
+
+	return true;
+}
+
+uint32_t Rewind_OldestFrame()
+{
+	std::lock_guard<std::mutex> lock( s_mutex );
+	return s_count > 0 ? Entry( 0 )->frameCount : 0;
+}
+
+void Rewind_GetStats( RewindStats *stats )
+{
+	std::lock_guard<std::mutex> lock( s_mutex );
+	stats->entries = s_count;
+	stats->keyframes = s_keyframes;
+	stats->bytes = s_bytes;
+	stats->dropped = s_dropped;
+}
@@ -0,0 +1,35 @@
+#if !defined( REWIND_H )
+#define REWIND_H 1
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct Machine;
+
+// Captures the machine every interval frames, RAM is stored compressed, every
+// keyframeInterval'th capture in full and the rest as XOR deltas against it.
+// Compression runs on a background thread, oldest captures are dropped to stay
+// within budgetBytes.
+void Rewind_Init( int interval, int keyframeInterval, size_t budgetBytes );
+void Rewind_Shutdown();
+
+// Call after every frame, records the input for replay and queues a capture when due
+void Rewind_Capture( const Machine *M );
+
+// Restores the nearest capture at or before frameCount and replays recorded input up
+// to it. History after frameCount is discarded.
+bool Rewind_Seek( Machine *M, uint32_t frameCount );
+
+uint32_t Rewind_OldestFrame();
+
+struct RewindStats
+{
+	int entries;
+	int keyframes;
+	size_t bytes;
+	int dropped;
+};
+
+void Rewind_GetStats( RewindStats *stats );
+
+#endif // REWIND_H
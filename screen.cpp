@@ -3,35 +3,28 @@
 #include "screen.h"
 #include "z80.h"
 #include "speccy.h"
+#include "filter.h"
+#include "display.h"
+#include "hash.h"
+#include "image.h"
 
 static SDL_Window *s_window;
 static SDL_Surface *s_surface;
+static SDL_Surface *s_filterSurface;
 static bool s_quitRequested = false;
-static uint32_t s_frameStart = 0;
+static bool s_filtersEnabled = true;
+static bool s_rewindHeld = false;
+static bool s_tapePlayPressed = false;
+static bool s_tapeRewindPressed = false;
 
-const static SDL_Color s_colors[2][8] =
-{
-	{
-		{ 0x00, 0x00, 0x00 },
-		{ 0x00, 0x00, 0xcd },
-		{ 0xcd, 0x00, 0x00 },
-		{ 0xcd, 0x00, 0xcd },
-		{ 0x00, 0xcd, 0x00 },
-		{ 0x00, 0xcd, 0xcd },
-		{ 0xcd, 0xcd, 0x00 },
-		{ 0xcd, 0xcd, 0xcd },
-	},
-	{
-		{ 0x00, 0x00, 0x00 },
-		{ 0x00, 0x00, 0xff },
-		{ 0xff, 0x00, 0x00 },
-		{ 0xff, 0x00, 0xff },
-		{ 0x00, 0xff, 0x00 },
-		{ 0x00, 0xff, 0xff },
-		{ 0xff, 0xff, 0x00 },
-		{ 0xff, 0xff, 0xff },
-	},
-};
+// Frame hashes are accumulated line by line as the frame is rendered
+static uint64_t s_hashAccum = HASH_SEED;
+static uint64_t s_frameHash = 0;
+static uint64_t s_prevFrameHash = 0;
+static uint64_t s_presentedHash = 0;
+static bool s_forcePresent = true;
+
+static uint32_t s_palette[DISPLAY_PALETTE_SIZE];
 
 #define SCALE 2
 
@@ -45,13 +38,25 @@ bool Screen_Init()
 
 	s_window = SDL_CreateWindow( "Speccy", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, SCREEN_WIDTH * SCALE, SCREEN_HEIGHT * SCALE, SDL_WINDOW_SHOWN );
 	s_surface = SDL_CreateRGBSurface( 0, SCREEN_WIDTH, SCREEN_HEIGHT, 32, 0, 0, 0, 0 );
+	s_filterSurface = NULL;
 	s_quitRequested = false;
+	s_forcePresent = true;
+
+	for( int i = 0; i < DISPLAY_PALETTE_SIZE; i++ )
+	{
+		s_palette[i] = SDL_MapRGB( s_surface->format, g_displayColors[i][0], g_displayColors[i][1], g_displayColors[i][2] );
+	}
+
+	Filter_Init( s_surface->format->Rmask, s_surface->format->Gmask, s_surface->format->Bmask );
 
 	return true;
 }
 
 void Screen_Shutdown()
 {
+	Filter_Shutdown();
+	if( s_filterSurface )
+		SDL_FreeSurface( s_filterSurface );
 	SDL_FreeSurface( s_surface );
 	SDL_DestroyWindow( s_window );
 	SDL_Quit();
@@ -137,6 +142,25 @@ static void ProcessKey( int key, bool down, SpeccyKeyState *keyState )
 }
 
 
+bool Screen_RewindHeld()
+{
+	return s_rewindHeld;
+}
+
+bool Screen_TapePlayPressed()
+{
+	bool pressed = s_tapePlayPressed;
+	s_tapePlayPressed = false;
+	return pressed;
+}
+
+bool Screen_TapeRewindPressed()
+{
+	bool pressed = s_tapeRewindPressed;
+	s_tapeRewindPressed = false;
+	return pressed;
+}
+
 void Screen_PollInput( SpeccyKeyState *keyState )
 {
 	SDL_Event e;
@@ -149,10 +173,23 @@ void Screen_PollInput( SpeccyKeyState *keyState )
 				break;
 
 			case SDL_KEYDOWN:
+				if( e.key.keysym.sym == SDLK_F5 )
+				{
+					s_filtersEnabled = !s_filtersEnabled;
+					s_forcePresent = true;
+				}
+				if( e.key.keysym.sym == SDLK_F6 )
+					s_rewindHeld = true;
+				if( e.key.keysym.sym == SDLK_F7 && !e.key.repeat )
+					s_tapePlayPressed = true;
+				if( e.key.keysym.sym == SDLK_F8 && !e.key.repeat )
+					s_tapeRewindPressed = true;
 				ProcessKey( e.key.keysym.sym, true, keyState );
 				break;
 
 			case SDL_KEYUP:
+				if( e.key.keysym.sym == SDLK_F6 )
+					s_rewindHeld = false;
 				ProcessKey( e.key.keysym.sym, false, keyState );
 				break;
 
@@ -162,95 +199,159 @@ void Screen_PollInput( SpeccyKeyState *keyState )
 	}
 }
 
-void Screen_UpdateScanline( uint8_t frame, int scanline, const uint8_t *mem, uint8_t borderIndex )
+static void FillSpan( uint32_t *line, int x0, int x1, uint32_t color )
 {
+	for( int x = x0; x < x1; x++ )
+	{
+		line[x] = color;
+	}
+}
+
+static void FillBorder( uint32_t *line, int x0, int x1, uint32_t color, bool paperLine )
+{
+	if( !paperLine )
+	{
+		FillSpan( line, x0, x1, color );
+		return;
+	}
+
+	FillSpan( line, x0, x1 < BORDER_WIDTH ? x1 : BORDER_WIDTH, color );
+	FillSpan( line, x0 > BORDER_WIDTH + PIXEL_WIDTH ? x0 : BORDER_WIDTH + PIXEL_WIDTH, x1, color );
+}
+
+void Screen_UpdateScanline( uint8_t frame, int scanline, const uint8_t *mem, BorderLog *border )
+{
+	// Pixel x of this line is drawn at T-state lineStart + ( x / 2 ), paper starts at scanline * TSTATES_PER_LINE
+	const int lineStart = ( scanline * TSTATES_PER_LINE ) - ( BORDER_WIDTH / 2 );
+	const int lineEnd = lineStart + ( SCREEN_WIDTH / 2 );
+
 	if( scanline < VBLANK_HEIGHT )
+	{
+		while( border->tail != border->head )
+		{
+			const BorderEvent *e = &border->event[border->tail & BORDER_LOG_MASK];
+			if( (int)e->tstate >= lineEnd )
+				break;
+			border->color = e->color;
+			border->tail++;
+		}
 		return;
+	}
 
 	const int y = scanline - VBLANK_HEIGHT;
 	const int sy = scanline - ( VBLANK_HEIGHT + TOP_BORDER_HEIGHT );
-			
-	const SDL_Color *borderColor = &s_colors[0][borderIndex];
-	uint32_t border = SDL_MapRGB( s_surface->format, borderColor->r, borderColor->g, borderColor->b );
-	
+	const bool paperLine = sy >= 0 && sy < PIXEL_HEIGHT;
+
 	SDL_LockSurface( s_surface );
 	
-	uint32_t *dest = ((uint32_t *)s_surface->pixels) + ( y * s_surface->w );
+	uint32_t *line = ((uint32_t *)s_surface->pixels) + ( y * s_surface->w );
 
-	for( int x = 0; x < BORDER_WIDTH; x++ )
+	if( paperLine )
 	{
-		*dest = border;
-		dest++;
+		Display_DecodeLine( line + BORDER_WIDTH, mem, sy, frame, s_palette );
 	}
 
-	if( sy < 0 || sy >= PIXEL_HEIGHT )
+	// Run-length fill the border from the colour changes that happened during this line
+	int x = 0;
+	uint8_t color = border->color;
+	while( border->tail != border->head )
 	{
-		for( int x = 0; x < PIXEL_WIDTH; x++ )
+		const BorderEvent *e = &border->event[border->tail & BORDER_LOG_MASK];
+		const int ex = ( (int)e->tstate - lineStart ) * 2;
+		if( ex >= SCREEN_WIDTH )
+			break;
+
+		if( ex > x )
 		{
-			*dest = border;
-			dest++;
+			FillBorder( line, x, ex, s_palette[color], paperLine );
+			x = ex;
 		}
+		color = e->color;
+		border->tail++;
 	}
-	else
-	{
-		const int srcY = ( ( sy >> 3 ) & 7 ) | ( ( sy & 7 ) << 3 ) | ( sy & ( 3 << 6 ) );
-		const uint8_t *src = mem + ( srcY * 32 );
-		const uint8_t *attr = mem + ( PIXEL_HEIGHT * 32 ) + ( ( sy >> 3 ) * 32 );
+	FillBorder( line, x, SCREEN_WIDTH, s_palette[color], paperLine );
+	border->color = color;
 
-		for( int x = 0; x < PIXEL_WIDTH; x+=8 )
-		{
-			int8_t flash = ( frame << 3 ) & *attr;
-			flash >>= 7;
+	s_hashAccum = Hash_Bytes( line, SCREEN_WIDTH * sizeof( uint32_t ), s_hashAccum );
 
-			uint8_t attrInk = ( *attr ^ flash ) & 0x7;
-			uint8_t attrPaper = ( ( *attr ^ flash ) >> 3 ) & 0x7;
-			uint8_t attrBright = ( *attr >> 6 ) & 0x1;
-			uint8_t attrFlash = ( *attr >> 7 ) & 0x1;
+	SDL_UnlockSurface( s_surface );
 
-			const SDL_Color *inkColor = &s_colors[attrBright][attrInk];
-			const SDL_Color *paperColor = &s_colors[attrBright][attrPaper];
+}
 
-			uint32_t ink = SDL_MapRGB( s_surface->format, inkColor->r, inkColor->g, inkColor->b );
-			uint32_t paper = SDL_MapRGB( s_surface->format, paperColor->r, paperColor->g, paperColor->b );
-			for( int b = 7; b >= 0; b-- )
-			{
-				if( *src & ( 1 << b ) )
-				{
-					*dest = ink;
-				}
-				else
-				{
-					*dest = paper;
-				}
-				dest++;
-			}
-			src++;
-			attr++;
-		}
-	}
+static SDL_Surface *ApplyFilters()
+{
+	const FilterImage src = { (uint32_t *)s_surface->pixels, s_surface->w, s_surface->h, s_surface->pitch / 4 };
+	const FilterImage *out = Filter_Apply( &src );
 
-	for( int x = 0; x < BORDER_WIDTH; x++ )
+	if( s_filterSurface == NULL || s_filterSurface->pixels != out->pixels || s_filterSurface->w != out->width || s_filterSurface->h != out->height )
 	{
-		*dest = border;
-		dest++;
-	}
+		if( s_filterSurface )
+			SDL_FreeSurface( s_filterSurface );
 
+		const SDL_PixelFormat *format = s_surface->format;
+		s_filterSurface = SDL_CreateRGBSurfaceFrom( out->pixels, out->width, out->height, 32, out->pitch * 4,
+				format->Rmask, format->Gmask, format->Bmask, format->Amask );
+	}
 
-	SDL_UnlockSurface( s_surface );
-
+	return s_filterSurface;
 }
 
 void Screen_UpdateFrame()
 {
+	s_prevFrameHash = s_frameHash;
+	s_frameHash = s_hashAccum;
+	s_hashAccum = HASH_SEED;
+
+	// Nothing to do if the window already shows this image
+	if( s_frameHash == s_presentedHash && !s_forcePresent )
+		return;
+
+	s_presentedHash = s_frameHash;
+	s_forcePresent = false;
+
 	SDL_Surface *windowSurface = SDL_GetWindowSurface( s_window );
-	SDL_BlitScaled( s_surface, NULL, windowSurface, NULL );
+	SDL_Surface *frame = s_surface;
+
+	if( s_filtersEnabled && Filter_ChainLength() > 0 )
+		frame = ApplyFilters();
+
+	if( frame->w == windowSurface->w && frame->h == windowSurface->h )
+		SDL_BlitSurface( frame, NULL, windowSurface, NULL );
+	else
+		SDL_BlitScaled( frame, NULL, windowSurface, NULL );
+
 	SDL_UpdateWindowSurface( s_window );
+}
+
 
-	uint32_t cur = SDL_GetTicks();
-	int delta = cur - s_frameStart;
-	if( delta < 20 )
-		SDL_Delay( 20 - delta );
+uint64_t Screen_FrameHash()
+{
+	return s_frameHash;
+}
 
-	s_frameStart = SDL_GetTicks();
+bool Screen_FrameChanged()
+{
+	return s_frameHash != s_prevFrameHash;
 }
 
+bool Screen_CaptureFrame( const char *name )
+{
+	const SDL_PixelFormat *format = s_surface->format;
+	uint8_t *rgb = (uint8_t *)malloc( s_surface->w * s_surface->h * 3 );
+	uint8_t *dest = rgb;
+
+	for( int y = 0; y < s_surface->h; y++ )
+	{
+		const uint32_t *src = (const uint32_t *)( (const uint8_t *)s_surface->pixels + ( y * s_surface->pitch ) );
+		for( int x = 0; x < s_surface->w; x++ )
+		{
+			SDL_GetRGB( src[x], format, &dest[0], &dest[1], &dest[2] );
+			dest += 3;
+		}
+	}
+
+	bool ok = Image_WritePPM( name, rgb, s_surface->w, s_surface->h );
+	free( rgb );
+
+	return ok;
+}
@@ -3,14 +3,27 @@
 
 struct ZState;
 struct SpeccyKeyState;
+struct BorderLog;
 
 bool Screen_Init();
 void Screen_Shutdown();
 
 bool Screen_Continue();
 void Screen_PollInput( SpeccyKeyState *keyState );
-void Screen_UpdateScanline( uint8_t frame, int scanline, const uint8_t *mem, uint8_t borderIndex );
+bool Screen_RewindHeld();
+
+// F7 and F8, true once for each press
+bool Screen_TapePlayPressed();
+bool Screen_TapeRewindPressed();
+void Screen_UpdateScanline( uint8_t frame, int scanline, const uint8_t *mem, BorderLog *border );
 void Screen_UpdateFrame();
 
+// Hash of the pixels of the last frame passed to Screen_UpdateFrame, which
+// only presents the frame if it differs from the last one presented
+uint64_t Screen_FrameHash();
+bool Screen_FrameChanged();
+
+bool Screen_CaptureFrame( const char *name );
+
 #endif // SCREEN_H
 
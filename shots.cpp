@@ -0,0 +1,275 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "display.h"
+#include "speccy.h"
+#include "image.h"
+#include "mapfile.h"
+#include "threadpool.h"
+#include "snapshot.h"
+
+// Attribute used for bitmap only .scr files, black ink on white paper
+#define DEFAULT_ATTR 0x38
+
+enum OutputFormat
+{
+	OUTPUT_PNG,
+	OUTPUT_PPM,
+};
+
+struct ShotOptions
+{
+	OutputFormat format;
+	bool border;
+	bool half;
+	const char *outDir;
+};
+
+static ShotOptions s_options;
+static std::vector<std::string> s_files;
+static std::atomic<int> s_failed( 0 );
+
+static const uint32_t s_indexPalette[DISPLAY_PALETTE_SIZE] =
+{
+	0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15
+};
+
+static bool LoadScreen( const MappedFile *file, uint8_t *screen, uint8_t *border )
+{
+	// Screens are picked out by size first, as .z80 has no signature to tell them apart by
+	const bool screenSize = file->size == DISPLAY_FILE_SIZE || file->size == DISPLAY_BITMAP_SIZE;
+
+	if( !screenSize && Snapshot_Detect( file->data, file->size ) != SNAPSHOT_UNKNOWN )
+	{
+		uint8_t *ram = (uint8_t *)malloc( SNAPSHOT_RAM_SIZE );
+		Snapshot snap;
+
+		bool ok = Snapshot_Parse( file->data, file->size, &snap, ram );
+		if( ok )
+		{
+			memcpy( screen, ram, DISPLAY_FILE_SIZE );
+			*border = snap.border;
+		}
+
+		free( ram );
+		return ok;
+	}
+
+	// Anything else that isn't a snapshot is unrecognised, not a screen with junk after it
+	if( file->size == DISPLAY_FILE_SIZE )
+	{
+		memcpy( screen, file->data, DISPLAY_FILE_SIZE );
+	}
+	else if( file->size == DISPLAY_BITMAP_SIZE )
+	{
+		memcpy( screen, file->data, DISPLAY_BITMAP_SIZE );
+		memset( screen + DISPLAY_BITMAP_SIZE, DEFAULT_ATTR, DISPLAY_ATTR_SIZE );
+	}
+	else
+	{
+		return false;
+	}
+
+	*border = 7;
+	return true;
+}
+
+static void RenderIndices( uint8_t *dest, int width, int height, const uint8_t *screen, uint8_t border )
+{
+	const int left = s_options.border ? BORDER_WIDTH : 0;
+	const int top = s_options.border ? TOP_BORDER_HEIGHT : 0;
+	uint32_t line[PIXEL_WIDTH];
+
+	for( int y = 0; y < height; y++ )
+	{
+		uint8_t *row = dest + ( y * width );
+		const int sy = y - top;
+
+		memset( row, border, width );
+
+		if( sy < 0 || sy >= PIXEL_HEIGHT )
+			continue;
+
+		Display_DecodeLine( line, screen, sy, 0, s_indexPalette );
+		for( int x = 0; x < PIXEL_WIDTH; x++ )
+		{
+			row[left + x] = (uint8_t)line[x];
+		}
+	}
+}
+
+static std::string OutputName( const char *name )
+{
+	const char *base = strrchr( name, '/' );
+	std::string out;
+
+	if( s_options.outDir )
+	{
+		out = s_options.outDir;
+		out += '/';
+		out += base ? base + 1 : name;
+	}
+	else
+	{
+		out = name;
+	}
+
+	size_t dot = out.rfind( '.' );
+	size_t slash = out.rfind( '/' );
+	if( dot != std::string::npos && ( slash == std::string::npos || dot > slash ) )
+		out.erase( dot );
+
+	out += s_options.format == OUTPUT_PNG ? ".png" : ".ppm";
+	return out;
+}
+
+static bool WriteShot( const char *name, const uint8_t *indices, int width, int height )
+{
+	std::string outName = OutputName( name );
+
+	if( s_options.format == OUTPUT_PNG )
+		return Image_WritePNG( outName.c_str(), indices, width, height, g_displayColors, DISPLAY_PALETTE_SIZE );
+
+	std::vector<uint8_t> rgb( width * height * 3 );
+	for( int i = 0; i < width * height; i++ )
+	{
+		memcpy( &rgb[i * 3], g_displayColors[indices[i]], 3 );
+	}
+	return Image_WritePPM( outName.c_str(), &rgb[0], width, height );
+}
+
+static void ProcessFile( void *context, int index )
+{
+	const char *name = s_files[index].c_str();
+	uint8_t screen[DISPLAY_FILE_SIZE];
+	uint8_t border;
+	MappedFile file;
+
+	if( !MapFile_Open( &file, name ) )
+	{
+		printf( "Could not read %s\n", name );
+		s_failed++;
+		return;
+	}
+
+	bool ok = LoadScreen( &file, screen, &border );
+	MapFile_Close( &file );
+
+	if( !ok )
+	{
+		printf( "Not a screen or snapshot: %s\n", name );
+		s_failed++;
+		return;
+	}
+
+	int width = s_options.border ? SCREEN_WIDTH : PIXEL_WIDTH;
+	int height = s_options.border ? SCREEN_HEIGHT : PIXEL_HEIGHT;
+	std::vector<uint8_t> indices( width * height );
+
+	RenderIndices( &indices[0], width, height, screen, border );
+
+	if( s_options.half )
+	{
+		width /= 2;
+		height /= 2;
+		for( int y = 0; y < height; y++ )
+		{
+			for( int x = 0; x < width; x++ )
+			{
+				indices[( y * width ) + x] = indices[( y * 2 * width * 2 ) + ( x * 2 )];
+			}
+		}
+	}
+
+	if( !WriteShot( name, &indices[0], width, height ) )
+	{
+		printf( "Could not write image for %s\n", name );
+		s_failed++;
+	}
+}
+
+static void AddFileList( const char *listName )
+{
+	FILE *fp = fopen( listName, "r" );
+	if( fp == NULL )
+	{
+		printf( "Could not read file list %s\n", listName );
+		return;
+	}
+
+	char line[4096];
+	while( fgets( line, sizeof( line ), fp ) )
+	{
+		line[strcspn( line, "\r\n" )] = 0;
+		if( line[0] )
+			s_files.push_back( line );
+	}
+	fclose( fp );
+}
+
+static void Usage()
+{
+	printf( "Usage: shots [-ppm] [-border] [-half] [-threads n] [-o dir] files... @filelist...\n" );
+}
+
+int main( int argc, char *argv[] )
+{
+	int threads = 0;
+
+	s_options.format = OUTPUT_PNG;
+	s_options.border = false;
+	s_options.half = false;
+	s_options.outDir = NULL;
+
+	for( int i = 1; i < argc; i++ )
+	{
+		if( strcmp( argv[i], "-ppm" ) == 0 )
+			s_options.format = OUTPUT_PPM;
+		else if( strcmp( argv[i], "-png" ) == 0 )
+			s_options.format = OUTPUT_PNG;
+		else if( strcmp( argv[i], "-border" ) == 0 )
+			s_options.border = true;
+		else if( strcmp( argv[i], "-half" ) == 0 )
+			s_options.half = true;
+		else if( strcmp( argv[i], "-threads" ) == 0 && i + 1 < argc )
+			threads = atoi( argv[++i] );
+		else if( strcmp( argv[i], "-o" ) == 0 && i + 1 < argc )
+			s_options.outDir = argv[++i];
+		else if( argv[i][0] == '@' )
+			AddFileList( argv[i] + 1 );
+		else if( argv[i][0] == '-' )
+		{
+			Usage();
+			return 1;
+		}
+		else
+			s_files.push_back( argv[i] );
+	}
+
+	if( s_files.empty() )
+	{
+		Usage();
+		return 1;
+	}
+
+	ThreadPool_Init( threads );
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	ThreadPool_Run( ProcessFile, NULL, (int)s_files.size() );
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	// Shutting down leaves only the calling thread
+	const int threadCount = ThreadPool_ThreadCount();
+	ThreadPool_Shutdown();
+
+	printf( "%d files, %d failed, %.3fs on %d threads (%.0f files/s)\n", (int)s_files.size(), s_failed.load(),
+			elapsed.count(), threadCount, s_files.size() / elapsed.count() );
+
+	return s_failed > 0 ? 1 : 0;
+}
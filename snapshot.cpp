@@ -0,0 +1,337 @@
+#include <string.h>
+#include <zlib.h>
+
+#include "snapshot.h"
+
+#define SNAPSHOT_PAGE_SIZE 0x4000
+
+#define SNA_HEADER_SIZE 27
+#define SNA_SIZE ( SNA_HEADER_SIZE + SNAPSHOT_RAM_SIZE )
+
+#define Z80_V1_HEADER_SIZE 30
+#define Z80_V2_EXTRA_SIZE 23
+#define Z80_V3_EXTRA_SIZE 54
+#define Z80_V3X_EXTRA_SIZE 55
+
+#define SZX_HEADER_SIZE 8
+#define SZX_BLOCK_HEADER_SIZE 8
+#define SZX_MACHINE_48K 1
+#define SZX_Z80R_SIZE 37
+#define SZX_RAMP_COMPRESSED 0x0001
+#define SZX_Z80R_HALTED 0x02
+
+#define BLOCK_ID(a,b,c,d) ( (uint32_t)(a) | ( (uint32_t)(b) << 8 ) | ( (uint32_t)(c) << 16 ) | ( (uint32_t)(d) << 24 ) )
+
+static uint16_t Read16( const uint8_t *p )
+{
+	return p[0] | ( p[1] << 8 );
+}
+
+static uint32_t Read32( const uint8_t *p )
+{
+	return p[0] | ( p[1] << 8 ) | ( p[2] << 16 ) | ( (uint32_t)p[3] << 24 );
+}
+
+static void ClearSnapshot( Snapshot *snap )
+{
+	memset( snap, 0, sizeof( Snapshot ) );
+}
+
+SnapshotFormat Snapshot_Detect( const uint8_t *data, size_t size )
+{
+	if( size >= SZX_HEADER_SIZE && memcmp( data, "ZXST", 4 ) == 0 )
+		return SNAPSHOT_SZX;
+
+	if( size == SNA_SIZE )
+		return SNAPSHOT_SNA;
+
+	if( size > Z80_V1_HEADER_SIZE )
+	{
+		// Version 1 has a non-zero PC, later versions zero it and give the extra header length
+		if( Read16( data + 6 ) != 0 )
+			return SNAPSHOT_Z80;
+
+		uint16_t extra = Read16( data + Z80_V1_HEADER_SIZE );
+		if( size > (size_t)( Z80_V1_HEADER_SIZE + 2 + extra ) && ( extra == Z80_V2_EXTRA_SIZE || extra == Z80_V3_EXTRA_SIZE || extra == Z80_V3X_EXTRA_SIZE ) )
+			return SNAPSHOT_Z80;
+	}
+
+	return SNAPSHOT_UNKNOWN;
+}
+
+static bool ParseSNA( const uint8_t *data, size_t size, Snapshot *snap, uint8_t *ram )
+{
+	if( size != SNA_SIZE )
+		return false;
+
+	snap->reg.I = data[0];
+	snap->sreg.HL = Read16( data + 1 );
+	snap->sreg.DE = Read16( data + 3 );
+	snap->sreg.BC = Read16( data + 5 );
+	snap->sreg.AF = Read16( data + 7 );
+	snap->reg.HL = Read16( data + 9 );
+	snap->reg.DE = Read16( data + 11 );
+	snap->reg.BC = Read16( data + 13 );
+	snap->reg.IY = Read16( data + 15 );
+	snap->reg.IX = Read16( data + 17 );
+	snap->IFF2 = ( data[19] >> 2 ) & 1;
+	snap->reg.R = data[20];
+	snap->reg.AF = Read16( data + 21 );
+	snap->reg.SP = Read16( data + 23 );
+	snap->IMODE = data[25] & 3;
+	snap->border = data[26] & 7;
+
+	memcpy( ram, data + SNA_HEADER_SIZE, SNAPSHOT_RAM_SIZE );
+
+	// The PC is on the stack, popped as the RETN the snapshot was taken from would
+	uint16_t sp = snap->reg.SP;
+	if( sp < 0x4000 || sp == 0xffff )
+		return false;
+
+	snap->reg.PC = ram[sp - 0x4000] | ( ram[sp - 0x4000 + 1] << 8 );
+	snap->reg.SP = sp + 2;
+	snap->IFF1 = snap->IFF2;
+
+	return true;
+}
+
+// ED ED count value runs, anything else is literal
+static bool UnpackZ80( const uint8_t *src, size_t size, uint8_t *dest, size_t destSize )
+{
+	size_t in = 0;
+	size_t out = 0;
+
+	while( in < size && out < destSize )
+	{
+		if( in + 3 < size && src[in] == 0xed && src[in + 1] == 0xed )
+		{
+			size_t count = src[in + 2];
+			if( out + count > destSize )
+				return false;
+
+			memset( dest + out, src[in + 3], count );
+			out += count;
+			in += 4;
+		}
+		else
+		{
+			dest[out++] = src[in++];
+		}
+	}
+
+	return out == destSize;
+}
+
+// Offset in 48K RAM of a .z80 page, -1 for pages a 48K machine doesn't have
+static int Z80PageOffset( uint8_t page )
+{
+	switch( page )
+	{
+	case 8: return 0x0000;
+	case 4: return 0x4000;
+	case 5: return 0x8000;
+	}
+	return -1;
+}
+
+static bool ParseZ80( const uint8_t *data, size_t size, Snapshot *snap, uint8_t *ram )
+{
+	if( size <= Z80_V1_HEADER_SIZE )
+		return false;
+
+	uint8_t flags = data[12] == 0xff ? 1 : data[12];
+
+	snap->reg.A = data[0];
+	snap->reg.F = data[1];
+	snap->reg.BC = Read16( data + 2 );
+	snap->reg.HL = Read16( data + 4 );
+	snap->reg.PC = Read16( data + 6 );
+	snap->reg.SP = Read16( data + 8 );
+	snap->reg.I = data[10];
+	snap->reg.R = ( data[11] & 0x7f ) | ( ( flags & 1 ) << 7 );
+	snap->border = ( flags >> 1 ) & 7;
+	snap->reg.DE = Read16( data + 13 );
+	snap->sreg.BC = Read16( data + 15 );
+	snap->sreg.DE = Read16( data + 17 );
+	snap->sreg.HL = Read16( data + 19 );
+	snap->sreg.A = data[21];
+	snap->sreg.F = data[22];
+	snap->reg.IY = Read16( data + 23 );
+	snap->reg.IX = Read16( data + 25 );
+	snap->IFF1 = data[27] ? 1 : 0;
+	snap->IFF2 = data[28] ? 1 : 0;
+	snap->IMODE = data[29] & 3;
+
+	if( snap->reg.PC != 0 )
+	{
+		// Version 1, a single 48K block
+		const uint8_t *src = data + Z80_V1_HEADER_SIZE;
+		size_t srcSize = size - Z80_V1_HEADER_SIZE;
+
+		if( ( flags & 0x20 ) == 0 )
+		{
+			if( srcSize < SNAPSHOT_RAM_SIZE )
+				return false;
+			memcpy( ram, src, SNAPSHOT_RAM_SIZE );
+			return true;
+		}
+
+		return UnpackZ80( src, srcSize, ram, SNAPSHOT_RAM_SIZE );
+	}
+
+	uint16_t extra = Read16( data + Z80_V1_HEADER_SIZE );
+	size_t offset = Z80_V1_HEADER_SIZE + 2 + extra;
+	if( offset > size || ( extra != Z80_V2_EXTRA_SIZE && extra != Z80_V3_EXTRA_SIZE && extra != Z80_V3X_EXTRA_SIZE ) )
+		return false;
+
+	snap->reg.PC = Read16( data + 32 );
+
+	// 48K, 48K + Interface 1, and in version 3 48K + M.G.T.
+	uint8_t hardware = data[34];
+	if( hardware != 0 && hardware != 1 && !( hardware == 3 && extra != Z80_V2_EXTRA_SIZE ) )
+		return false;
+
+	int loaded = 0;
+	while( offset + 3 <= size )
+	{
+		uint16_t length = Read16( data + offset );
+		uint8_t page = data[offset + 2];
+		offset += 3;
+
+		bool raw = length == 0xffff;
+		size_t srcSize = raw ? SNAPSHOT_PAGE_SIZE : length;
+		if( offset + srcSize > size )
+			return false;
+
+		int pageOffset = Z80PageOffset( page );
+		if( pageOffset >= 0 )
+		{
+			if( raw )
+				memcpy( ram + pageOffset, data + offset, SNAPSHOT_PAGE_SIZE );
+			else if( !UnpackZ80( data + offset, srcSize, ram + pageOffset, SNAPSHOT_PAGE_SIZE ) )
+				return false;
+
+			loaded |= 1 << ( pageOffset / SNAPSHOT_PAGE_SIZE );
+		}
+
+		offset += srcSize;
+	}
+
+	return loaded == 7;
+}
+
+// Offset in 48K RAM of a .szx page, -1 for pages a 48K machine doesn't have
+static int SZXPageOffset( uint8_t page )
+{
+	switch( page )
+	{
+	case 5: return 0x0000;
+	case 2: return 0x4000;
+	case 0: return 0x8000;
+	}
+	return -1;
+}
+
+static bool ParseSZX( const uint8_t *data, size_t size, Snapshot *snap, uint8_t *ram )
+{
+	if( size < SZX_HEADER_SIZE || memcmp( data, "ZXST", 4 ) != 0 || data[6] != SZX_MACHINE_48K )
+		return false;
+
+	bool registers = false;
+	int loaded = 0;
+
+	size_t offset = SZX_HEADER_SIZE;
+	while( offset + SZX_BLOCK_HEADER_SIZE <= size )
+	{
+		uint32_t id = Read32( data + offset );
+		uint32_t blockSize = Read32( data + offset + 4 );
+		offset += SZX_BLOCK_HEADER_SIZE;
+
+		if( blockSize > size - offset )
+			return false;
+
+		const uint8_t *block = data + offset;
+		offset += blockSize;
+
+		if( id == BLOCK_ID( 'Z', '8', '0', 'R' ) )
+		{
+			if( blockSize < SZX_Z80R_SIZE )
+				return false;
+
+			snap->reg.AF = Read16( block + 0 );
+			snap->reg.BC = Read16( block + 2 );
+			snap->reg.DE = Read16( block + 4 );
+			snap->reg.HL = Read16( block + 6 );
+			snap->sreg.AF = Read16( block + 8 );
+			snap->sreg.BC = Read16( block + 10 );
+			snap->sreg.DE = Read16( block + 12 );
+			snap->sreg.HL = Read16( block + 14 );
+			snap->reg.IX = Read16( block + 16 );
+			snap->reg.IY = Read16( block + 18 );
+			snap->reg.SP = Read16( block + 20 );
+			snap->reg.PC = Read16( block + 22 );
+			snap->reg.I = block[24];
+			snap->reg.R = block[25];
+			snap->IFF1 = block[26] ? 1 : 0;
+			snap->IFF2 = block[27] ? 1 : 0;
+			snap->IMODE = block[28] & 3;
+			snap->halted = ( block[34] & SZX_Z80R_HALTED ) != 0;
+			registers = true;
+		}
+		else if( id == BLOCK_ID( 'S', 'P', 'C', 'R' ) )
+		{
+			if( blockSize < 1 )
+				return false;
+
+			snap->border = block[0] & 7;
+		}
+		else if( id == BLOCK_ID( 'R', 'A', 'M', 'P' ) )
+		{
+			if( blockSize < 3 )
+				return false;
+
+			int pageOffset = SZXPageOffset( block[2] );
+			if( pageOffset < 0 )
+				continue;
+
+			const uint8_t *src = block + 3;
+			uint32_t srcSize = blockSize - 3;
+
+			if( Read16( block ) & SZX_RAMP_COMPRESSED )
+			{
+				uLongf destSize = SNAPSHOT_PAGE_SIZE;
+				if( uncompress( ram + pageOffset, &destSize, src, srcSize ) != Z_OK || destSize != SNAPSHOT_PAGE_SIZE )
+					return false;
+			}
+			else
+			{
+				if( srcSize != SNAPSHOT_PAGE_SIZE )
+					return false;
+				memcpy( ram + pageOffset, src, SNAPSHOT_PAGE_SIZE );
+			}
+
+			loaded |= 1 << ( pageOffset / SNAPSHOT_PAGE_SIZE );
+		}
+	}
+
+	return registers && loaded == 7;
+}
+
+bool Snapshot_Parse( const uint8_t *data, size_t size, Snapshot *snap, uint8_t *ram )
+{
+	ClearSnapshot( snap );
+
+	switch( Snapshot_Detect( data, size ) )
+	{
+	case SNAPSHOT_SNA:
+		return ParseSNA( data, size, snap, ram );
+	case SNAPSHOT_Z80:
+		return ParseZ80( data, size, snap, ram );
+	case SNAPSHOT_SZX:
+		return ParseSZX( data, size, snap, ram );
+	default:
+		break;
+	}
+
+	return false;
+}
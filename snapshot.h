@@ -0,0 +1,39 @@
+#if !defined( SNAPSHOT_H )
+#define SNAPSHOT_H 1
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "z80.h"
+
+// RAM from 0x4000, the 48K machine
+#define SNAPSHOT_RAM_SIZE 0xc000
+
+enum SnapshotFormat
+{
+	SNAPSHOT_UNKNOWN,
+	SNAPSHOT_SNA,
+	SNAPSHOT_Z80,
+	SNAPSHOT_SZX,
+};
+
+struct Snapshot
+{
+	RegisterSet reg;
+	RegisterSet sreg;
+
+	uint8_t IFF1;
+	uint8_t IFF2;
+	uint8_t IMODE;
+	uint8_t border;
+	bool halted;
+};
+
+// Works out the format from the file contents, not its name
+SnapshotFormat Snapshot_Detect( const uint8_t *data, size_t size );
+
+// Validates and decodes a snapshot of any supported format, RAM is decompressed
+// straight into ram ( SNAPSHOT_RAM_SIZE bytes ), which is undefined on failure
+bool Snapshot_Parse( const uint8_t *data, size_t size, Snapshot *snap, uint8_t *ram );
+
+#endif // SNAPSHOT_H
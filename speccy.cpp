@@ -1,131 +1,521 @@
+#include <unistd.h>
+
 #include "z80.h"
+#include "machine.h"
 #include "screen.h"
 #include "speccy.h"
+#include "pacing.h"
+#include "filter.h"
+#include "threadpool.h"
+#include "rewind.h"
+#include "statefile.h"
+#include "movie.h"
+#include "tape.h"
+#include "audio.h"
+#include "ay.h"
+#include "basic.h"
+#include "boot.h"
+#include "calc.h"
+#include "print.h"
+
+// Capture every 5 frames, a keyframe every 10 captures
+#define REWIND_INTERVAL 5
+#define REWIND_KEYFRAME_INTERVAL 10
+
+// Frames stepped back per frame shown while rewinding
+#define REWIND_STEP 2
+
+// Frames between writes of a state file's dirty pages
+#define STATE_AUTOSAVE_FRAMES 250
+
+// Frames rendered while warping through tape loading
+#define TAPE_WARP_SKIP 10
 
-static SpeccyKeyState s_keyState;
-static uint8_t s_ula;
+// Frames between run-ahead cost reports
+#define RUN_AHEAD_REPORT 250
 
-uint8_t ULARead( ZState *Z, uint16_t addr )
+// Frames between audio queue reports
+#define AUDIO_REPORT 250
+
+static BorderLog s_border;
+static BeeperLog s_beeper;
+static AYRegisters s_ay;
+static MachineState s_runAheadState;
+static uint64_t s_runAheadTime;
+static int s_runAheadFrames;
+
+static void RenderLine( Machine *M, int scanline, void *context )
 {
-	for( int i = 0; i < 8; i++ )
-	{
-		if( ( addr & ( 0x0100 << i ) ) == 0 )
-			return s_keyState.row[i] & 0x1f;
-	}
-	return 0x00;
+	Screen_UpdateScanline( M->frame, scanline, Machine_Screen( M ), M->border );
 }
 
-void ULAWrite( ZState *Z, uint16_t addr, uint8_t value )
+// Runs frames ahead with the current input and renders the last of them, then
+// returns the machine to where it was
+static void RunAhead( Machine *M, int frames, bool render )
 {
-	s_ula = value;
+	const uint64_t start = Pacing_Now();
+
+	// Only the frame kept is heard
+	BeeperLog *beeper = M->beeper;
+	M->beeper = NULL;
+
+	Machine_SaveState( M, &s_runAheadState );
+	for( int i = 0; i < frames; i++ )
+	{
+		Machine_RunFrame( M, ( render && i == frames - 1 ) ? RenderLine : NULL, NULL );
+	}
+	Machine_RestoreState( M, &s_runAheadState );
+	M->beeper = beeper;
+
+	s_runAheadTime += Pacing_Now() - start;
+	s_runAheadFrames++;
+
+	if( s_runAheadFrames == RUN_AHEAD_REPORT )
+	{
+		printf( "Run-ahead %d: %.3fms per frame\n", frames, ( s_runAheadTime / (double)s_runAheadFrames ) / 1000000.0 );
+		s_runAheadTime = 0;
+		s_runAheadFrames = 0;
+	}
 }
 
-void ReadSNA( ZState *Z, const char *name, uint8_t *ram )
+// Replays a movie as fast as possible with no window, returns the exit code
+static int PlayHeadless( Machine *M )
 {
-	FILE *fp = fopen( name, "rb" );
-	fread( &Z->reg.I, 1, 1, fp );
-	fread( &Z->sreg.HL, 2, 1, fp );
-	fread( &Z->sreg.DE, 2, 1, fp );
-	fread( &Z->sreg.BC, 2, 1, fp );
-	fread( &Z->sreg.AF, 2, 1, fp );
-
-	fread( &Z->reg.HL, 2, 1, fp );
-	fread( &Z->reg.DE, 2, 1, fp );
-	fread( &Z->reg.BC, 2, 1, fp );
-	fread( &Z->reg.IY, 2, 1, fp );
-	fread( &Z->reg.IX, 2, 1, fp );
-
-	uint8_t iff;
-	fread( &iff, 1, 1, fp );
-	Z->IFF0 = iff & 1 ? 1 : 0;
-	Z->IFF1 = iff & 2 ? 1 : 0;
-	Z->NMI = 0;
-	Z->INT = 0;
-
-	fread( &Z->reg.R, 1, 1, fp );
-	fread( &Z->reg.AF, 2, 1, fp );
-	fread( &Z->reg.SP, 2, 1, fp );
-	
-	fread( &iff, 1, 1, fp );
-
-	Z->IMODE = iff;
-
-	fread( &iff, 1, 1, fp );
-
-	fread( ram, 49152, 1, fp );
-
-	fclose( fp );
-}
+	uint32_t frames = Movie_EndFrame() - M->frameCount;
+	uint64_t start = Pacing_Now();
+
+	while( Movie_Playing( M ) )
+		Machine_RunFrame( M, NULL, NULL );
+
+	double seconds = ( Pacing_Now() - start ) / 1000000000.0;
+	bool match = Movie_Verify( M );
 
+	printf( "Played %u frames in %.3fs (%.0f frames/s, %.1fx real time)\n", frames, seconds, frames / seconds,
+		frames * (double)FRAME_TSTATES / ( seconds * CPU_CLOCK_HZ ) );
+	printf( "Final state %016llx: %s\n", (unsigned long long)Movie_StateHash( M ), match ? "match" : "MISMATCH" );
+
+	return match ? 0 : 1;
+}
 
 int main( int argc, char *argv[] )
 {
-	Screen_Init();
+	const char *snapshot = NULL;
+	PaceMode paceMode = PACE_REALTIME;
+	int paceFactor = 1;
+	const char *capturePrefix = NULL;
+	int rewindMB = 0;
+	int runAhead = 0;
+	const char *stateFile = NULL;
+	const char *recordMovie = NULL;
+	const char *playMovie = NULL;
+	const char *tape = NULL;
+	bool tapeEdges = false;
+	bool tapeWarp = false;
+	bool headless = false;
+	bool fastCalc = false;
+	bool fastPrint = false;
+	bool coldBoot = false;
+	const char *basic = NULL;
+	int autoRun = -1;
+	bool mute = false;
+	bool audioSync = false;
+	bool audioStats = false;
+	bool contention = true;
+	int turbo = 1;
+	bool model128 = false;
+
+	for( int i = 1; i < argc; i++ )
+	{
+		if( strcmp( argv[i], "-speed" ) == 0 && i + 1 < argc )
+		{
+			paceMode = PACE_SPEED;
+			paceFactor = atoi( argv[++i] );
+		}
+		else if( strcmp( argv[i], "-warp" ) == 0 )
+		{
+			paceMode = PACE_WARP;
+		}
+		else if( strcmp( argv[i], "-skip" ) == 0 && i + 1 < argc )
+		{
+			paceMode = PACE_WARP_SKIP;
+			paceFactor = atoi( argv[++i] );
+		}
+		else if( strcmp( argv[i], "-filter" ) == 0 && i + 1 < argc )
+		{
+			if( !Filter_ParseChain( argv[++i] ) )
+				return 1;
+		}
+		else if( strcmp( argv[i], "-capture" ) == 0 && i + 1 < argc )
+		{
+			capturePrefix = argv[++i];
+		}
+		else if( strcmp( argv[i], "-rewind" ) == 0 && i + 1 < argc )
+		{
+			rewindMB = atoi( argv[++i] );
+		}
+		else if( strcmp( argv[i], "-runahead" ) == 0 && i + 1 < argc )
+		{
+			runAhead = atoi( argv[++i] );
+		}
+		else if( strcmp( argv[i], "-state" ) == 0 && i + 1 < argc )
+		{
+			stateFile = argv[++i];
+		}
+		else if( strcmp( argv[i], "-record" ) == 0 && i + 1 < argc )
+		{
+			recordMovie = argv[++i];
+		}
+		else if( strcmp( argv[i], "-play" ) == 0 && i + 1 < argc )
+		{
+			playMovie = argv[++i];
+		}
+		else if( strcmp( argv[i], "-tape" ) == 0 && i + 1 < argc )
+		{
+			tape = argv[++i];
+		}
+		else if( strcmp( argv[i], "-tapeedges" ) == 0 )
+		{
+			tapeEdges = true;
+		}
+		else if( strcmp( argv[i], "-headless" ) == 0 )
+		{
+			headless = true;
+		}
+		else if( strcmp( argv[i], "-fastcalc" ) == 0 )
+		{
+			fastCalc = true;
+		}
+		else if( strcmp( argv[i], "-fastprint" ) == 0 )
+		{
+			fastPrint = true;
+		}
+		else if( strcmp( argv[i], "-coldboot" ) == 0 )
+		{
+			coldBoot = true;
+		}
+		else if( strcmp( argv[i], "-basic" ) == 0 && i + 1 < argc )
+		{
+			basic = argv[++i];
+		}
+		else if( strcmp( argv[i], "-autorun" ) == 0 && i + 1 < argc )
+		{
+			autoRun = atoi( argv[++i] );
+		}
+		else if( strcmp( argv[i], "-mute" ) == 0 )
+		{
+			mute = true;
+		}
+		else if( strcmp( argv[i], "-audiosync" ) == 0 )
+		{
+			audioSync = true;
+		}
+		else if( strcmp( argv[i], "-audiostats" ) == 0 )
+		{
+			audioStats = true;
+		}
+		else if( strcmp( argv[i], "-128" ) == 0 )
+		{
+			model128 = true;
+		}
+		else if( strcmp( argv[i], "-nocontention" ) == 0 )
+		{
+			contention = false;
+		}
+		else if( strcmp( argv[i], "-turbo" ) == 0 && i + 1 < argc )
+		{
+			turbo = atoi( argv[++i] );
+		}
+		else
+		{
+			snapshot = argv[i];
+		}
+	}
+
+	if( headless && playMovie == NULL )
+	{
+		printf( "-headless needs a movie to -play\n" );
+		return 1;
+	}
+
+	// Saved states, and so everything built on them, only hold the 48K's memory
+	if( model128 && ( stateFile || rewindMB > 0 || runAhead > 0 || recordMovie || playMovie || basic ) )
+	{
+		printf( "-state, -rewind, -runahead, -record, -play and -basic need the 48K model\n" );
+		return 1;
+	}
+
+	// The tape's position isn't part of a saved state, so frames run again would use up
+	// blocks and edges the real frames then miss
+	if( tape && ( rewindMB > 0 || runAhead > 0 ) )
+	{
+		printf( "-tape can't be used with -rewind or -runahead\n" );
+		return 1;
+	}
+
+	// Same for a movie's place in its events, frames run again would record or play them twice
+	if( ( recordMovie || playMovie ) && ( rewindMB > 0 || runAhead > 0 ) )
+	{
+		printf( "-record and -play can't be used with -rewind or -runahead\n" );
+		return 1;
+	}
 
-	uint8_t rom[16 * 1024];
-	uint8_t ram[48 * 1024];
+	ThreadPool_Init( 0 );
+	if( !headless )
+		Screen_Init();
+	Pacing_Init( headless ? PACE_WARP : paceMode, paceFactor );
+
+	// Big enough for either model, the 48K uses the start of each
+	static uint8_t rom[MACHINE_128_ROM_SIZE];
+	static uint8_t ram[MACHINE_128_RAM_SIZE];
+	static Machine M;
 
 	printf( "Reading rom.\n" );
-	FILE *fp = fopen( "roms/48.rom", "rb" );
-	if( fp == NULL )
+	bool romLoaded = model128 ? Machine_LoadROM( rom, "roms/128-0.rom" ) && Machine_LoadROM( rom + MACHINE_ROM_SIZE, "roms/128-1.rom" ) :
+		Machine_LoadROM( rom, "roms/48.rom" );
+	if( !romLoaded )
 	{
 		printf( "Could not read rom file\n" );
 		abort();
 	}
 
-	fread( rom, sizeof( rom ), 1, fp );
-	fclose( fp );
+	// An existing state file resumes where it was left, a snapshot given as well is ignored.
+	// One that can't be resumed is left alone rather than written over.
+	const bool resume = stateFile && access( stateFile, F_OK ) == 0;
+	if( resume && !StateFile_Map( &M, rom, stateFile ) )
+	{
+		printf( "Could not resume state file %s\n", stateFile );
+		return 1;
+	}
 
-	ZState Z;
-	Z80_Init( &Z );
+	if( resume )
+	{
+		printf( "Resumed state: %s\n", stateFile );
+	}
+	else
+	{
+		if( model128 )
+		{
+			Machine_Init128( &M, rom, ram );
+			AY_Attach( &M, &s_ay );
+		}
+		else
+			Machine_Init( &M, rom, ram );
 
-	Z.memory[0].base = 0x0000;
-	Z.memory[0].size = 0x4000;
-	Z.memory[0].type = MEM_ROM;
-	Z.memory[0].ptr = rom;
+		// Without a snapshot start at the ready prompt, unless the boot is wanted and
+		// there's no listing to type in. The boot is cached as a saved state.
+		if( snapshot == NULL && !model128 && ( !coldBoot || basic != NULL ) )
+		{
+			if( !Boot_Machine( &M, Boot_CacheDir() ) )
+			{
+				printf( "The ROM never reached its copyright message\n" );
+				return 1;
+			}
+		}
+		else
+			Machine_Reset( &M );
 
-	Z.memory[1].base = 0x4000;
-	Z.memory[1].size = 0xc000;
-	Z.memory[1].type = MEM_RAM;
-	Z.memory[1].ptr = ram;
+		if( snapshot != NULL )
+		{
+			printf( "Loading snapshot: %s\n", snapshot );
+			if( !Machine_LoadSnapshot( &M, snapshot ) )
+			{
+				printf( "Could not load snapshot %s\n", snapshot );
+				return 1;
+			}
+		}
 
-	Z.memoryCount = 2;
+		// Written straight into memory, so a movie recorded with it must be played with it
+		if( basic != NULL && !Basic_Load( &M, basic, autoRun ) )
+		{
+			printf( "Could not load BASIC listing %s\n", basic );
+			return 1;
+		}
 
-	Z.peripheral[0].mask = 0x0001;
-	Z.peripheral[0].address = 0x0000;
-	Z.peripheral[0].Read = ULARead;
-	Z.peripheral[0].Write = ULAWrite;
-	Z.peripheralCount = 1;
+		if( stateFile && !( StateFile_Write( &M, stateFile ) && StateFile_Map( &M, rom, stateFile ) ) )
+		{
+			printf( "Could not create state file %s\n", stateFile );
+			stateFile = NULL;
+		}
+	}
+	// Mapping a state file starts the machine again, contention and all
+	Machine_SetContention( &M, contention );
+	if( !Machine_SetTurbo( &M, turbo ) )
+	{
+		printf( "-turbo takes 1 to %d\n", MACHINE_MAX_TURBO );
+		return 1;
+	}
+	M.border = &s_border;
 
-	Z80_Reset( &Z );
+	const bool audio = !mute && !headless && Audio_Init();
 
-	if( argc == 2 )
+	// Paced by the audio device's clock in place of the performance counter
+	if( audio && audioSync && paceMode == PACE_REALTIME )
 	{
-		printf( "Loading snapshot: %s\n", argv[1] );
-		ReadSNA( &Z, argv[1], ram );
-		Z80_SnapshotResume( &Z );
+		paceMode = PACE_AUDIO;
+		Pacing_SetMode( paceMode, paceFactor );
 	}
 
-	memset( &s_keyState, 0xff, sizeof( s_keyState ) );
+	// These change timing, so movies must be played the way they were recorded
+	const uint8_t *basicRom = model128 ? rom + MACHINE_ROM_SIZE : rom;
+	if( fastCalc && !Calc_Enable( basicRom ) )
+		printf( "Rom not recognised, -fastcalc ignored\n" );
+	if( fastPrint && !Print_Enable( basicRom ) )
+		printf( "Rom not recognised, -fastprint ignored\n" );
 
-	uint8_t frame = 0;
+	if( tape && !Tape_Open( tape ) )
+	{
+		printf( "Could not open tape %s\n", tape );
+		return 1;
+	}
+
+	// Recordings without blocks can only be played
+	if( tape && Tape_Sampled() )
+		tapeEdges = true;
+
+	// Loaders time the edges with the CPU, only the traps load with turbo
+	if( tape && tapeEdges && turbo > 1 )
+	{
+		printf( "-turbo can't play a tape's edges\n" );
+		return 1;
+	}
+
+	if( tape && tapeEdges )
+		Tape_Play( &M );
+
+	if( playMovie )
+	{
+		if( !Movie_Play( &M, playMovie ) )
+		{
+			printf( "Could not play movie %s\n", playMovie );
+			return 1;
+		}
+
+		if( headless )
+		{
+			int result = PlayHeadless( &M );
+			ThreadPool_Shutdown();
+			return result;
+		}
+	}
+	else if( recordMovie )
+	{
+		Movie_Record( &M );
+	}
+
+	if( rewindMB > 0 )
+		Rewind_Init( REWIND_INTERVAL, REWIND_KEYFRAME_INTERVAL, (size_t)rewindMB << 20 );
 
 	while( Screen_Continue() )
 	{
-		Screen_PollInput( &s_keyState );
-		int scanline = 0;
+		// Keys still work the UI during playback, the machine only sees the movie
+		SpeccyKeyState keyState;
+		Screen_PollInput( playMovie ? &keyState : &M.keyState );
+
+		// A movie only has the keyboard, so the tape is left to run as it was recorded
+		if( tape && !playMovie && !recordMovie )
+		{
+			if( Screen_TapePlayPressed() )
+			{
+				if( Tape_Playing() )
+					Tape_Stop( &M );
+				else if( turbo == 1 )
+					Tape_Play( &M );
+				printf( "Tape %s at block %d of %d\n", Tape_Playing() ? "playing" : "stopped", Tape_CurrentBlock() + 1, Tape_BlockCount() );
+			}
+			if( Screen_TapeRewindPressed() )
+			{
+				Tape_Rewind();
+				printf( "Tape rewound\n" );
+			}
+		}
+
+		// Loading from edges is exact at any speed, so warp through it
+		if( tape && Tape_Loading( &M ) != tapeWarp )
+		{
+			tapeWarp = !tapeWarp;
+			Pacing_SetMode( tapeWarp ? PACE_WARP_SKIP : paceMode, tapeWarp ? TAPE_WARP_SKIP : paceFactor );
+		}
+
+		const bool render = Pacing_RenderFrame();
+
+		// Only heard at normal speed, otherwise the speaker isn't even logged
+		M.beeper = ( audio && ( Pacing_GetMode() == PACE_REALTIME || Pacing_GetMode() == PACE_AUDIO ) ) ? &s_beeper : NULL;
+
+		// Step back, the frame run below shows the rewound position
+		if( rewindMB > 0 && Screen_RewindHeld() && M.frameCount > REWIND_STEP )
+		{
+			SpeccyKeyState keyState = M.keyState;
+			Rewind_Seek( &M, M.frameCount - ( REWIND_STEP + 1 ) );
+			M.keyState = keyState;
+		}
 
-		for( int scanline = 0; scanline < SCREEN_HEIGHT + VBLANK_HEIGHT; scanline++ )
+		if( runAhead > 0 )
 		{
-			Screen_UpdateScanline( frame, scanline, ram, s_ula & 0x7 );
-			Z80_Run( &Z, 224 );
+			Machine_RunFrame( &M, NULL, NULL );
+			if( rewindMB > 0 )
+				Rewind_Capture( &M );
+			RunAhead( &M, runAhead, render );
 		}
-		frame++;
-		Screen_UpdateFrame();
-		Z80_MaskableInterrupt( &Z );
+		else
+		{
+			Machine_RunFrame( &M, render ? RenderLine : NULL, NULL );
+			if( rewindMB > 0 )
+				Rewind_Capture( &M );
+		}
+
+		if( M.beeper )
+			Audio_EndFrame( M.beeper, M.ay );
+
+		if( audio && audioStats && M.frameCount % AUDIO_REPORT == 0 )
+		{
+			AudioStats stats;
+			Audio_GetStats( &stats );
+			printf( "Audio: queued %u (%u-%u, target %u), rate %+.3f%%, %u overrun, %u underrun, waited %ums\n", stats.queued,
+				stats.queuedMin, stats.queuedMax, stats.target, stats.adjust * 100, stats.overruns, stats.underruns, stats.waitMs );
+		}
+
+		if( render )
+		{
+			Screen_UpdateFrame();
+
+			// Repeated frames are left out, the gaps in the numbering give their duration
+			if( capturePrefix && Screen_FrameChanged() )
+			{
+				char name[1024];
+				snprintf( name, sizeof( name ), "%s%06u.ppm", capturePrefix, M.frameCount );
+				Screen_CaptureFrame( name );
+			}
+		}
+		if( playMovie && M.frameCount == Movie_EndFrame() )
+		{
+			printf( "Movie finished, final state %s\n", Movie_Verify( &M ) ? "matches" : "DOES NOT MATCH" );
+			M.InputHook = NULL;
+			playMovie = NULL;
+		}
+
+		if( stateFile && M.frameCount % STATE_AUTOSAVE_FRAMES == 0 && StateFile_Save( &M ) < 0 )
+			printf( "Could not save state file %s\n", stateFile );
+
+		Pacing_EndFrame();
 	}
 
+	if( recordMovie && !Movie_StopRecord( &M, recordMovie ) )
+		printf( "Could not write movie %s\n", recordMovie );
+
+	if( stateFile )
+		StateFile_Close( &M );
+
+	if( tape )
+		Tape_Close();
+
+	if( rewindMB > 0 )
+		Rewind_Shutdown();
+
+	if( audio )
+		Audio_Shutdown();
+
 	Screen_Shutdown();
+	ThreadPool_Shutdown();
 
 	return 0;
 }
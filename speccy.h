@@ -12,6 +12,10 @@
 
 #define SCREEN_HEIGHT ( TOP_BORDER_HEIGHT + PIXEL_HEIGHT + BOTTOM_BORDER_HEIGHT )
 
+#define CPU_CLOCK_HZ 3500000
+#define TSTATES_PER_LINE 224
+#define FRAME_TSTATES ( TSTATES_PER_LINE * ( VBLANK_HEIGHT + SCREEN_HEIGHT ) )
+
 
 enum SpeccyKey
 {
@@ -30,6 +34,59 @@ struct SpeccyKeyState
 	uint8_t row[8];
 };
 
+#define BORDER_LOG_SIZE 8192
+#define BORDER_LOG_MASK ( BORDER_LOG_SIZE - 1 )
+
+// Border colour changes for the current frame, in T-states from the start of the frame.
+// head is advanced by the ULA, tail by the renderer as it completes each line.
+struct BorderEvent
+{
+	uint32_t tstate;
+	uint8_t color;
+};
+
+struct BorderLog
+{
+	uint32_t head;
+	uint32_t tail;
+	uint8_t color;
+	BorderEvent event[BORDER_LOG_SIZE];
+};
+
+#define BEEPER_LOG_SIZE 8192
+#define BEEPER_LOG_MASK ( BEEPER_LOG_SIZE - 1 )
+
+// Speaker bit changes for the current frame, in T-states from the start of the frame.
+// level is the speaker bit as the frame started, each change flips it.
+struct BeeperLog
+{
+	uint32_t head;
+	uint8_t level;
+	uint32_t tstate[BEEPER_LOG_SIZE];
+};
+
+#define AY_LOG_SIZE 4096
+#define AY_LOG_MASK ( AY_LOG_SIZE - 1 )
+
+struct AYWrite
+{
+	uint32_t tstate;
+	uint8_t reg;
+	uint8_t value;
+};
+
+// The 128K's sound chip as the machine sees it. reg holds the registers as written and
+// start as they were when the frame started, and the frame's writes are logged with
+// their T-state so the sound can be made afterwards.
+struct AYRegisters
+{
+	uint8_t selected;
+	uint8_t reg[16];
+	uint8_t start[16];
+	uint32_t head;
+	AYWrite write[AY_LOG_SIZE];
+};
+
 #define SK_ROW(sk) ((sk) / 5)
 #define SK_BIT(sk) ((sk) % 5)
 #define SK_MASK(sk) (1 << SK_BIT((sk)))
@@ -0,0 +1,147 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stddef.h>
+
+#include "statefile.h"
+
+#define STATE_HEADER_SIZE offsetof( MachineState, ram )
+
+static_assert( STATE_HEADER_SIZE <= STATE_FILE_RAM_OFFSET, "State header must fit before the RAM" );
+
+static int s_fd = -1;
+static uint8_t *s_map;
+static bool s_dirty[MACHINE_RAM_PAGES];
+
+static bool WriteAll( int fd, const void *data, size_t size, off_t offset )
+{
+	return pwrite( fd, data, size, offset ) == (ssize_t)size;
+}
+
+static bool WriteHeader( int fd, const Machine *M )
+{
+	uint8_t header[STATE_FILE_RAM_OFFSET];
+	memset( header, 0, sizeof( header ) );
+	Machine_SaveRegisters( M, (MachineState *)header );
+
+	return WriteAll( fd, header, sizeof( header ), 0 );
+}
+
+// First write to a page since the last save, note it and let writes through
+static uint8_t *DirtyFault( ZState *Z, uint16_t address )
+{
+	int index = ( address >> Z_PAGE_SHIFT ) - MACHINE_RAM_PAGE;
+	if( index < 0 )
+		return NULL;	// ROM
+
+	s_dirty[index] = true;
+
+	ZPage *page = &Z->page[address >> Z_PAGE_SHIFT];
+	page->write = (uint8_t *)page->read;
+	return page->write;
+}
+
+static void ProtectPages( Machine *M )
+{
+	for( int i = 0; i < MACHINE_RAM_PAGES; i++ )
+	{
+		M->Z.page[MACHINE_RAM_PAGE + i].write = NULL;
+		s_dirty[i] = false;
+	}
+}
+
+bool StateFile_Write( const Machine *M, const char *name )
+{
+	int fd = open( name, O_WRONLY | O_CREAT | O_EXCL, 0644 );
+	if( fd < 0 )
+		return false;
+
+	bool ok = WriteHeader( fd, M );
+	for( int i = 0; ok && i < MACHINE_RAM_PAGES; i++ )
+		ok = WriteAll( fd, M->Z.page[MACHINE_RAM_PAGE + i].read, Z_PAGE_SIZE, STATE_FILE_RAM_OFFSET + i * Z_PAGE_SIZE );
+
+	close( fd );
+	return ok;
+}
+
+bool StateFile_Map( Machine *M, uint8_t *rom, const char *name )
+{
+	if( s_fd >= 0 )
+		return false;
+
+	int fd = open( name, O_RDWR );
+	if( fd < 0 )
+		return false;
+
+	struct stat st;
+	if( fstat( fd, &st ) < 0 || st.st_size != STATE_FILE_SIZE )
+	{
+		close( fd );
+		return false;
+	}
+
+	// Private, so RAM writes stay in memory until they are saved
+	void *ptr = mmap( NULL, STATE_FILE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0 );
+	if( ptr == MAP_FAILED )
+	{
+		close( fd );
+		return false;
+	}
+
+	uint8_t *map = (uint8_t *)ptr;
+	Machine_Init( M, rom, map + STATE_FILE_RAM_OFFSET );
+	if( !Machine_RestoreRegisters( M, (const MachineState *)map ) )
+	{
+		munmap( ptr, STATE_FILE_SIZE );
+		close( fd );
+		return false;
+	}
+
+	s_fd = fd;
+	s_map = map;
+
+	M->Z.WriteFault = DirtyFault;
+	ProtectPages( M );
+
+	return true;
+}
+
+int StateFile_Save( Machine *M )
+{
+	if( s_fd < 0 )
+		return -1;
+
+	int written = 0;
+	for( int i = 0; i < MACHINE_RAM_PAGES; i++ )
+	{
+		if( !s_dirty[i] )
+			continue;
+
+		if( !WriteAll( s_fd, M->ram + i * Z_PAGE_SIZE, Z_PAGE_SIZE, STATE_FILE_RAM_OFFSET + i * Z_PAGE_SIZE ) )
+			return -1;
+		written++;
+	}
+
+	if( !WriteHeader( s_fd, M ) )
+		return -1;
+
+	ProtectPages( M );
+	return written;
+}
+
+void StateFile_Close( Machine *M )
+{
+	if( s_fd < 0 )
+		return;
+
+	StateFile_Save( M );
+
+	munmap( s_map, STATE_FILE_SIZE );
+	close( s_fd );
+	s_fd = -1;
+	s_map = NULL;
+
+	M->ram = NULL;
+	M->Z.WriteFault = NULL;
+}
@@ -0,0 +1,24 @@
+#if !defined( STATEFILE_H )
+#define STATEFILE_H 1
+
+#include "machine.h"
+
+// A state file is the register part of a MachineState padded out to a page,
+// followed by the RAM image, so it can be mapped and run without parsing.
+#define STATE_FILE_RAM_OFFSET 4096
+#define STATE_FILE_SIZE ( STATE_FILE_RAM_OFFSET + MACHINE_RAM_SIZE )
+
+// Creates a new file, an existing one is never replaced
+bool StateFile_Write( const Machine *M, const char *name );
+
+// Initialises M with its RAM mapped privately from the file, pages are read in
+// as they are touched. Only one state file is mapped at a time.
+bool StateFile_Map( Machine *M, uint8_t *rom, const char *name );
+
+// Writes the header and the RAM pages written since the last save, returns the
+// number of pages written or -1 on error
+int StateFile_Save( Machine *M );
+
+void StateFile_Close( Machine *M );
+
+#endif // STATEFILE_H
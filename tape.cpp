@@ -0,0 +1,488 @@
+#include <string.h>
+
+#include <vector>
+
+#include "tape.h"
+#include "machine.h"
+#include "mapfile.h"
+#include "tapestream.h"
+
+#define TZX_SIGNATURE "ZXTape!\x1a"
+#define TZX_HEADER_SIZE 10
+
+#define TZX_STANDARD 0x10
+#define TZX_TURBO 0x11
+#define TZX_PURE_DATA 0x14
+
+// A loader counts as running if it was last seen sampling within this many T-states
+#define LOADING_WINDOW ( FRAME_TSTATES * 2 )
+
+static MappedFile s_file;
+static std::vector<TapeBlock> s_blocks;
+static int s_current;
+
+static TapeFormat s_format;
+static bool s_playing;
+static int s_block;
+static uint8_t s_level;
+static uint64_t s_segmentEnd;
+static uint64_t s_lastLoop;
+
+static uint32_t Read16( const uint8_t *p )
+{
+	return p[0] | ( p[1] << 8 );
+}
+
+static uint32_t Read24( const uint8_t *p )
+{
+	return p[0] | ( p[1] << 8 ) | ( p[2] << 16 );
+}
+
+static uint32_t Read32( const uint8_t *p )
+{
+	return p[0] | ( p[1] << 8 ) | ( p[2] << 16 ) | ( (uint32_t)p[3] << 24 );
+}
+
+static void AddBlock( uint8_t id, const uint8_t *body, const uint8_t *data, uint32_t dataSize )
+{
+	TapeBlock block;
+	block.id = id;
+	block.body = body;
+	block.data = data;
+	block.dataSize = dataSize;
+	s_blocks.push_back( block );
+}
+
+static bool ParseTAP( const uint8_t *data, size_t size )
+{
+	size_t offset = 0;
+	while( offset + 2 <= size )
+	{
+		uint32_t length = Read16( data + offset );
+		offset += 2;
+		if( length > size - offset )
+			return false;
+
+		AddBlock( TZX_STANDARD, NULL, data + offset, length );
+		offset += length;
+	}
+
+	return offset == size;
+}
+
+// Size of a TZX block after its ID, false if it runs past the end
+static bool TZXBlockSize( uint8_t id, const uint8_t *body, size_t avail, size_t *blockSize )
+{
+	size_t fixed;
+	switch( id )
+	{
+	case 0x10: fixed = 4; break;
+	case 0x11: fixed = 18; break;
+	case 0x12: fixed = 4; break;
+	case 0x13: fixed = 1; break;
+	case 0x14: fixed = 10; break;
+	case 0x15: fixed = 8; break;
+	case 0x20: case 0x23: case 0x24: fixed = 2; break;
+	case 0x21: case 0x30: case 0x33: fixed = 1; break;
+	case 0x22: case 0x25: case 0x27: fixed = 0; break;
+	case 0x26: case 0x28: case 0x31: case 0x32: fixed = 2; break;
+	case 0x2a: fixed = 4; break;
+	case 0x2b: fixed = 5; break;
+	case 0x35: fixed = 20; break;
+	case 0x5a: fixed = 9; break;
+	default: fixed = 4; break;	// Everything else, 0x18 and 0x19 included, starts with a 32-bit length
+	}
+
+	if( fixed > avail )
+		return false;
+
+	size_t size;
+	switch( id )
+	{
+	case 0x10: size = fixed + Read16( body + 2 ); break;
+	case 0x11: size = fixed + Read24( body + 15 ); break;
+	case 0x13: size = fixed + body[0] * 2; break;
+	case 0x14: size = fixed + Read24( body + 7 ); break;
+	case 0x15: size = fixed + Read24( body + 5 ); break;
+	case 0x21: case 0x30: size = fixed + body[0]; break;
+	case 0x26: size = fixed + Read16( body ) * 2; break;
+	case 0x28: case 0x32: size = fixed + Read16( body ); break;
+	case 0x31: size = fixed + body[1]; break;
+	case 0x33: size = fixed + body[0] * 3; break;
+	case 0x35: size = fixed + Read32( body + 16 ); break;
+	case 0x12: case 0x20: case 0x22: case 0x23: case 0x24: case 0x25: case 0x27: case 0x2a: case 0x2b: case 0x5a:
+		size = fixed;
+		break;
+	default: size = fixed + Read32( body ); break;
+	}
+
+	*blockSize = size;
+	return size <= avail;
+}
+
+static bool ParseTZX( const uint8_t *data, size_t size )
+{
+	if( size < TZX_HEADER_SIZE || memcmp( data, TZX_SIGNATURE, 8 ) != 0 )
+		return false;
+
+	size_t offset = TZX_HEADER_SIZE;
+	while( offset < size )
+	{
+		uint8_t id = data[offset++];
+		const uint8_t *body = data + offset;
+
+		size_t blockSize;
+		if( !TZXBlockSize( id, body, size - offset, &blockSize ) )
+			return false;
+
+		switch( id )
+		{
+		case TZX_STANDARD:
+			AddBlock( id, body, body + 4, Read16( body + 2 ) );
+			break;
+		case TZX_TURBO:
+			AddBlock( id, body, body + 18, Read24( body + 15 ) );
+			break;
+		case TZX_PURE_DATA:
+			AddBlock( id, body, body + 10, Read24( body + 7 ) );
+			break;
+		default:
+			AddBlock( id, body, NULL, 0 );
+			break;
+		}
+
+		offset += blockSize;
+	}
+
+	return true;
+}
+
+// The edge sampling loop of LD-SAMPLE in the ROM, which most custom loaders copy:
+//   loop: INC B / RET Z / LD A,n / IN A,(n) / RRA / [RET NC] / XOR C / AND n / JR Z,loop
+// Called with PC just past the IN, returns the T-states an iteration takes or 0.
+static int MatchSampleLoop( ZState *Z, uint8_t *mask, bool *retNC )
+{
+	const uint16_t start = Z->reg.PC - 6;
+	if( Z80_ReadMemory( Z, start ) != 0x04 || Z80_ReadMemory( Z, start + 1 ) != 0xc8 ||
+		Z80_ReadMemory( Z, start + 2 ) != 0x3e || Z80_ReadMemory( Z, start + 4 ) != 0xdb )
+		return 0;
+
+	int period = 4 + 5 + 7 + 11 + 4 + 4 + 7 + 12;
+	uint16_t pc = Z->reg.PC;
+
+	if( Z80_ReadMemory( Z, pc++ ) != 0x1f )
+		return 0;
+
+	*retNC = Z80_ReadMemory( Z, pc ) == 0xd0;
+	if( *retNC )
+	{
+		pc++;
+		period += 5;
+	}
+
+	if( Z80_ReadMemory( Z, pc++ ) != 0xa9 || Z80_ReadMemory( Z, pc++ ) != 0xe6 )
+		return 0;
+
+	*mask = Z80_ReadMemory( Z, pc++ );
+
+	if( Z80_ReadMemory( Z, pc++ ) != 0x28 )
+		return 0;
+
+	int8_t disp = (int8_t)Z80_ReadMemory( Z, pc++ );
+	if( (uint16_t)( pc + disp ) != start )
+		return 0;
+
+	return period;
+}
+
+// In a sampling loop that will keep going round until the next edge, skips the
+// iterations in between. Only B, carry and time change over them, and the sample
+// they end on reads the same value as this one.
+static void Accelerate( Machine *M, uint8_t value, uint64_t now )
+{
+	ZState *Z = &M->Z;
+
+	// An interrupt could come in between
+	if( Z->IFF0 )
+		return;
+
+	uint8_t mask;
+	bool retNC;
+	int period = MatchSampleLoop( Z, &mask, &retNC );
+	if( period == 0 )
+		return;
+
+	s_lastLoop = now;
+
+	// This iteration carries in the current carry, the rest a clear one from the AND
+	const uint8_t carry = Z->reg.F & M_C;
+	if( retNC && ( value & 1 ) == 0 )
+		return;
+	if( ( ( ( value >> 1 ) | ( carry << 7 ) ) ^ Z->reg.C ) & mask )
+		return;
+	if( ( ( value >> 1 ) ^ Z->reg.C ) & mask )
+		return;
+
+	// Samples before the edge, before INC B wraps, and before the frame ends
+	uint64_t skip = ( s_segmentEnd - now - 1 ) / period;
+	uint64_t toWrap = 255 - Z->reg.B;
+	uint32_t frameTState = Machine_FrameTState( M );
+	uint64_t toFrameEnd = frameTState < FRAME_TSTATES ? ( FRAME_TSTATES - frameTState ) / period : 0;
+
+	if( skip > toWrap )
+		skip = toWrap;
+	if( skip > toFrameEnd )
+		skip = toFrameEnd;
+	if( skip == 0 )
+		return;
+
+	Z->reg.B += (uint8_t)skip;
+	Z->reg.F &= ~M_C;
+	Z->cycles -= (int)( skip * period );
+}
+
+static bool LoadBytesTrap( Machine *M );
+
+// Back to the traps, so the rest of the tape still loads if it isn't played again
+static void Stopped( Machine *M )
+{
+	TapeStream_Stop();
+	s_playing = false;
+	s_level = 0;
+
+	M->EarHook = NULL;
+	if( !Tape_Sampled() )
+		Machine_SetTrap( TAPE_LD_BYTES, LoadBytesTrap );
+}
+
+static uint8_t EarHook( Machine *M, uint8_t value )
+{
+	if( !s_playing )
+		return value;
+
+	uint64_t now = Machine_Time( M );
+	while( now >= s_segmentEnd )
+	{
+		TapeSegment segment;
+		if( !TapeStream_Next( &segment ) )
+		{
+			s_current = segment.block;
+			Stopped( M );
+			return value;
+		}
+
+		s_level = segment.level;
+		s_segmentEnd += segment.length;
+		s_block = segment.block;
+	}
+
+	value |= s_level << 6;
+	Accelerate( M, value, now );
+
+	return value;
+}
+
+// F after a XOR that leaves v in A
+static uint8_t LogicFlags( uint8_t v )
+{
+	uint8_t p = v ^ ( v >> 4 );
+	uint8_t f = ( v & ( M_S | M_3 | M_5 ) ) | ( ( ( ~0x6996 >> ( p & 0xf ) ) << F_P ) & M_P );
+	return v == 0 ? f | M_Z : f;
+}
+
+// F after CP 1 with v in A, carry is set only for zero
+static uint8_t CompareOneFlags( uint8_t v )
+{
+	uint8_t r = v - 1;
+	uint8_t f = ( r & M_S ) | M_N;
+	if( r == 0 )
+		f |= M_Z;
+	if( ( v & 0xf ) == 0 )
+		f |= M_H;
+	if( v == 0x80 )
+		f |= M_V;
+	if( v == 0 )
+		f |= M_C;
+	return f;
+}
+
+// LD-BYTES with A the expected flag, IX the destination, DE the length and carry
+// set to load or clear to verify. Takes the next data block and leaves through
+// SA/LD-RET with the registers as the ROM would, A and F included for loaders that
+// call it and test them.
+static bool LoadBytesTrap( Machine *M )
+{
+	if( !Machine_BasicRomPaged( M ) )
+		return false;
+
+	while( s_current < (int)s_blocks.size() && s_blocks[s_current].dataSize == 0 )
+		s_current++;
+
+	// Nothing left, let the ROM wait for a signal as it would with the tape stopped
+	if( s_current == (int)s_blocks.size() )
+		return false;
+
+	const TapeBlock *block = &s_blocks[s_current++];
+	ZState *Z = &M->Z;
+
+	const bool load = ( Z->reg.F & M_C ) != 0;
+	const uint8_t *data = block->data + 1;
+	const uint32_t available = block->dataSize - 1;
+
+	uint8_t parity = block->data[0];
+
+	// LD-FLAG, XOR L : RET NZ
+	if( parity != Z->reg.A )
+	{
+		Z->reg.A ^= parity;
+		Z->reg.F = LogicFlags( Z->reg.A );
+		Z->reg.H = parity;
+		Z->reg.PC = TAPE_SA_LD_RET;
+		return true;
+	}
+
+	uint32_t count = Z->reg.DE < available ? Z->reg.DE : available;
+	uint32_t i;
+	uint8_t difference = 0;
+
+	// Each byte is in the parity before it is stored or checked
+	for( i = 0; i < count; i++ )
+	{
+		uint16_t address = Z->reg.IX + i;
+		parity ^= data[i];
+		if( load )
+			Z80_WriteMemory( Z, address, data[i] );
+		else if( ( difference = Z80_ReadMemory( Z, address ) ^ data[i] ) != 0 )
+			break;
+	}
+
+	Z->reg.IX += i;
+	Z->reg.DE -= i;
+	Z->reg.H = parity;
+
+	if( difference != 0 )
+	{
+		// LD-VERIFY, XOR L : RET NZ
+		Z->reg.A = difference;
+		Z->reg.F = LogicFlags( difference );
+	}
+	else if( available == count )
+	{
+		// No checksum, the ROM gives up waiting for an edge with B counted round to zero
+		Z->reg.A = 0;
+		Z->reg.F = M_Z | M_H;
+	}
+	else
+	{
+		// The byte after the data is the checksum, bringing the parity to zero.
+		// LD A,H : CP 1 sets carry only then.
+		parity ^= data[count];
+		Z->reg.H = parity;
+		Z->reg.A = parity;
+		Z->reg.F = CompareOneFlags( parity );
+	}
+	Z->reg.PC = TAPE_SA_LD_RET;
+
+	return true;
+}
+
+bool Tape_Open( const char *name )
+{
+	Tape_Close();
+
+	if( !MapFile_Open( &s_file, name ) )
+		return false;
+
+	bool ok = true;
+	s_format = TapeStream_Detect( s_file.data, s_file.size );
+	if( s_format == TAPE_FORMAT_TZX )
+		ok = ParseTZX( s_file.data, s_file.size );
+	else if( s_format == TAPE_FORMAT_TAP )
+		ok = ParseTAP( s_file.data, s_file.size );
+
+	if( !ok )
+	{
+		Tape_Close();
+		return false;
+	}
+
+	s_current = 0;
+	if( !Tape_Sampled() )
+		Machine_SetTrap( TAPE_LD_BYTES, LoadBytesTrap );
+
+	return true;
+}
+
+void Tape_Close()
+{
+	Machine_SetTrap( TAPE_LD_BYTES, NULL );
+	TapeStream_Stop();
+
+	s_blocks.clear();
+	s_current = 0;
+	s_playing = false;
+	MapFile_Close( &s_file );
+}
+
+bool Tape_Sampled()
+{
+	return s_format == TAPE_FORMAT_WAV || s_format == TAPE_FORMAT_CSW;
+}
+
+static void StartStream()
+{
+	TapeStream_Start( s_format, s_file.data, s_file.size, s_blocks.data(), (int)s_blocks.size(), s_current );
+	s_block = s_current;
+}
+
+void Tape_Play( Machine *M )
+{
+	if( s_playing )
+		return;
+
+	Machine_SetTrap( TAPE_LD_BYTES, NULL );
+	StartStream();
+
+	s_level = 0;
+	s_segmentEnd = Machine_Time( M );
+	s_lastLoop = 0;
+	s_playing = true;
+
+	M->EarHook = EarHook;
+}
+
+void Tape_Stop( Machine *M )
+{
+	if( !s_playing )
+		return;
+
+	s_current = s_block;
+	Stopped( M );
+}
+
+bool Tape_Playing()
+{
+	return s_playing;
+}
+
+bool Tape_Loading( const Machine *M )
+{
+	return s_playing && s_lastLoop > 0 && Machine_Time( M ) - s_lastLoop < LOADING_WINDOW;
+}
+
+void Tape_Rewind()
+{
+	s_current = 0;
+	if( s_playing )
+		StartStream();
+}
+
+int Tape_BlockCount()
+{
+	return (int)s_blocks.size();
+}
+
+int Tape_CurrentBlock()
+{
+	return s_playing ? s_block : s_current;
+}
@@ -0,0 +1,36 @@
+#if !defined( TAPE_H )
+#define TAPE_H 1
+
+#include <stdint.h>
+
+struct Machine;
+
+// ROM tape loader entry and the exit that restores the border and returns
+#define TAPE_LD_BYTES 0x0556
+#define TAPE_SA_LD_RET 0x053f
+
+// Opens a .tap, .tzx, .wav or .csw, the format is taken from the contents. While a
+// .tap or .tzx is open LD-BYTES is trapped and each call is given the next data block
+// at once. WAV and CSW recordings have no blocks and can only be played.
+bool Tape_Open( const char *name );
+void Tape_Close();
+bool Tape_Sampled();
+
+// Plays the tape from the current block as pulses on the EAR input, in place of the
+// LD-BYTES trap, for loaders the trap can't handle. The file is decoded on a thread
+// a fixed distance ahead, so playing takes the same memory whatever the tape's size.
+// Edge sampling loops shaped like the ROM's are skipped ahead to the next edge.
+// Playing stops at the end of the tape or a block that stops it, and the trap takes
+// over again until the tape is played once more.
+void Tape_Play( Machine *M );
+void Tape_Stop( Machine *M );
+bool Tape_Playing();
+
+// Whether a loader has recently been seen sampling the tape
+bool Tape_Loading( const Machine *M );
+
+void Tape_Rewind();
+int Tape_BlockCount();
+int Tape_CurrentBlock();
+
+#endif // TAPE_H
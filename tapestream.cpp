@@ -0,0 +1,738 @@
+#include <string.h>
+#include <zlib.h>
+
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+#include "tapestream.h"
+#include "speccy.h"
+
+#define TZX_SIGNATURE "ZXTape!\x1a"
+
+#define TZX_STANDARD 0x10
+#define TZX_TURBO 0x11
+#define TZX_PURE_TONE 0x12
+#define TZX_PULSES 0x13
+#define TZX_PURE_DATA 0x14
+#define TZX_DIRECT 0x15
+#define TZX_PAUSE 0x20
+#define TZX_LOOP_START 0x24
+#define TZX_LOOP_END 0x25
+#define TZX_STOP_48K 0x2a
+
+// ROM saving timings
+#define PILOT_PULSE 2168
+#define PILOT_HEADER 8063
+#define PILOT_DATA 3223
+#define SYNC1_PULSE 667
+#define SYNC2_PULSE 735
+#define ZERO_PULSE 855
+#define ONE_PULSE 1710
+#define TAP_PAUSE_MS 1000
+
+#define TSTATES_PER_MS ( CPU_CLOCK_HZ / 1000 )
+
+#define WAV_HEADER_SIZE 12
+#define WAV_CHUNK_HEADER_SIZE 8
+#define WAV_FMT_SIZE 16
+#define WAV_PCM 1
+
+// Samples within this of the centre keep the level they had, out of 128
+#define WAV_HYSTERESIS 4
+
+#define CSW_SIGNATURE "Compressed Square Wave\x1a"
+#define CSW_SIGNATURE_SIZE 23
+#define CSW_V1_HEADER_SIZE 0x20
+#define CSW_V2_HEADER_SIZE 0x34
+#define CSW_RLE 1
+#define CSW_Z_RLE 2
+#define CSW_BUFFER_SIZE 4096
+
+// Segments decoded ahead of the emulation, a power of two
+#define TAPE_RING_SIZE 8192
+#define TAPE_FULL_SLEEP_MS 1
+
+enum PulseStage
+{
+	STAGE_BLOCK,
+	STAGE_PILOT,
+	STAGE_SYNC1,
+	STAGE_SYNC2,
+	STAGE_DATA,
+	STAGE_PULSES,
+	STAGE_DIRECT,
+	STAGE_PAUSE,
+};
+
+// Turns .tap and .tzx blocks into a stream of level segments
+struct PulseDecoder
+{
+	const TapeBlock *blocks;
+	int blockCount;
+
+	int block;
+	PulseStage stage;
+	uint8_t level;
+
+	uint32_t pilot;
+	uint32_t pilotCount;
+	uint32_t sync1;
+	uint32_t sync2;
+	uint32_t zero;
+	uint32_t one;
+	uint32_t usedBits;
+	uint32_t pause;
+
+	const uint8_t *data;
+	uint32_t dataSize;
+
+	uint32_t count;
+	uint32_t bit;
+	uint32_t pulse;
+
+	int loopStart;
+	uint32_t loopCount;
+};
+
+// Sample times are kept in 16.16 fixed point T-states
+struct SampleClock
+{
+	uint64_t step;
+	uint64_t time;
+	uint64_t emitted;
+};
+
+struct WavInfo
+{
+	const uint8_t *samples;
+	size_t size;
+	uint32_t rate;
+	uint32_t frameBytes;
+	uint32_t bits;
+};
+
+struct WavReader
+{
+	const uint8_t *p;
+	const uint8_t *end;
+	uint32_t frameBytes;
+	bool wide;
+	uint8_t level;
+	SampleClock clock;
+};
+
+struct CswInfo
+{
+	const uint8_t *pulses;
+	size_t size;
+	uint32_t rate;
+	bool compressed;
+	uint8_t level;
+};
+
+struct CswReader
+{
+	const uint8_t *p;
+	const uint8_t *end;
+	bool compressed;
+	bool finished;
+	z_stream stream;
+	uint8_t buffer[CSW_BUFFER_SIZE];
+	uint32_t bufferSize;
+	uint32_t bufferOffset;
+	uint8_t level;
+	SampleClock clock;
+};
+
+// Owned by the decoding thread while it runs
+static TapeFormat s_format;
+static PulseDecoder s_pulses;
+static WavReader s_wav;
+static CswReader s_csw;
+
+static TapeSegment s_ring[TAPE_RING_SIZE];
+static std::atomic<uint32_t> s_head( 0 );
+static std::atomic<uint32_t> s_tail( 0 );
+static std::atomic<bool> s_done( false );
+static std::atomic<bool> s_quit( false );
+static int s_endBlock;
+static std::thread s_thread;
+
+static uint32_t Read16( const uint8_t *p )
+{
+	return p[0] | ( p[1] << 8 );
+}
+
+static uint32_t Read24( const uint8_t *p )
+{
+	return p[0] | ( p[1] << 8 ) | ( p[2] << 16 );
+}
+
+static uint32_t Read32( const uint8_t *p )
+{
+	return p[0] | ( p[1] << 8 ) | ( p[2] << 16 ) | ( (uint32_t)p[3] << 24 );
+}
+
+static bool ParseWAV( const uint8_t *data, size_t size, WavInfo *info )
+{
+	if( size < WAV_HEADER_SIZE || memcmp( data, "RIFF", 4 ) != 0 || memcmp( data + 8, "WAVE", 4 ) != 0 )
+		return false;
+
+	bool format = false;
+	size_t offset = WAV_HEADER_SIZE;
+	while( offset + WAV_CHUNK_HEADER_SIZE <= size )
+	{
+		const uint8_t *header = data + offset;
+		const uint8_t *chunk = header + WAV_CHUNK_HEADER_SIZE;
+		offset += WAV_CHUNK_HEADER_SIZE;
+
+		// Recordings cut short often still claim their full length
+		size_t chunkSize = Read32( header + 4 );
+		if( chunkSize > size - offset )
+			chunkSize = size - offset;
+
+		if( memcmp( header, "fmt ", 4 ) == 0 )
+		{
+			if( chunkSize < WAV_FMT_SIZE )
+				return false;
+
+			uint32_t channels = Read16( chunk + 2 );
+			info->rate = Read32( chunk + 4 );
+			info->frameBytes = Read16( chunk + 12 );
+			info->bits = Read16( chunk + 14 );
+
+			format = Read16( chunk ) == WAV_PCM && channels > 0 && info->rate > 0 &&
+				( info->bits == 8 || info->bits == 16 ) && info->frameBytes == channels * info->bits / 8;
+			if( !format )
+				return false;
+		}
+		else if( memcmp( header, "data", 4 ) == 0 )
+		{
+			if( !format )
+				return false;
+
+			info->samples = chunk;
+			info->size = chunkSize - chunkSize % info->frameBytes;
+			return true;
+		}
+
+		offset += chunkSize + ( chunkSize & 1 );
+	}
+
+	return false;
+}
+
+static bool ParseCSW( const uint8_t *data, size_t size, CswInfo *info )
+{
+	if( size < CSW_V1_HEADER_SIZE || memcmp( data, CSW_SIGNATURE, CSW_SIGNATURE_SIZE ) != 0 )
+		return false;
+
+	uint8_t compression;
+	uint8_t flags;
+	size_t offset;
+
+	switch( data[0x17] )
+	{
+	case 1:
+		info->rate = Read16( data + 0x19 );
+		compression = data[0x1b];
+		flags = data[0x1c];
+		offset = CSW_V1_HEADER_SIZE;
+		break;
+
+	case 2:
+		if( size < CSW_V2_HEADER_SIZE )
+			return false;
+		info->rate = Read32( data + 0x19 );
+		compression = data[0x21];
+		flags = data[0x22];
+		offset = CSW_V2_HEADER_SIZE + data[0x23];
+		break;
+
+	default:
+		return false;
+	}
+
+	// Z-RLE only exists from version 2
+	if( offset > size || info->rate == 0 || ( compression != CSW_RLE && !( compression == CSW_Z_RLE && data[0x17] == 2 ) ) )
+		return false;
+
+	info->pulses = data + offset;
+	info->size = size - offset;
+	info->compressed = compression == CSW_Z_RLE;
+	info->level = flags & 1;
+	return true;
+}
+
+TapeFormat TapeStream_Detect( const uint8_t *data, size_t size )
+{
+	WavInfo wav;
+	CswInfo csw;
+
+	if( size >= 8 && memcmp( data, TZX_SIGNATURE, 8 ) == 0 )
+		return TAPE_FORMAT_TZX;
+	if( ParseWAV( data, size, &wav ) )
+		return TAPE_FORMAT_WAV;
+	if( ParseCSW( data, size, &csw ) )
+		return TAPE_FORMAT_CSW;
+
+	return TAPE_FORMAT_TAP;
+}
+
+static void StartClock( SampleClock *clock, uint32_t rate )
+{
+	clock->step = ( (uint64_t)CPU_CLOCK_HZ << 16 ) / rate;
+	clock->time = 0;
+	clock->emitted = 0;
+}
+
+// Whole T-states since the last segment, the fractions carry over
+static uint32_t ClockSegment( SampleClock *clock )
+{
+	uint32_t length = (uint32_t)( ( clock->time >> 16 ) - clock->emitted );
+	clock->emitted += length;
+	return length;
+}
+
+static bool Pulse( PulseDecoder *d, uint32_t pulse, uint32_t *length )
+{
+	d->level ^= 1;
+	*length = pulse;
+	return true;
+}
+
+// Sets the decoder up for the block it has reached, returns false if the block stops the tape
+static bool StartBlock( PulseDecoder *d )
+{
+	const TapeBlock *block = &d->blocks[d->block];
+	const uint8_t *body = block->body;
+
+	d->stage = STAGE_PAUSE;
+	d->pilot = PILOT_PULSE;
+	d->pilotCount = 0;
+	d->sync1 = 0;
+	d->sync2 = 0;
+	d->zero = ZERO_PULSE;
+	d->one = ONE_PULSE;
+	d->usedBits = 8;
+	d->pause = 0;
+	d->data = block->data;
+	d->dataSize = block->dataSize;
+	d->bit = 0;
+	d->pulse = 0;
+
+	switch( block->id )
+	{
+	case TZX_STANDARD:
+		d->pilotCount = block->dataSize > 0 && block->data[0] < 0x80 ? PILOT_HEADER : PILOT_DATA;
+		d->sync1 = SYNC1_PULSE;
+		d->sync2 = SYNC2_PULSE;
+		d->pause = body ? Read16( body ) : TAP_PAUSE_MS;
+		d->stage = STAGE_PILOT;
+		break;
+
+	case TZX_TURBO:
+		d->pilot = Read16( body );
+		d->sync1 = Read16( body + 2 );
+		d->sync2 = Read16( body + 4 );
+		d->zero = Read16( body + 6 );
+		d->one = Read16( body + 8 );
+		d->pilotCount = Read16( body + 10 );
+		d->usedBits = body[12];
+		d->pause = Read16( body + 13 );
+		d->stage = STAGE_PILOT;
+		break;
+
+	case TZX_PURE_TONE:
+		d->pilot = Read16( body );
+		d->pilotCount = Read16( body + 2 );
+		d->stage = STAGE_PILOT;
+		break;
+
+	case TZX_PULSES:
+		d->count = body[0];
+		d->data = body + 1;
+		d->stage = STAGE_PULSES;
+		break;
+
+	case TZX_PURE_DATA:
+		d->zero = Read16( body );
+		d->one = Read16( body + 2 );
+		d->usedBits = body[4];
+		d->pause = Read16( body + 5 );
+		d->stage = STAGE_DATA;
+		break;
+
+	case TZX_DIRECT:
+		d->pilot = Read16( body );
+		d->pause = Read16( body + 2 );
+		d->usedBits = body[4];
+		d->dataSize = Read24( body + 5 );
+		d->data = body + 8;
+		d->stage = STAGE_DIRECT;
+		break;
+
+	case TZX_PAUSE:
+		d->pause = Read16( body );
+		if( d->pause == 0 )
+			return false;
+		break;
+
+	case TZX_LOOP_START:
+		d->loopStart = d->block + 1;
+		d->loopCount = Read16( body );
+		break;
+
+	case TZX_LOOP_END:
+		if( d->loopCount > 1 )
+		{
+			d->loopCount--;
+			d->block = d->loopStart - 1;
+		}
+		break;
+
+	case TZX_STOP_48K:
+		return false;
+	}
+
+	if( d->usedBits == 0 || d->usedBits > 8 )
+		d->usedBits = 8;
+
+	return true;
+}
+
+static uint32_t DataBits( const PulseDecoder *d )
+{
+	return d->dataSize ? ( d->dataSize - 1 ) * 8 + d->usedBits : 0;
+}
+
+static uint8_t DataBit( const PulseDecoder *d, uint32_t bit )
+{
+	return ( d->data[bit >> 3] >> ( 7 - ( bit & 7 ) ) ) & 1;
+}
+
+// The next stretch of constant level, d->level holds the level. Returns false at
+// the end of the tape or a block that stops it.
+static bool NextSegment( PulseDecoder *d, uint32_t *length )
+{
+	while( true )
+	{
+		switch( d->stage )
+		{
+		case STAGE_BLOCK:
+			if( d->block >= d->blockCount )
+				return false;
+			if( !StartBlock( d ) )
+			{
+				d->block++;
+				return false;
+			}
+			break;
+
+		case STAGE_PILOT:
+			if( d->pilotCount > 0 )
+			{
+				d->pilotCount--;
+				return Pulse( d, d->pilot, length );
+			}
+			d->stage = STAGE_SYNC1;
+			break;
+
+		case STAGE_SYNC1:
+			d->stage = STAGE_SYNC2;
+			if( d->sync1 )
+				return Pulse( d, d->sync1, length );
+			break;
+
+		case STAGE_SYNC2:
+			d->stage = STAGE_DATA;
+			if( d->sync2 )
+				return Pulse( d, d->sync2, length );
+			break;
+
+		case STAGE_DATA:
+			if( d->bit < DataBits( d ) )
+			{
+				// Two pulses a bit
+				uint32_t pulse = DataBit( d, d->bit ) ? d->one : d->zero;
+				if( ++d->pulse == 2 )
+				{
+					d->pulse = 0;
+					d->bit++;
+				}
+				return Pulse( d, pulse, length );
+			}
+			d->stage = STAGE_PAUSE;
+			break;
+
+		case STAGE_PULSES:
+			if( d->bit < d->count )
+				return Pulse( d, Read16( d->data + 2 * d->bit++ ), length );
+			d->stage = STAGE_PAUSE;
+			break;
+
+		case STAGE_DIRECT:
+			if( d->bit < DataBits( d ) )
+			{
+				// Levels are given sample by sample, runs of the same level make one segment
+				uint8_t sample = DataBit( d, d->bit );
+				uint32_t run = 0;
+				while( d->bit < DataBits( d ) && DataBit( d, d->bit ) == sample )
+				{
+					run++;
+					d->bit++;
+				}
+				d->level = sample;
+				*length = run * d->pilot;
+				return true;
+			}
+			d->stage = STAGE_PAUSE;
+			break;
+
+		case STAGE_PAUSE:
+			d->stage = STAGE_BLOCK;
+			d->block++;
+			if( d->pause > 0 )
+			{
+				d->level = 0;
+				*length = d->pause * TSTATES_PER_MS;
+				return true;
+			}
+			break;
+		}
+	}
+}
+
+// First channel only, centred and scaled to 8 bits
+static int WavSample( const WavReader *r )
+{
+	return r->wide ? (int16_t)Read16( r->p ) >> 8 : r->p[0] - 128;
+}
+
+// A run of samples on the same side of the centre
+static bool NextWavSegment( WavReader *r, TapeSegment *segment )
+{
+	if( r->p >= r->end )
+		return false;
+
+	while( r->p < r->end )
+	{
+		int sample = WavSample( r );
+		if( ( r->level && sample < -WAV_HYSTERESIS ) || ( !r->level && sample > WAV_HYSTERESIS ) )
+			break;
+
+		r->p += r->frameBytes;
+		r->clock.time += r->clock.step;
+	}
+
+	segment->length = ClockSegment( &r->clock );
+	segment->level = r->level;
+	r->level ^= 1;
+	return true;
+}
+
+static bool CswByte( CswReader *r, uint8_t *value )
+{
+	if( !r->compressed )
+	{
+		if( r->p >= r->end )
+			return false;
+		*value = *r->p++;
+		return true;
+	}
+
+	while( r->bufferOffset == r->bufferSize )
+	{
+		if( r->finished )
+			return false;
+
+		r->stream.next_out = r->buffer;
+		r->stream.avail_out = CSW_BUFFER_SIZE;
+
+		int result = inflate( &r->stream, Z_NO_FLUSH );
+		if( result != Z_OK && result != Z_STREAM_END )
+			return false;
+
+		r->finished = result == Z_STREAM_END;
+		r->bufferSize = CSW_BUFFER_SIZE - r->stream.avail_out;
+		r->bufferOffset = 0;
+	}
+
+	*value = r->buffer[r->bufferOffset++];
+	return true;
+}
+
+// Each RLE entry is a pulse of that many samples, zero escapes a 32-bit count
+static bool NextCswSegment( CswReader *r, TapeSegment *segment )
+{
+	uint8_t bytes[4];
+	if( !CswByte( r, &bytes[0] ) )
+		return false;
+
+	uint32_t samples = bytes[0];
+	if( samples == 0 )
+	{
+		for( int i = 0; i < 4; i++ )
+		{
+			if( !CswByte( r, &bytes[i] ) )
+				return false;
+		}
+		samples = Read32( bytes );
+	}
+
+	r->clock.time += samples * r->clock.step;
+
+	segment->length = ClockSegment( &r->clock );
+	segment->level = r->level;
+	r->level ^= 1;
+	return true;
+}
+
+static bool Decode( TapeSegment *segment )
+{
+	switch( s_format )
+	{
+	case TAPE_FORMAT_WAV:
+		segment->block = 0;
+		return NextWavSegment( &s_wav, segment );
+
+	case TAPE_FORMAT_CSW:
+		segment->block = 0;
+		return NextCswSegment( &s_csw, segment );
+
+	default:
+		break;
+	}
+
+	if( !NextSegment( &s_pulses, &segment->length ) )
+		return false;
+
+	segment->block = s_pulses.block;
+	segment->level = s_pulses.level;
+	return true;
+}
+
+// Keeps the ring topped up, touching the mapped file well before the emulation needs it
+static void DecodeThread()
+{
+	TapeSegment segment;
+
+	while( !s_quit.load( std::memory_order_relaxed ) )
+	{
+		uint32_t head = s_head.load( std::memory_order_relaxed );
+		if( head - s_tail.load( std::memory_order_acquire ) == TAPE_RING_SIZE )
+		{
+			std::this_thread::sleep_for( std::chrono::milliseconds( TAPE_FULL_SLEEP_MS ) );
+			continue;
+		}
+
+		if( !Decode( &segment ) )
+		{
+			s_endBlock = s_format == TAPE_FORMAT_TAP || s_format == TAPE_FORMAT_TZX ? s_pulses.block : 0;
+			break;
+		}
+
+		s_ring[head & ( TAPE_RING_SIZE - 1 )] = segment;
+		s_head.store( head + 1, std::memory_order_release );
+	}
+
+	s_done.store( true, std::memory_order_release );
+}
+
+void TapeStream_Start( TapeFormat format, const uint8_t *data, size_t size, const TapeBlock *blocks, int blockCount, int firstBlock )
+{
+	TapeStream_Stop();
+
+	s_format = format;
+
+	if( format == TAPE_FORMAT_WAV )
+	{
+		WavInfo info;
+		if( !ParseWAV( data, size, &info ) )
+			info.size = 0;
+
+		s_wav.p = info.samples;
+		s_wav.end = info.samples + info.size;
+		s_wav.frameBytes = info.frameBytes;
+		s_wav.wide = info.bits == 16;
+		s_wav.level = 0;
+		StartClock( &s_wav.clock, info.rate );
+	}
+	else if( format == TAPE_FORMAT_CSW )
+	{
+		CswInfo info;
+		if( !ParseCSW( data, size, &info ) )
+			info.size = 0;
+
+		s_csw.p = info.pulses;
+		s_csw.end = info.pulses + info.size;
+		s_csw.compressed = info.compressed;
+		s_csw.finished = false;
+		s_csw.bufferSize = 0;
+		s_csw.bufferOffset = 0;
+		s_csw.level = info.level;
+		StartClock( &s_csw.clock, info.rate );
+
+		if( info.compressed )
+		{
+			memset( &s_csw.stream, 0, sizeof( z_stream ) );
+			s_csw.stream.next_in = (Bytef *)info.pulses;
+			s_csw.stream.avail_in = (uInt)info.size;
+			s_csw.finished = inflateInit( &s_csw.stream ) != Z_OK;
+		}
+	}
+	else
+	{
+		memset( &s_pulses, 0, sizeof( s_pulses ) );
+		s_pulses.blocks = blocks;
+		s_pulses.blockCount = blockCount;
+		s_pulses.block = firstBlock;
+		s_pulses.stage = STAGE_BLOCK;
+	}
+
+	s_head = 0;
+	s_tail = 0;
+	s_done = false;
+	s_quit = false;
+
+	s_thread = std::thread( DecodeThread );
+}
+
+void TapeStream_Stop()
+{
+	if( !s_thread.joinable() )
+		return;
+
+	s_quit = true;
+	s_thread.join();
+
+	if( s_format == TAPE_FORMAT_CSW && s_csw.compressed )
+		inflateEnd( &s_csw.stream );
+}
+
+bool TapeStream_Next( TapeSegment *segment )
+{
+	if( !s_thread.joinable() )
+	{
+		segment->block = 0;
+		return false;
+	}
+
+	uint32_t tail = s_tail.load( std::memory_order_relaxed );
+
+	// The decoder only falls behind on a very slow host, wait rather than play it wrong
+	while( tail == s_head.load( std::memory_order_acquire ) )
+	{
+		if( s_done.load( std::memory_order_acquire ) && tail == s_head.load( std::memory_order_acquire ) )
+		{
+			segment->block = s_endBlock;
+			return false;
+		}
+		std::this_thread::yield();
+	}
+
+	*segment = s_ring[tail & ( TAPE_RING_SIZE - 1 )];
+	s_tail.store( tail + 1, std::memory_order_release );
+	return true;
+}
@@ -0,0 +1,50 @@
+#if !defined( TAPESTREAM_H )
+#define TAPESTREAM_H 1
+
+#include <stdint.h>
+#include <stddef.h>
+
+enum TapeFormat
+{
+	TAPE_FORMAT_TAP,
+	TAPE_FORMAT_TZX,
+	TAPE_FORMAT_WAV,
+	TAPE_FORMAT_CSW,
+};
+
+struct TapeBlock
+{
+	uint8_t id;
+
+	// The TZX block after its ID, NULL for .tap
+	const uint8_t *body;
+
+	// Flag, data and checksum as LD-BYTES sees them, empty for blocks without data
+	const uint8_t *data;
+	uint32_t dataSize;
+};
+
+// A stretch of constant EAR level
+struct TapeSegment
+{
+	uint32_t length;
+	int block;
+	uint8_t level;
+};
+
+// Works out the format from the file contents. WAV and CSW headers are checked
+// here, anything not recognised is taken to be .tap.
+TapeFormat TapeStream_Detect( const uint8_t *data, size_t size );
+
+// Decodes a tape into segments on a background thread, a bounded ring's worth
+// ahead of the reader. Blocks are only used for .tap and .tzx, which start at
+// firstBlock, the sampled formats always start from the beginning. The data and
+// blocks must stay valid until the stream is stopped.
+void TapeStream_Start( TapeFormat format, const uint8_t *data, size_t size, const TapeBlock *blocks, int blockCount, int firstBlock );
+void TapeStream_Stop();
+
+// The next segment, without locking. Returns false at the end of the tape or a
+// block that stops it, with segment->block the block to carry on from.
+bool TapeStream_Next( TapeSegment *segment );
+
+#endif // TAPESTREAM_H
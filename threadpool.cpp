@@ -0,0 +1,139 @@
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
+#include <stdint.h>
+
+#include "threadpool.h"
+
+static std::vector<std::thread> s_threads;
+static std::mutex s_mutex;
+static std::condition_variable s_wake;
+static std::condition_variable s_done;
+
+static ThreadPoolJob s_job = NULL;
+static void *s_context = NULL;
+static int s_count = 0;
+// The generation in the top 32 bits and the next index in the bottom, so a worker
+// still holding an earlier Run's job can never take an index from a later one
+static std::atomic<uint64_t> s_next( 0 );
+static std::atomic<int> s_completed( 0 );
+static int s_active = 0;
+static uint32_t s_generation = 0;
+static bool s_quit = false;
+
+static void DoWork( ThreadPoolJob job, void *context, int count, uint32_t generation )
+{
+	uint64_t next = s_next.load();
+	while( true )
+	{
+		if( (uint32_t)( next >> 32 ) != generation || (uint32_t)next >= (uint32_t)count )
+			break;
+		if( !s_next.compare_exchange_weak( next, next + 1 ) )
+			continue;
+
+		int index = (int)(uint32_t)next;
+		job( context, index );
+		s_completed.fetch_add( 1 );
+		next = s_next.load();
+	}
+}
+
+static void WorkerThread()
+{
+	uint32_t generation = 0;
+
+	while( true )
+	{
+		ThreadPoolJob job;
+		void *context;
+		int count;
+
+		{
+			std::unique_lock<std::mutex> lock( s_mutex );
+			s_wake.wait( lock, [&]{ return s_quit || s_generation != generation; } );
+			if( s_quit )
+				return;
+
+			generation = s_generation;
+			job = s_job;
+			context = s_context;
+			count = s_count;
+			s_active++;
+		}
+
+		DoWork( job, context, count, generation );
+
+		{
+			std::lock_guard<std::mutex> lock( s_mutex );
+			s_active--;
+			s_done.notify_all();
+		}
+	}
+}
+
+void ThreadPool_Init( int threadCount )
+{
+	if( threadCount <= 0 )
+		threadCount = std::thread::hardware_concurrency();
+
+	s_quit = false;
+
+	// The calling thread is one of the workers
+	for( int i = 1; i < threadCount; i++ )
+	{
+		s_threads.push_back( std::thread( WorkerThread ) );
+	}
+}
+
+void ThreadPool_Shutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock( s_mutex );
+		s_quit = true;
+		s_wake.notify_all();
+	}
+
+	for( size_t i = 0; i < s_threads.size(); i++ )
+	{
+		s_threads[i].join();
+	}
+	s_threads.clear();
+}
+
+int ThreadPool_ThreadCount()
+{
+	return (int)s_threads.size() + 1;
+}
+
+void ThreadPool_Run( ThreadPoolJob job, void *context, int count )
+{
+	if( count <= 0 )
+		return;
+
+	if( s_threads.empty() || count == 1 )
+	{
+		for( int i = 0; i < count; i++ )
+			job( context, i );
+		return;
+	}
+
+	uint32_t generation;
+	{
+		std::lock_guard<std::mutex> lock( s_mutex );
+		s_job = job;
+		s_context = context;
+		s_count = count;
+		s_completed = 0;
+		s_generation++;
+		s_next = (uint64_t)s_generation << 32;
+		generation = s_generation;
+		s_wake.notify_all();
+	}
+
+	DoWork( job, context, count, generation );
+
+	std::unique_lock<std::mutex> lock( s_mutex );
+	s_done.wait( lock, [&]{ return s_completed.load() == count && s_active == 0; } );
+}
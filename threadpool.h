@@ -0,0 +1,15 @@
+#if !defined( THREADPOOL_H )
+#define THREADPOOL_H 1
+
+typedef void (*ThreadPoolJob)( void *context, int index );
+
+// threadCount of 0 uses one thread per hardware core
+void ThreadPool_Init( int threadCount );
+void ThreadPool_Shutdown();
+int ThreadPool_ThreadCount();
+
+// Calls job( context, i ) for i in [0, count) across the pool, the calling
+// thread takes part. Returns once every index has completed.
+void ThreadPool_Run( ThreadPoolJob job, void *context, int count );
+
+#endif // THREADPOOL_H
@@ -109,6 +109,21 @@ struct ZMemory
 	uint16_t base;
 	uint32_t size;
 	uint8_t *ptr;
+	bool contended;
+};
+
+#define Z_PAGE_SHIFT 10
+#define Z_PAGE_SIZE ( 1 << Z_PAGE_SHIFT )
+#define Z_PAGE_MASK ( Z_PAGE_SIZE - 1 )
+#define Z_PAGE_COUNT ( 0x10000 >> Z_PAGE_SHIFT )
+
+// Memory is accessed through a page table built from the memory regions by
+// Z80_MapMemory. Pages without a write pointer are read only unless
+// WriteFault supplies one.
+struct ZPage
+{
+	uint8_t *read;
+	uint8_t *write;
 };
 
 struct ZState
@@ -136,8 +151,31 @@ struct ZState
 
 	int memoryCount;
 	ZMemory memory[8];
+
+	ZPage page[Z_PAGE_COUNT];
+
+	// A bit per page, set for contended regions by Z80_MapMemory. While contention is
+	// set each access to a contended page, and each port access, is delayed by its entry
+	// for the T-state the access starts on. access counts down with cycles through the
+	// instruction, 4 for an opcode fetch and 3 for other accesses. contention points at
+	// the entry for cycles reaching 0, so an access's entry is contention[-access].
+	// Z80_Run only keeps access, in a separate build of the core, while contention is set.
+	uint64_t contended;
+	const uint8_t *contention;
+	int access;
+
+	// Returns the page to write through for address, or NULL to discard the write
+	uint8_t *(*WriteFault)( ZState *, uint16_t address );
+
+	// Optional, a bit per address. Trap is called before fetching an opcode from a set
+	// address and returns true if it has done the work itself and moved PC on.
+	const uint32_t *traps;
+	bool (*Trap)( ZState * );
 };
 
+#define Z_TRAP_WORDS ( 0x10000 / 32 )
+#define Z_TRAP_TEST(traps,address) ( ( (traps)[(address) >> 5] >> ( (address) & 31 ) ) & 1 )
+
 void Z80_Reset( ZState *Z );
 void Z80_Init( ZState *Z );
 void Z80_Run( ZState *Z, int cycles );
@@ -146,6 +184,13 @@ void Z80_NonMaskableInterrupt( ZState *Z );
 
 void Z80_SnapshotResume( ZState *Z );
 
+// Memory access through the page table, for code working on the machine's behalf
+uint8_t Z80_ReadMemory( ZState *Z, uint16_t address );
+void Z80_WriteMemory( ZState *Z, uint16_t address, uint8_t value );
+
+// Rebuilds the page table from the memory regions, which must be page aligned
+void Z80_MapMemory( ZState *Z );
+
 
 #endif // !defined( Z80_H )
 
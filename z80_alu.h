@@ -1,5 +1,4 @@
-#if !defined( Z80_ALU_H )
-#define Z80_ALU_H 1
+// Part of the core, included by z80_exec.h once for each build of it
 
 void SetParity( ZState *Z, uint8_t v )
 {
@@ -234,6 +233,3 @@ void BitTest( ZState *Z, int bit, uint8_t v, uint8_t flagMask )
 	if( ( v & mask ) == 0 )
 		Z->reg.F |= M_Z | M_P;
 }
-	
-#endif // Z80_ALU_H
-
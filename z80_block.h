@@ -1,5 +1,4 @@
-#if !defined( Z80_BLOCK_H )
-#define Z80_BLOCK_H 1
+// Part of the core, included by z80_exec.h once for each build of it
 
 bool Ldd( ZState *Z )
 {
@@ -106,6 +105,3 @@ bool Cpi( ZState *Z )
 
 	return false;
 }
-
-
-#endif // Z80_BLOCK_H
@@ -1,5 +1,4 @@
-#if !defined( Z80_BRANCH_H )
-#define Z80_BRANCH_H 1
+// Part of the core, included by z80_exec.h once for each build of it
 
 void Jump( ZState *Z, uint8_t cond )
 {
@@ -42,6 +41,3 @@ void JumpRelative( ZState *Z, uint8_t cond )
 		Z->reg.PC = Z->reg.PC + addr;
 	}
 }
-
-
-#endif // Z80_BRANCH_H
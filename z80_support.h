@@ -1,5 +1,4 @@
-#if !defined( Z80_SUPPORT_H )
-#define Z80_SUPPORT_H 1
+// Part of the core, included by z80_exec.h once for each build of it
 
 uint8_t ReadPC8( ZState *Z )
 {
@@ -121,5 +120,3 @@ void Exchange( ZState *Z )
 	Z->sreg.DE = r.DE;
 	Z->sreg.HL = r.HL;
 }
-
-#endif // Z80_SUPPORT_H
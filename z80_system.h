@@ -1,47 +1,64 @@
-#if !defined( Z80_SYSTEM_H )
-#define Z80_SYSTEM_H 1
+// Part of the core, included by z80_exec.h once for each build of it
 
-uint8_t Read8( ZState *Z, uint16_t address )
+#define CONTENDED( Z, address ) ( ( ( Z )->contended >> ( ( address ) >> Z_PAGE_SHIFT ) ) & 1 )
+
+void Contend( ZState *Z )
+{
+	int delay = Z->contention[-Z->access];
+	Z->access -= delay;
+	Z->cycles -= delay;
+}
+
+uint8_t Load8( ZState *Z, uint16_t address )
+{
+	return Z->page[address >> Z_PAGE_SHIFT].read[address & Z_PAGE_MASK];
+}
+
+void Store8( ZState *Z, uint16_t address, uint8_t value )
 {
-	uint8_t value;
-	for( int i = 0; i < Z->memoryCount; i++ )
+	uint8_t *ptr = Z->page[address >> Z_PAGE_SHIFT].write;
+	if( ptr == NULL )
 	{
-		if( Z->memory[i].base > address )
-			continue;
+		if( Z->WriteFault == NULL )
+			return;
 
-		uint16_t ofs = address - Z->memory[i].base;
+		ptr = Z->WriteFault( Z, address );
+		if( ptr == NULL )
+			return;
+	}
 
-		if( ofs >= Z->memory[i].size )
-			continue;
+	ptr[address & Z_PAGE_MASK] = value;
+}
 
-		value = Z->memory[i].ptr[ofs];
-		break;
+inline uint8_t Read8( ZState *Z, uint16_t address )
+{
+	// Only the contended build keeps time through the instruction
+	if( Z_CONTENDED )
+	{
+		if( CONTENDED( Z, address ) )
+			Contend( Z );
+		Z->access -= 3;
 	}
 
+	uint8_t value = Load8( Z, address );
+
 	MEM_PRINT( "Read 0x%04x -> 0x%02x\n", address, value );
 
 	return value;
 }
 
-void Write8( ZState *Z, uint16_t address, uint8_t value )
+inline void Write8( ZState *Z, uint16_t address, uint8_t value )
 {
 	MEM_PRINT( "Write 0x%04x <- 0x%02x\n", address, value );
-	for( int i = 0; i < Z->memoryCount; i++ )
-	{
-		if( Z->memory[i].type == MEM_ROM )
-			continue;
-
-		if( Z->memory[i].base > address )
-			continue;
-
-		uint16_t ofs = address - Z->memory[i].base;
 
-		if( ofs >= Z->memory[i].size )
-			continue;
-
-		Z->memory[i].ptr[ofs] = value;
-		break;
+	if( Z_CONTENDED )
+	{
+		if( CONTENDED( Z, address ) )
+			Contend( Z );
+		Z->access -= 3;
 	}
+
+	Store8( Z, address, value );
 }
 
 uint16_t Read16( ZState *Z, uint16_t address )
@@ -56,8 +73,47 @@ void Write16( ZState *Z, uint16_t address, uint16_t value )
 	Write8( Z, address + 1, value >> 8 );
 }
 
+// The ULA's pattern over the 4 T-states of a port access. Ports with A0 low are its
+// own and are contended from the second T-state, and ports that look like contended
+// addresses are contended as memory would be, on every T-state if not the ULA's.
+void ContendPort( ZState *Z, uint16_t addr )
+{
+	const uint8_t *contention = Z->contention;
+	bool ula = ( addr & 1 ) == 0;
+	int t = -Z->access;
+
+	if( CONTENDED( Z, addr ) )
+	{
+		t += contention[t] + 1;
+		if( ula )
+		{
+			t += contention[t] + 3;
+		}
+		else
+		{
+			for( int i = 0; i < 3; i++ )
+				t += contention[t] + 1;
+		}
+	}
+	else if( ula )
+	{
+		t += 1;
+		t += contention[t] + 3;
+	}
+	else
+	{
+		t += 4;
+	}
+
+	Z->cycles -= t + Z->access - 4;
+	Z->access = -t;
+}
+
 uint8_t ReadPort( ZState *Z, uint16_t addr )
 {
+	if( Z_CONTENDED )
+		ContendPort( Z, addr );
+
 	for( int i = 0; i < Z->peripheralCount; i++ )
 	{
 		if( Z->peripheral[i].Read == NULL )
@@ -72,6 +128,9 @@ uint8_t ReadPort( ZState *Z, uint16_t addr )
 
 void WritePort( ZState *Z, uint16_t addr, uint8_t value )
 {
+	if( Z_CONTENDED )
+		ContendPort( Z, addr );
+
 	for( int i = 0; i < Z->peripheralCount; i++ )
 	{
 		if( Z->peripheral[i].Write == NULL )
@@ -81,6 +140,3 @@ void WritePort( ZState *Z, uint16_t addr, uint8_t value )
 			return Z->peripheral[i].Write( Z, addr, value );
 	}
 }
-
-
-#endif // Z80_SYSTEM_H
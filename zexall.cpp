@@ -58,6 +58,7 @@ int main( int argc, char *argv[] )
 	Z.memory[0].type = MEM_RAM;
 	Z.memory[0].ptr = ram;
 	Z.memoryCount = 1;
+	Z80_MapMemory( &Z );
 
 	ram[5] = OUT_RN_A;
 	ram[6] = 0xff;